@@ -0,0 +1,11 @@
+#!/bin/sh
+# Like random.sh, but valid UTF-8 text: lines of ASCII, Latin, CJK and
+# emoji, in runs of one script each, for the text insertion paths.
+perl -CO -e '
+        srand(23);
+        my @scripts = ([0x21, 0x5e], [0xc0, 0x17f], [0x4e00, 0x51a0], [0x1f300, 0x1f5ff]);
+        for (1 .. ($ARGV[0] || 200000)) {
+                my $s = $scripts[int(rand(@scripts))];
+                print join("", map { chr($s->[0] + int(rand($s->[1] - $s->[0]))) } 1 .. 1 + int(rand(120))), "\n";
+        }
+' "$@"
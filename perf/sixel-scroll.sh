@@ -0,0 +1,25 @@
+#!/usr/bin/env bash
+
+# Images among lines of text, the way plotting scripts or image previews
+# fill the scrollback. Run it in the terminal, or feed its output to
+# src/image-bench.
+
+cnt=$1
+[ -n "$cnt" ] || cnt=200
+
+lines=$2
+[ -n "$lines" ] || lines=5
+
+images=("$(dirname "$0")"/sixel-*.six)
+
+x=0
+while [ $x -lt $cnt ]; do
+	y=0
+	while [ $y -lt $lines ]; do
+		echo "$x.$y"
+		y=$(($y + 1))
+	done
+	cat "${images[$(($x % ${#images[@]}))]}"
+	echo
+	x=$(($x + 1))
+done
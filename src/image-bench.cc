@@ -0,0 +1,625 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <cairo.h>
+#include <locale.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+#include <cerrno>
+#include <cstdlib>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "ring.hh"
+#include "sixel.h"
+#include "vtedefines.hh"
+#include "vteimage.h"
+#include "vteimageindex.h"
+
+/* Feeds its input to a ring the way the terminal does, without a display:
+ * every newline adds a row, every DECSIXEL image is appended as tiles with
+ * _vte_ring_append_image(), and after each image the images that left the
+ * view are frozen, the ones out of the scrollback or over the frozen limit
+ * are removed, and a frame is painted into an offscreen image surface.
+ * Then the view is scrolled through the scrollback, a page at a time, up
+ * and back down, thawing and freezing the images on the way.
+ *
+ * Each operation is timed on its own, and the latency percentiles are
+ * printed at the end, along with the peak RSS.
+ */
+
+using namespace vte::image;
+
+enum {
+        OP_APPEND,     /* create_tiles() and _vte_ring_append_image() for one image */
+        OP_FREEZE,     /* image_object::freeze() for one image */
+        OP_THAW,       /* image_object::thaw() for one image */
+        OP_COMPOSITE,  /* painting a frame while the input is fed */
+        OP_SCROLL,     /* painting a frame while scrolling, thawing included */
+        OP_EVICT,      /* removing images, as Terminal::maybe_remove_images() does */
+        N_OPS
+};
+
+static char const* const op_names[N_OPS] = {
+        "append",
+        "freeze",
+        "thaw",
+        "composite",
+        "scroll",
+        "evict",
+};
+
+static inline int64_t
+now_ns() noexcept
+{
+        return std::chrono::duration_cast<std::chrono::nanoseconds>
+                (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class Bench {
+private:
+        bool m_quiet;
+        int m_columns;
+        int m_rows;
+        int m_cell_width;
+        int m_cell_height;
+        gsize m_frozen_limit;
+        VteRing* m_ring;
+        cairo_surface_t* m_target; /* stands in for the widget's window */
+        glong m_cursor_row{0};
+        glong m_view_top{0};
+        std::vector<int64_t> m_latencies[N_OPS];
+        gsize m_images{0};
+        gsize m_errors{0};
+
+        inline void
+        record(int op,
+               int64_t start)
+        {
+                m_latencies[op].push_back(now_ns() - start);
+        }
+
+        void
+        line_feed()
+        {
+                m_cursor_row++;
+                while ((glong)_vte_ring_next(m_ring) <= m_cursor_row)
+                        _vte_ring_append(m_ring, 0);
+
+                /* The view follows the cursor */
+                m_view_top = std::max(m_cursor_row - m_rows + 1, (glong)_vte_ring_delta(m_ring));
+        }
+
+        void
+        freeze_images(std::vector<image_object*> const& images)
+        {
+                for (auto image : images) {
+                        if (image->is_freezed())
+                                continue;
+
+                        auto const start = now_ns();
+                        auto const size = image->get_charged_size();
+                        image->freeze();
+                        if (image->is_freezed()) {
+                                m_ring->image_onscreen_resource_counter -= size;
+                                m_ring->image_offscreen_resource_counter += image->charge();
+                        }
+                        record(OP_FREEZE, start);
+                }
+        }
+
+        /* Paints the images in the view starting at row @top, as
+         * Terminal::widget_draw() does for an undamaged frame.
+         */
+        void
+        draw_frame(glong top,
+                   int op)
+        {
+                auto const start = now_ns();
+                auto cr = cairo_create(m_target);
+                auto images = std::vector<image_object*>{};
+
+                m_ring->image_index->find_overlapping(top, top + m_rows - 1, images);
+                for (auto image : images) {
+                        if (image->is_freezed()) {
+                                auto const thaw_start = now_ns();
+                                auto const size = image->get_charged_size();
+                                if (!image->thaw())
+                                        continue;
+                                m_ring->image_offscreen_resource_counter -= size;
+                                m_ring->image_onscreen_resource_counter += image->charge();
+                                record(OP_THAW, thaw_start);
+                        }
+
+                        image->materialize(nullptr);
+                        auto const size = image->get_charged_size();
+                        image->paint(cr,
+                                     image->get_left() * m_cell_width,
+                                     (image->get_top() - top) * m_cell_height,
+                                     m_cell_width, m_cell_height);
+                        m_ring->image_onscreen_resource_counter += image->charge() - size;
+                }
+
+                cairo_destroy(cr);
+                record(op, start);
+        }
+
+        /* The first two steps of Terminal::maybe_remove_images() */
+        void
+        remove_images()
+        {
+                auto const start = now_ns();
+                auto image_index = m_ring->image_index;
+                image_object* image;
+
+                while ((image = image_index->oldest()) != nullptr) {
+                        if (image->get_bottom() >= (glong)_vte_ring_delta(m_ring) &&
+                            m_ring->image_offscreen_resource_counter <= m_frozen_limit)
+                                break;
+
+                        if (image->is_freezed())
+                                m_ring->image_offscreen_resource_counter -= image->get_charged_size();
+                        else
+                                m_ring->image_onscreen_resource_counter -= image->get_charged_size();
+                        image_index->remove(image);
+                        delete image;
+                }
+
+                record(OP_EVICT, start);
+        }
+
+        void
+        load_image(char const* filename,
+                   int const* params,
+                   int nparams,
+                   guchar const* body,
+                   guchar const* bodyend,
+                   bool report)
+        {
+                sixel_state_t st;
+                int pixelwidth, pixelheight;
+                unsigned int palette[DECSIXEL_PALETTE_MAX];
+
+                if (sixel_parser_init(&st, 0xffffff, 0x000000, 1) < 0) {
+                        sixel_parser_deinit(&st);
+                        m_errors++;
+                        return;
+                }
+
+                sixel_parser_start(&st, params, nparams);
+                if (sixel_parser_parse(&st, body, bodyend - body) < 0 ||
+                    sixel_parser_finalize(&st, &pixelwidth, &pixelheight) < 0 ||
+                    pixelwidth <= 0 || pixelheight <= 0) {
+                        if (report)
+                                g_printerr("%s: Decoder error in image %" G_GSIZE_FORMAT "\n",
+                                           filename, m_images);
+                        sixel_parser_deinit(&st);
+                        m_errors++;
+                        return;
+                }
+
+                /* As Terminal::seq_load_sixel() does */
+                auto indexed = std::make_shared<indexed_image>();
+                auto const ncolors = sixel_parser_get_palette(&st, palette);
+                indexed->width = pixelwidth;
+                indexed->height = pixelheight;
+                indexed->index_size = ncolors <= 256 ? 1 : 2;
+                indexed->palette.assign(palette, palette + ncolors);
+                indexed->indices.resize((gsize)pixelwidth * pixelheight * indexed->index_size);
+                sixel_parser_render_indices(&st,
+                                            indexed->indices.data(),
+                                            pixelwidth * indexed->index_size,
+                                            indexed->index_size,
+                                            pixelwidth, 0, pixelheight);
+                sixel_parser_deinit(&st);
+
+                auto const height = (pixelheight + m_cell_height - 1) / m_cell_height;
+                auto const old_view_top = m_view_top;
+
+                auto const start = now_ns();
+                for (auto tile : image_object::create_tiles(std::move(indexed), 0, m_cursor_row,
+                                                            m_cell_width, m_cell_height,
+                                                            m_ring->image_store))
+                        _vte_ring_append_image(m_ring, tile, m_cell_width, m_cell_height);
+                record(OP_APPEND, start);
+                m_images++;
+
+                for (auto i = 0; i < height; ++i)
+                        line_feed();
+
+                /* What scrolled out of the view */
+                auto images = std::vector<image_object*>{};
+                m_ring->image_index->find_by_bottom(old_view_top, m_view_top - 1, images);
+                freeze_images(images);
+
+                remove_images();
+                draw_frame(m_view_top, OP_COMPOSITE);
+
+                if (report && !m_quiet)
+                        g_print("%s: image %" G_GSIZE_FORMAT ": %dx%d, %d colors\n",
+                                filename, m_images, pixelwidth, pixelheight, ncolors);
+        }
+
+        /* Finds the newlines and the DECSIXEL sequences in @data.
+         * Anything else is skipped.
+         */
+        void
+        process_data(char const* filename,
+                     guchar const* data,
+                     gsize size,
+                     bool report)
+        {
+                auto const end = data + size;
+                auto p = data;
+                while (p < end) {
+                        if (*p == '\n') {
+                                line_feed();
+                                p++;
+                                continue;
+                        }
+
+                        /* DCS is either ESC P or the C1 control */
+                        if (*p == 0x1b && p + 1 < end && p[1] == 'P')
+                                p += 2;
+                        else if (*p == 0x90)
+                                p += 1;
+                        else {
+                                p++;
+                                continue;
+                        }
+
+                        int params[DECSIXEL_PARAMS_MAX];
+                        int nparams = 0;
+                        int param = -1;
+                        for (; p < end; ++p) {
+                                if (*p >= '0' && *p <= '9') {
+                                        param = std::min(std::max(param, 0) * 10 + (*p - '0'),
+                                                         DECSIXEL_PARAMVALUE_MAX);
+                                } else if (*p == ';') {
+                                        if (nparams < DECSIXEL_PARAMS_MAX)
+                                                params[nparams++] = std::max(param, 0);
+                                        param = -1;
+                                } else
+                                        break;
+                        }
+                        if (param >= 0 && nparams < DECSIXEL_PARAMS_MAX)
+                                params[nparams++] = param;
+
+                        /* Not a DECSIXEL, skip it */
+                        if (p == end || *p != 'q')
+                                continue;
+                        ++p;
+
+                        auto bodyend = p;
+                        while (bodyend < end &&
+                               *bodyend != 0x1b && *bodyend != 0x9c &&
+                               *bodyend != 0x18 && *bodyend != 0x1a)
+                                ++bodyend;
+
+                        load_image(filename, params, nparams, p, bodyend, report);
+                        p = bodyend;
+                }
+        }
+
+        bool
+        process_file(char const* filename,
+                     int fd,
+                     int repeat)
+        {
+                auto data = g_byte_array_new();
+
+                gsize const buf_size = 16384;
+                guchar* buf = g_new0(guchar, buf_size);
+
+                bool rv = true;
+                for (;;) {
+                        auto len = read(fd, buf, buf_size);
+                        if (!len)
+                                break;
+                        if (len == -1) {
+                                if (errno == EAGAIN || errno == EINTR)
+                                        continue;
+                                g_printerr("Error reading %s: %m\n", filename);
+                                rv = false;
+                                break;
+                        }
+                        g_byte_array_append(data, buf, len);
+                }
+                g_free(buf);
+
+                for (auto i = 0; rv && i < repeat; ++i)
+                        process_data(filename, data->data, data->len, i == 0);
+
+                g_byte_array_unref(data);
+                return rv;
+        }
+
+public:
+
+        Bench(bool quiet,
+              int columns,
+              int rows,
+              int cell_width,
+              int cell_height,
+              int scrollback,
+              gsize frozen_limit)
+                : m_quiet{quiet},
+                  m_columns{std::max(columns, 1)},
+                  m_rows{std::max(rows, 1)},
+                  m_cell_width{std::max(cell_width, 1)},
+                  m_cell_height{std::max(cell_height, 1)},
+                  m_frozen_limit{frozen_limit}
+        {
+                /* As for the normal screen, with streams */
+                m_ring = new VteRing(std::max(scrollback, 0) + m_rows, true);
+                _vte_ring_append(m_ring, 0);
+
+                m_target = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+                                                      m_columns * m_cell_width,
+                                                      m_rows * m_cell_height);
+        }
+
+        ~Bench()
+        {
+                cairo_surface_destroy(m_target);
+                delete m_ring;
+        }
+
+        Bench(Bench const&) = delete;
+        Bench(Bench&&) = delete;
+
+        inline constexpr gsize errors() const noexcept { return m_errors; }
+
+        bool process_files(char const* const* filenames,
+                           int repeat)
+        {
+                bool r = true;
+                if (filenames != nullptr) {
+                        for (auto i = 0; filenames[i] != nullptr; i++) {
+                                char const* filename = filenames[i];
+
+                                int fd = -1;
+                                if (g_str_equal(filename, "-")) {
+                                        fd = STDIN_FILENO;
+                                } else {
+                                        fd = open(filename, O_RDONLY);
+                                        if (fd == -1) {
+                                                g_printerr("Error opening file %s: %m\n", filename);
+                                        }
+                                }
+                                if (fd != -1) {
+                                        r = process_file(filename, fd, repeat);
+                                        if (fd != STDIN_FILENO)
+                                                close(fd);
+                                        if (!r)
+                                                break;
+                                }
+                        }
+                } else {
+                        r = process_file("-", STDIN_FILENO, repeat);
+                }
+
+                return r;
+        }
+
+        /* Scrolls the view up to the top of the scrollback and back down
+         * to the bottom, a page at a time.
+         */
+        void scroll()
+        {
+                auto const first = (glong)_vte_ring_delta(m_ring);
+                auto const last = m_view_top;
+                auto images = std::vector<image_object*>{};
+
+                for (auto top = last; top > first; ) {
+                        auto const next = std::max(top - m_rows, first);
+                        draw_frame(next, OP_SCROLL);
+
+                        images.clear();
+                        m_ring->image_index->find_by_top(next + m_rows, top + m_rows - 1, images);
+                        freeze_images(images);
+                        top = next;
+                }
+
+                for (auto top = first; top < last; ) {
+                        auto const next = std::min(top + m_rows, last);
+                        draw_frame(next, OP_SCROLL);
+
+                        images.clear();
+                        m_ring->image_index->find_by_bottom(top, next - 1, images);
+                        freeze_images(images);
+                        top = next;
+                }
+        }
+
+        void print_benchmark() const
+        {
+                g_print("\nImages: %\'" G_GSIZE_FORMAT " errors %\'" G_GSIZE_FORMAT
+                        " kept %\'" G_GSIZE_FORMAT "\n",
+                        m_images, m_errors, m_ring->image_index->size());
+                g_print("Rows: %\'ld scrollback from %\'ld\n",
+                        (long)_vte_ring_next(m_ring), (long)_vte_ring_delta(m_ring));
+                g_print("Image bytes: onscreen %\'" G_GSIZE_FORMAT
+                        " offscreen %\'" G_GSIZE_FORMAT
+                        " store %\'" G_GSIZE_FORMAT "\n",
+                        m_ring->image_onscreen_resource_counter,
+                        m_ring->image_offscreen_resource_counter,
+                        m_ring->image_store->get_size());
+
+                g_print("\n%-10s %8s %10s %10s %10s %10s %10s\n",
+                        "op", "count", "p50 µs", "p90 µs", "p99 µs", "max µs", "total ms");
+                for (auto op = 0; op < N_OPS; ++op) {
+                        auto latencies = m_latencies[op];
+                        if (latencies.empty())
+                                continue;
+
+                        std::sort(latencies.begin(), latencies.end());
+                        auto const percentile = [&](int p) -> double {
+                                auto const i = std::min(latencies.size() * p / 100, latencies.size() - 1);
+                                return latencies[i] / 1000.;
+                        };
+                        int64_t total = 0;
+                        for (auto latency : latencies)
+                                total += latency;
+
+                        g_print("%-10s %8zu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                                op_names[op], latencies.size(),
+                                percentile(50), percentile(90), percentile(99),
+                                latencies.back() / 1000., total / 1e6);
+                }
+
+                struct rusage usage;
+                if (getrusage(RUSAGE_SELF, &usage) == 0)
+                        g_print("\nPeak RSS: %\'ld kB\n", (long)usage.ru_maxrss);
+        }
+
+}; // class Bench
+
+class Options {
+private:
+        bool m_no_scroll{false};
+        bool m_quiet{false};
+        int m_columns{80};
+        int m_rows{24};
+        int m_cell_width{10};
+        int m_cell_height{20};
+        int m_scrollback{VTE_SCROLLBACK_INIT};
+        int m_frozen_limit{VTE_DEFAULT_FREEZED_IMAGE_LIMIT >> 20};
+        int m_repeat{1};
+        char** m_filenames{nullptr};
+
+        template<typename T1, typename T2 = T1>
+        class OptionArg {
+        private:
+                T1* m_return_ptr;
+                T2 m_value;
+        public:
+                OptionArg(T1* ptr, T2 v) : m_return_ptr{ptr}, m_value{v} { }
+                ~OptionArg() { *m_return_ptr = m_value; }
+
+                inline constexpr T2* ptr() noexcept { return &m_value; }
+        };
+
+        using BoolArg = OptionArg<bool, gboolean>;
+        using IntArg = OptionArg<int>;
+        using StrvArg = OptionArg<char**>;
+
+public:
+
+        Options() noexcept = default;
+        Options(Options const&) = delete;
+        Options(Options&&) = delete;
+
+        ~Options() {
+                if (m_filenames != nullptr)
+                        g_strfreev(m_filenames);
+        }
+
+        inline constexpr bool no_scroll()    const noexcept { return m_no_scroll;    }
+        inline constexpr bool quiet()        const noexcept { return m_quiet;        }
+        inline constexpr int  columns()      const noexcept { return m_columns;      }
+        inline constexpr int  rows()         const noexcept { return m_rows;         }
+        inline constexpr int  cell_width()   const noexcept { return m_cell_width;   }
+        inline constexpr int  cell_height()  const noexcept { return m_cell_height;  }
+        inline constexpr int  scrollback()   const noexcept { return m_scrollback;   }
+        inline constexpr int  frozen_limit() const noexcept { return m_frozen_limit; }
+        inline constexpr int  repeat()       const noexcept { return m_repeat;       }
+        inline constexpr char const* const* filenames() const noexcept { return m_filenames; }
+
+        bool parse(int argc,
+                   char* argv[],
+                   GError** error) noexcept
+        {
+                BoolArg no_scroll{&m_no_scroll, false};
+                BoolArg quiet{&m_quiet, false};
+                IntArg columns{&m_columns, 80};
+                IntArg rows{&m_rows, 24};
+                IntArg cell_width{&m_cell_width, 10};
+                IntArg cell_height{&m_cell_height, 20};
+                IntArg scrollback{&m_scrollback, VTE_SCROLLBACK_INIT};
+                IntArg frozen_limit{&m_frozen_limit, VTE_DEFAULT_FREEZED_IMAGE_LIMIT >> 20};
+                IntArg repeat{&m_repeat, 1};
+                StrvArg filenames{&m_filenames, nullptr};
+                GOptionEntry const entries[] = {
+                        { "cell-height", 0, 0, G_OPTION_ARG_INT, cell_height.ptr(),
+                          "Cell height in pixels", "PIXELS" },
+                        { "cell-width", 0, 0, G_OPTION_ARG_INT, cell_width.ptr(),
+                          "Cell width in pixels", "PIXELS" },
+                        { "columns", 0, 0, G_OPTION_ARG_INT, columns.ptr(),
+                          "Width of the view", "COLUMNS" },
+                        { "frozen-limit", 'f', 0, G_OPTION_ARG_INT, frozen_limit.ptr(),
+                          "Remove the oldest images above SIZE MB of frozen images", "SIZE" },
+                        { "no-scroll", 'n', 0, G_OPTION_ARG_NONE, no_scroll.ptr(),
+                          "Do not scroll through the scrollback after the input", nullptr },
+                        { "quiet", 'q', 0, G_OPTION_ARG_NONE, quiet.ptr(),
+                          "Suppress output except for errors and benchmark", nullptr },
+                        { "repeat", 'r', 0, G_OPTION_ARG_INT, repeat.ptr(),
+                          "Repeat each file COUNT times", "COUNT" },
+                        { "rows", 0, 0, G_OPTION_ARG_INT, rows.ptr(),
+                          "Height of the view", "ROWS" },
+                        { "scrollback", 's', 0, G_OPTION_ARG_INT, scrollback.ptr(),
+                          "Keep ROWS rows of scrollback", "ROWS" },
+                        { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, filenames.ptr(),
+                          nullptr, nullptr },
+                        { nullptr },
+                };
+
+                auto context = g_option_context_new("[FILE…] — image benchmark");
+                g_option_context_set_help_enabled(context, true);
+                g_option_context_add_main_entries(context, entries, nullptr);
+
+                bool rv = g_option_context_parse(context, &argc, &argv, error);
+                g_option_context_free(context);
+                return rv;
+        }
+}; // class Options
+
+int
+main(int argc,
+     char *argv[])
+{
+        setlocale(LC_ALL, "");
+
+        Options options{};
+        GError* err = nullptr;
+        if (!options.parse(argc, argv, &err)) {
+                g_printerr("Failed to parse arguments: %s\n", err->message);
+                g_error_free(err);
+                return EXIT_FAILURE;
+        }
+
+        Bench bench{options.quiet(),
+                    options.columns(), options.rows(),
+                    options.cell_width(), options.cell_height(),
+                    options.scrollback(),
+                    (gsize)std::max(options.frozen_limit(), 0) << 20};
+        auto rv = bench.process_files(options.filenames(), options.repeat());
+
+        if (!options.no_scroll())
+                bench.scroll();
+
+        bench.print_benchmark();
+
+        return rv && bench.errors() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -45,13 +45,6 @@ enum {
 
 using namespace std::literals;
 
-char*
-vte::parser::Sequence::ucs4_to_utf8(gunichar const* str,
-                                    ssize_t len) const noexcept
-{
-        return g_ucs4_to_utf8(str, len, nullptr, nullptr, nullptr);
-}
-
 static constexpr char const*
 seq_to_str(unsigned int type) noexcept
 {
@@ -20,6 +20,7 @@
 #include <cstdint>
 #include <algorithm>
 #include <string>
+#include <string_view>
 
 #include "parser.hh"
 
@@ -53,11 +54,29 @@ public:
                 return vte_parser_feed(&m_parser, raw);
         }
 
+        template<typename T>
+        inline size_t feed_run(T const* begin,
+                               T const* end,
+                               int& rv) noexcept
+        {
+                return vte_parser_feed_run(&m_parser, begin, end, &rv);
+        }
+
         inline void reset() noexcept
         {
                 vte_parser_reset(&m_parser);
         }
 
+        inline void set_dispatch_unripe(bool enable) noexcept
+        {
+                vte_parser_set_dispatch_unripe(&m_parser, enable);
+        }
+
+        inline constexpr bool is_ground() const noexcept
+        {
+                return m_parser.state == VTE_PARSER_STATE_GROUND;
+        }
+
 protected:
         vte_parser_t m_parser;
 }; // class Parser
@@ -77,9 +96,6 @@ public:
 
         typedef int number;
 
-        char* ucs4_to_utf8(gunichar const* str,
-                           ssize_t len = -1) const noexcept;
-
         void print() const noexcept;
 
         /* type:
@@ -162,62 +178,60 @@ public:
                 return (introducer() & 0x80) != 0;
         }
 
-        /* intermediates:
+        /* is_unripe:
          *
-         * This is the pintro and intermediate characters in the sequence, if any.
+         * Whether the sequence was dispatched before its data string
+         * was received; this only happens for DCS sequences whose data
+         * string the caller consumes itself, see vte_parser_set_dispatch_unripe().
          *
-         * Returns: the intermediates
+         * Returns: whether the sequence is unripe
          */
-        inline constexpr unsigned int intermediates() const noexcept
+        inline constexpr bool is_unripe() const noexcept
         {
-                return m_seq->intermediates;
+                return m_seq->unripe;
         }
 
-        // FIXMEchpe: upgrade to C++17 and use the u32string_view version below, instead
-        /*
-         * string:
+        /* intermediates:
          *
-         * This is the string argument of a DCS or OSC sequence.
+         * This is the pintro and intermediate characters in the sequence, if any.
          *
-         * Returns: the string argument
+         * Returns: the intermediates
          */
-        inline std::u32string string() const noexcept
+        inline constexpr unsigned int intermediates() const noexcept
         {
-                size_t len;
-                auto buf = vte_seq_string_get(&m_seq->arg_str, &len);
-                return std::u32string(reinterpret_cast<char32_t*>(buf), len);
+                return m_seq->intermediates;
         }
 
-        #if 0
         /*
          * string:
          *
-         * This is the string argument of a DCS or OSC sequence.
+         * This is the string argument of a DCS or OSC sequence, in UTF-8.
+         * It may be a span of the input, so it is only good until the
+         * parser is fed again.
          *
          * Returns: the string argument
          */
-        inline constexpr std::u32string_view string() const noexcept
+        inline std::string_view string() const noexcept
         {
                 size_t len = 0;
                 auto buf = vte_seq_string_get(&m_seq->arg_str, &len);
-                return std::u32string_view(buf, len);
+                return std::string_view(buf, len);
         }
-        #endif
 
         /*
-         * string:
-         *
-         * This is the string argument of a DCS or OSC sequence.
+         * string_utf8:
          *
-         * Returns: the string argument
+         * Returns: a copy of the string argument of a DCS or OSC sequence
          */
-        std::string string_utf8() const noexcept;
+        inline std::string string_utf8() const noexcept
+        {
+                return std::string{string()};
+        }
 
         inline char* string_param() const noexcept
         {
-                size_t len = 0;
-                auto buf = vte_seq_string_get(&m_seq->arg_str, &len);
-                return ucs4_to_utf8(buf, len);
+                auto const str = string();
+                return g_strndup(str.data(), str.size());
         }
 
         /* size:
@@ -25,16 +25,21 @@
 /*
  * vte_seq_string_t:
  *
- * A type to hold the argument string of a DSC or OSC sequence.
+ * A type to hold the argument string of a DSC or OSC sequence, in UTF-8.
+ *
+ * While the string is made of bytes appended straight from the input,
+ * it is only a span of the input; it is copied into @buf (spilled) when
+ * anything else is appended, or when the input is about to go away.
  */
 typedef struct vte_seq_string_t {
         uint32_t capacity;
         uint32_t len;
-        uint32_t* buf;
+        char* buf;
+        char const* span;
 } vte_seq_string_t;
 
-#define VTE_SEQ_STRING_DEFAULT_CAPACITY (1 << 7) /* must be power of two */
-#define VTE_SEQ_STRING_MAX_CAPACITY     (1 << 12)
+#define VTE_SEQ_STRING_DEFAULT_CAPACITY (1 << 9) /* must be power of two */
+#define VTE_SEQ_STRING_MAX_CAPACITY     (1 << 14) /* bytes */
 
 /*
  * vte_seq_string_init:
@@ -45,7 +50,8 @@ static inline void vte_seq_string_init(vte_seq_string_t* str) noexcept
 {
         str->capacity = VTE_SEQ_STRING_DEFAULT_CAPACITY;
         str->len = 0;
-        str->buf = (uint32_t*)g_malloc0_n(str->capacity, sizeof(uint32_t));
+        str->buf = (char*)g_malloc0(str->capacity);
+        str->span = nullptr;
 }
 
 /*
@@ -62,43 +68,145 @@ static inline void vte_seq_string_free(vte_seq_string_t* str) noexcept
 /*
  * vte_seq_string_ensure_capacity:
  * @string:
+ * @n: a number of bytes
  *
- * If @string's length is at capacity, and capacity is not maximal,
- * expands the string's capacity.
+ * If @string's buffer can't take @n more bytes, and capacity is
+ * not maximal, expands the buffer's capacity.
  *
- * Returns: %true if the string has capacity for at least one more character
+ * Returns: %true if the buffer has capacity for @n more bytes
  */
-static inline bool vte_seq_string_ensure_capacity(vte_seq_string_t* str) noexcept
+static inline bool vte_seq_string_ensure_capacity(vte_seq_string_t* str,
+                                                  size_t n) noexcept
 {
-        if (str->len < str->capacity)
+        if (str->len + n <= str->capacity)
                 return true;
-        if (str->capacity >= VTE_SEQ_STRING_MAX_CAPACITY)
+        if (str->len + n > VTE_SEQ_STRING_MAX_CAPACITY)
                 return false;
 
-        str->capacity *= 2;
-        str->buf = (uint32_t*)g_realloc_n(str->buf, str->capacity, sizeof(uint32_t));
+        while (str->len + n > str->capacity)
+                str->capacity *= 2;
+        str->buf = (char*)g_realloc(str->buf, str->capacity);
         return true;
 }
 
+/*
+ * vte_seq_string_spill:
+ * @string:
+ *
+ * Copies @string into its own buffer, if it is a span of the input.
+ */
+static inline void vte_seq_string_spill(vte_seq_string_t* str) noexcept
+{
+        if (G_LIKELY(str->span == nullptr))
+                return;
+
+        auto const len = str->len;
+        str->len = 0;
+        vte_seq_string_ensure_capacity(str, len);
+        memcpy(str->buf, str->span, len);
+        str->len = len;
+        str->span = nullptr;
+}
+
 /*
  * vte_seq_string_push:
  * @string:
  * @c: a character
  *
- * Appends @c to @str, or iff @str already has maximum length, does nothing.
+ * Appends @c to @str, or iff @str has no room for it, does nothing.
  *
  * Returns: %true if the character was appended
  */
 static inline bool vte_seq_string_push(vte_seq_string_t* str,
                                        uint32_t c) noexcept
 {
-        if (!vte_seq_string_ensure_capacity(str))
+        vte_seq_string_spill(str);
+
+        auto const n = c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+        if (!vte_seq_string_ensure_capacity(str, n))
                 return false;
 
-        str->buf[str->len++] = c;
+        auto p = str->buf + str->len;
+        switch (n) {
+        case 1:
+                p[0] = char(c);
+                break;
+        case 2:
+                p[0] = char(0xc0 | (c >> 6));
+                p[1] = char(0x80 | (c & 0x3f));
+                break;
+        case 3:
+                p[0] = char(0xe0 | (c >> 12));
+                p[1] = char(0x80 | ((c >> 6) & 0x3f));
+                p[2] = char(0x80 | (c & 0x3f));
+                break;
+        default:
+                p[0] = char(0xf0 | (c >> 18));
+                p[1] = char(0x80 | ((c >> 12) & 0x3f));
+                p[2] = char(0x80 | ((c >> 6) & 0x3f));
+                p[3] = char(0x80 | (c & 0x3f));
+                break;
+        }
+        str->len += n;
         return true;
 }
 
+/*
+ * vte_seq_string_append:
+ * @string:
+ * @begin: the first byte
+ * @end: past the last byte
+ *
+ * Appends the bytes, which must be ASCII, from @begin to @end, as far as
+ * they fit. If @string is empty, or a span of the input ending at @begin,
+ * they are not copied; see vte_seq_string_spill().
+ *
+ * Returns: the number of bytes appended
+ */
+static inline size_t vte_seq_string_append(vte_seq_string_t* str,
+                                           uint8_t const* begin,
+                                           uint8_t const* end) noexcept
+{
+        auto n = size_t(end - begin);
+        if (n > VTE_SEQ_STRING_MAX_CAPACITY - str->len)
+                n = VTE_SEQ_STRING_MAX_CAPACITY - str->len;
+
+        if (str->len == 0)
+                str->span = reinterpret_cast<char const*>(begin);
+        else if (str->span != nullptr &&
+                 str->span + str->len != reinterpret_cast<char const*>(begin))
+                vte_seq_string_spill(str);
+
+        if (str->span == nullptr) {
+                vte_seq_string_ensure_capacity(str, n);
+                memcpy(str->buf + str->len, begin, n);
+        }
+        str->len += n;
+
+        return n;
+}
+
+/*
+ * vte_seq_string_append:
+ * @string:
+ * @begin: the first character
+ * @end: past the last character
+ *
+ * Pushes the characters from @begin to @end, as far as they fit.
+ *
+ * Returns: the number of characters pushed
+ */
+static inline size_t vte_seq_string_append(vte_seq_string_t* str,
+                                           uint32_t const* begin,
+                                           uint32_t const* end) noexcept
+{
+        auto p = begin;
+        while (p != end && vte_seq_string_push(str, *p))
+                ++p;
+
+        return p - begin;
+}
+
 /*
  * vte_seq_string_finish:
  * @string:
@@ -120,19 +228,20 @@ static inline void vte_seq_string_reset(vte_seq_string_t* str) noexcept
 {
         /* Zero length. However, don't clear the buffer, nor shrink the capacity. */
         str->len = 0;
+        str->span = nullptr;
 }
 
 /*
  * vte_seq_string_get:
  * @string:
- * @len: location to store the buffer length in code units
+ * @len: location to store the length in bytes
  *
- * Returns: the string's buffer as an array of uint32_t code units
+ * Returns: the string's bytes, in UTF-8
  */
-static constexpr inline uint32_t* vte_seq_string_get(vte_seq_string_t const* str,
-                                                     size_t* len) noexcept
+static constexpr inline char const* vte_seq_string_get(vte_seq_string_t const* str,
+                                                       size_t* len) noexcept
 {
         assert(len != nullptr);
         *len = str->len;
-        return str->buf;
+        return str->span != nullptr ? str->span : str->buf;
 }
@@ -23,6 +23,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <string>
+#include <tuple>
 #include <vector>
 
 using namespace std::literals;
@@ -223,6 +224,17 @@ feed_parser(vte_seq_builder& b,
         return feed_parser(s);
 }
 
+static std::string
+to_utf8(std::u32string const& str)
+{
+        auto u8str = std::string{};
+        for (auto c : str) {
+                char u[6];
+                u8str.append(u, g_unichar_to_utf8(c, u));
+        }
+        return u8str;
+}
+
 static void
 test_seq_arg(void)
 {
@@ -261,8 +273,41 @@ test_seq_string(void)
         auto buf = vte_seq_string_get(&str, &len);
         g_assert_cmpuint(len, ==, 0);
 
+        /* Characters are stored in UTF-8 */
+        g_assert_true(vte_seq_string_push(&str, 'a'));
+        g_assert_true(vte_seq_string_push(&str, 0xe9U));
+        g_assert_true(vte_seq_string_push(&str, 0xfffdU));
+        g_assert_true(vte_seq_string_push(&str, 0x1f600U));
+        buf = vte_seq_string_get(&str, &len);
+        g_assert_cmpuint(len, ==, 10);
+        g_assert_true(std::string(buf, len) == "a\u00e9\ufffd\U0001f600"s);
+
+        /* Bytes are a span of the input, until something else is appended */
+        auto const input = "0123456789"s;
+        auto const bytes = reinterpret_cast<uint8_t const*>(input.data());
+        vte_seq_string_reset(&str);
+        g_assert_cmpuint(vte_seq_string_append(&str, bytes, bytes + 4), ==, 4);
+        g_assert_cmpuint(vte_seq_string_append(&str, bytes + 4, bytes + 6), ==, 2);
+        buf = vte_seq_string_get(&str, &len);
+        g_assert_true(buf == input.data());
+        g_assert_cmpuint(len, ==, 6);
+
+        g_assert_cmpuint(vte_seq_string_append(&str, bytes + 7, bytes + 8), ==, 1);
+        buf = vte_seq_string_get(&str, &len);
+        g_assert_true(buf != input.data());
+        g_assert_true(std::string(buf, len) == "0123457"s);
+
+        vte_seq_string_reset(&str);
+        vte_seq_string_append(&str, bytes, bytes + 3);
+        vte_seq_string_spill(&str);
+        g_assert_true(vte_seq_string_push(&str, '!'));
+        buf = vte_seq_string_get(&str, &len);
+        g_assert_true(std::string(buf, len) == "012!"s);
+
+        /* Up to the maximum length */
+        vte_seq_string_reset(&str);
         for (unsigned int i = 0; i < VTE_SEQ_STRING_MAX_CAPACITY; ++i) {
-                auto rv = vte_seq_string_push(&str, 0xfffdU);
+                auto rv = vte_seq_string_push(&str, 'a');
                 g_assert_true(rv);
 
                 buf = vte_seq_string_get(&str, &len);
@@ -270,12 +315,13 @@ test_seq_string(void)
         }
 
         /* Try one more */
-        auto rv = vte_seq_string_push(&str, 0xfffdU);
+        auto rv = vte_seq_string_push(&str, 'a');
         g_assert_false(rv);
+        g_assert_cmpuint(vte_seq_string_append(&str, bytes, bytes + 1), ==, 0);
 
         buf = vte_seq_string_get(&str, &len);
         for (unsigned int i = 0; i < len; i++)
-                g_assert_cmpuint(buf[i], ==, 0xfffdU);
+                g_assert_cmpuint(buf[i], ==, 'a');
 
         vte_seq_string_reset(&str);
         buf = vte_seq_string_get(&str, &len);
@@ -923,12 +969,131 @@ static void
 test_seq_dcs(void)
 {
         /* Length exceeded */
-        test_seq_dcs_simple(std::u32string(VTE_SEQ_STRING_MAX_CAPACITY + 1, 0x100000), VTE_SEQ_NONE);
+        test_seq_dcs_simple(std::u32string(VTE_SEQ_STRING_MAX_CAPACITY / 4 + 1, 0x100000), VTE_SEQ_NONE);
 
         test_seq_dcs(U""s);
         test_seq_dcs(U"123;TESTING"s);
 }
 
+static void
+test_seq_dcs_unripe(void)
+{
+        /* DECSIXEL is dispatched unripe on its final character when
+         * enabled, and then again, ripe, on the string terminator.
+         */
+        parser.reset();
+        parser.set_dispatch_unripe(true);
+
+        auto rv = feed_parser(U"\x1bP0;1;0q"s);
+        g_assert_cmpint(rv, ==, VTE_SEQ_DCS);
+        g_assert_cmpint(seq.command(), ==, VTE_CMD_DECSIXEL);
+        g_assert_true(seq.is_unripe());
+        g_assert_cmpint(seq.size(), ==, 3);
+        g_assert_cmpint(seq.param(1), ==, 1);
+
+        /* The caller would normally consume the data string itself */
+        rv = feed_parser(U"#0;2;0;0;0#0~~@@\x1b\\"s);
+        g_assert_cmpint(rv, ==, VTE_SEQ_DCS);
+        g_assert_cmpint(seq.command(), ==, VTE_CMD_DECSIXEL);
+        g_assert_false(seq.is_unripe());
+
+        /* Other DCS are collected as usual */
+        rv = feed_parser(U"\x1bP$qm"s);
+        g_assert_cmpint(rv, ==, VTE_SEQ_NONE);
+        rv = feed_parser(U"\x1b\\"s);
+        g_assert_cmpint(rv, ==, VTE_SEQ_DCS);
+        g_assert_cmpint(seq.command(), ==, VTE_CMD_DECRQSS);
+        g_assert_false(seq.is_unripe());
+
+        /* CAN cancels the sequence */
+        rv = feed_parser(U"\x1bPq#0~\x18"s);
+        g_assert_cmpint(rv, ==, VTE_SEQ_IGNORE);
+
+        parser.set_dispatch_unripe(false);
+        parser.reset();
+}
+
+using feed_results = std::vector<std::tuple<size_t, int, unsigned int, std::string>>;
+
+static void
+add_feed_result(feed_results& results,
+                size_t i,
+                int rv)
+{
+        auto str = rv == VTE_SEQ_OSC || rv == VTE_SEQ_DCS ? std::string{seq.string()} : ""s;
+        results.emplace_back(i, rv, seq.command(), str);
+}
+
+static feed_results
+feed_parser_by_char(std::u32string const& s)
+{
+        auto results = feed_results{};
+        parser.reset();
+        for (size_t i = 0; i < s.size(); ++i) {
+                auto rv = parser.feed(s[i]);
+                if (rv != VTE_SEQ_NONE)
+                        add_feed_result(results, i, rv);
+        }
+        return results;
+}
+
+template<typename T>
+static feed_results
+feed_parser_by_run(std::u32string const& s)
+{
+        /* Bytes from 0x80 up stop a run of bytes; anything that isn't ASCII
+         * is fed to the parser by itself then */
+        auto chars = std::vector<T>{};
+        for (auto c : s)
+                chars.push_back(sizeof(T) > 1 || c < 0x80 ? T(c) : T(0x80));
+
+        auto results = feed_results{};
+        parser.reset();
+        for (size_t i = 0; i < s.size(); ) {
+                int rv;
+                auto n = parser.feed_run(chars.data() + i, chars.data() + chars.size(), rv);
+                if (n == 0) {
+                        g_assert_cmpuint(s[i], >=, 0x80);
+                        rv = parser.feed(s[i]);
+                        n = 1;
+                }
+                i += n;
+                if (rv != VTE_SEQ_NONE)
+                        add_feed_result(results, i - 1, rv);
+        }
+        return results;
+}
+
+static void
+test_seq_feed_run(void)
+{
+        /* Feeding runs gives the same sequences, at the same characters
+         * and with the same strings, as feeding one character at a time */
+        auto str = U"ab\x1b[1;38:5:12m\r\n\x1b]0;a title \u00e9\u4e00\x07\x1bP$qm\x1b\\"
+                U"\x1b[?25h\x9b" U"3q\x1b(B\x1b)0\x1bZc\x9a" U"c\x1b[1\x18x\x7f\x1b[<1;2:3$tx"
+                U"\x1b[1;2;3;4;5;6;7;8;9;0;1;2;3;4;5;6;7;8;9;0;1;2;3;4;5;6;7;8;9;0;1;2;3;4;5;6H"
+                U"\x1b]8;;http://example.com\x1b\\link\x1b]8;;\x1b\\\x9d" U"2;mixed\x1b\\"s;
+        /* An overlong OSC is ignored */
+        str += U"\x1b]2;"s + std::u32string(VTE_SEQ_STRING_MAX_CAPACITY + 1, U'x') + U"\x07\x1b[m"s;
+
+        auto const expected = feed_parser_by_char(str);
+        g_assert_cmpuint(expected.size(), >, 20);
+        g_assert_true(feed_parser_by_run<uint32_t>(str) == expected);
+        g_assert_true(feed_parser_by_run<uint8_t>(str) == expected);
+
+        /* A string that comes in one run of bytes isn't copied */
+        auto const title = "\x1b]2;a title\x07"s;
+        auto const bytes = reinterpret_cast<uint8_t const*>(title.data());
+        int rv;
+        parser.reset();
+        g_assert_cmpuint(parser.feed_run(bytes, bytes + title.size(), rv), ==, title.size());
+        g_assert_cmpint(rv, ==, VTE_SEQ_OSC);
+        g_assert_true(seq.string() == "2;a title"s);
+        g_assert_true(seq.string().data() == title.data() + 2);
+
+        parser.reset();
+}
+
 static void
 test_seq_dcs_known(uint32_t f,
                    uint32_t p,
@@ -1289,9 +1454,9 @@ test_seq_osc(std::u32string const& str,
                 return;
 
         if (max_arg_str_len < 0 || size_t(max_arg_str_len) == str.size())
-                g_assert_true(seq.string() == str);
+                g_assert_true(seq.string() == to_utf8(str));
         else
-                g_assert_true(seq.string() == str.substr(0, max_arg_str_len));
+                g_assert_true(seq.string() == to_utf8(str.substr(0, max_arg_str_len)));
 }
 
 static int
@@ -1321,11 +1486,11 @@ test_seq_osc(void)
         test_seq_osc(U"TEST"s);
 
         /* String of any supported length */
-        for (unsigned int len = 0; len < VTE_SEQ_STRING_MAX_CAPACITY; ++len)
+        for (unsigned int len = 0; len < VTE_SEQ_STRING_MAX_CAPACITY / 4; ++len)
                 test_seq_osc(std::u32string(len, 0x10000+len));
 
         /* Length exceeded */
-        test_seq_osc(std::u32string(VTE_SEQ_STRING_MAX_CAPACITY + 1, 0x100000), VTE_SEQ_IGNORE);
+        test_seq_osc(std::u32string(VTE_SEQ_STRING_MAX_CAPACITY / 4 + 1, 0x100000), VTE_SEQ_IGNORE);
 
         /* Test all introducer/ST combinations */
         for (auto introducer : { u32SequenceBuilder::Introducer::DEFAULT,
@@ -1349,7 +1514,7 @@ test_seq_glue_string(void)
         std::u32string str{U"TEST"s};
         test_seq_osc(str);
 
-        g_assert_true(seq.string() == str);
+        g_assert_true(seq.string() == to_utf8(str));
 }
 
 static void
@@ -1508,7 +1673,9 @@ main(int argc,
         g_test_add_func("/vte/parser/sequences/sci/known", test_seq_sci_known);
         g_test_add_func("/vte/parser/sequences/dcs", test_seq_dcs);
         g_test_add_func("/vte/parser/sequences/dcs/known", test_seq_dcs_known);
+        g_test_add_func("/vte/parser/sequences/dcs/unripe", test_seq_dcs_unripe);
         g_test_add_func("/vte/parser/sequences/osc", test_seq_osc);
+        g_test_add_func("/vte/parser/sequences/feed-run", test_seq_feed_run);
 
         return g_test_run();
 }
@@ -494,7 +494,7 @@ vte_parse_host_sci(vte_seq_t const* seq)
  */
 
 enum parser_state_t {
-        STATE_GROUND,           /* initial state and ground */
+        STATE_GROUND = VTE_PARSER_STATE_GROUND, /* initial state and ground */
         STATE_DCS_PASS_ESC,     /* ESC after DCS which may be ESC \ aka C0 ST */
         STATE_OSC_STRING_ESC,   /* ESC after OSC which may be ESC \ aka C0 ST */
         STATE_ESC,              /* ESC sequence was started */
@@ -515,87 +515,43 @@ enum parser_state_t {
         STATE_N,
 };
 
-/* Parser state transitioning */
-
-typedef int (* parser_action_func)(vte_parser_t* parser, uint32_t raw);
-
-// FIXMEchpe: I get weird performance results here from
-// either not inlining, inlining these function or the
-// macros below. Sometimes (after a recompile) one is
-// (as much as 50%!) slower, sometimes the other one etc. ‽
-
-#if 1 // (inline) functions
-
-// #define PTINLINE inline
-#define PTINLINE
-
-/* nop */
-static PTINLINE int
-parser_nop(vte_parser_t* parser,
-           uint32_t raw)
-{
-        return VTE_SEQ_NONE;
-}
-/* dispatch related actions */
-static PTINLINE int
-parser_action(vte_parser_t* parser,
-              uint32_t raw,
-              parser_action_func action)
-{
-        return action(parser, raw);
-}
-
-/* perform state transition */
-static PTINLINE int
-parser_transition_no_action(vte_parser_t* parser,
-                            uint32_t raw,
-                            unsigned int state)
-{
-        parser->state = state;
-        return VTE_SEQ_NONE;
-}
-
-/* perform state transition and dispatch related actions */
-static PTINLINE int
-parser_transition(vte_parser_t* parser,
-                  uint32_t raw,
-                  unsigned int state,
-                  parser_action_func action)
-{
-        parser->state = state;
-
-        return action(parser, raw);
-}
-
-#undef PTINLINE
-
-#else // macros
-
-/* nop */
-#define parser_nop(parser,raw) \
-        ({ VTE_SEQ_NONE; })
-
-/* dispatch related actions */
-#define parser_action(p,r,a) \
-        ({ \
-                a((p), (r)); \
-        })
-
-/* perform state transition */
-#define parser_transition_no_action(p,r,s) \
-        ({ \
-                parser->state = s; \
-                VTE_SEQ_NONE; \
-        })
-
-/* perform state transition and dispatch related actions */
-#define parser_transition(p,r,s,a) \
-        ({ \
-                (p)->state = s; \
-                a((p), (r)); \
-        })
+/* Parser actions, performed on entering the new state of a transition */
+
+enum parser_action_t {
+        ACTION_NONE,
+        ACTION_CLEAR,
+        ACTION_CLEAR_INT,
+        ACTION_CLEAR_INT_AND_PARAMS,
+        ACTION_CLEAR_PARAMS_ONLY,
+        ACTION_IGNORE,
+        ACTION_PRINT,
+        ACTION_EXECUTE,
+        ACTION_COLLECT_ESC,
+        ACTION_COLLECT_CSI,
+        ACTION_COLLECT_DCS = ACTION_COLLECT_CSI,
+        ACTION_COLLECT_PARAMETER,
+        ACTION_PARAM,
+        ACTION_FINISH_PARAM,
+        ACTION_FINISH_SUBPARAM,
+        ACTION_ESC_DISPATCH,
+        ACTION_CSI_DISPATCH,
+        ACTION_DCS_START,
+        ACTION_DCS_CONSUME,
+        ACTION_DCS_COLLECT,
+        ACTION_DCS_DISPATCH,
+        ACTION_OSC_START,
+        ACTION_OSC_COLLECT,
+        ACTION_OSC_DISPATCH,
+        ACTION_SCI_DISPATCH,
+
+        ACTION_N,
+
+        /* Flag: do the ACTION_CLEAR_INT deferred on ESC in a string first */
+        ACTION_FLAG_CLEAR_INT = 0x80,
+};
 
-#endif // (inline) functions or macros
+static_assert(ACTION_N <= ACTION_FLAG_CLEAR_INT, "too many parser actions");
+static_assert(STATE_N <= 0x100, "too many parser states");
 
 /**
  * vte_parser_init() - Initialise parser object
@@ -770,10 +726,8 @@ parser_params_overflow(vte_parser_t* parser,
          * Transition to STATE_{CSI,DCS}_IGNORE to ignore the
          * whole sequence.
          */
-        parser_transition_no_action(parser,
-                                    raw,
-                                    parser->state == STATE_CSI_PARAM ?
-                                    STATE_CSI_IGNORE : STATE_DCS_IGNORE);
+        parser->state = parser->state == STATE_CSI_PARAM ?
+                STATE_CSI_IGNORE : STATE_DCS_IGNORE;
 }
 
 /* The next two functions are only called when encountering a ';' or ':',
@@ -861,6 +815,24 @@ parser_dcs_start(vte_parser_t* parser,
         return VTE_SEQ_NONE;
 }
 
+/*
+ * parser_dcs_is_streamed:
+ * @command: a VTE_CMD_* value
+ *
+ * Returns: whether the data string of the DCS @command can be consumed
+ *   by the caller directly from its input, see vte_parser_set_dispatch_unripe()
+ */
+static inline bool
+parser_dcs_is_streamed(unsigned int command)
+{
+        switch (command) {
+        case VTE_CMD_DECSIXEL:
+                return true;
+        default:
+                return false;
+        }
+}
+
 static int
 parser_dcs_consume(vte_parser_t* parser,
                    uint32_t raw)
@@ -880,6 +852,20 @@ parser_dcs_consume(vte_parser_t* parser,
         parser->seq.type = VTE_SEQ_DCS;
         parser->seq.terminator = raw;
         parser->seq.command = vte_parse_host_dcs(&parser->seq);
+        parser->seq.unripe = false;
+
+        /* If the caller consumes the data string of this DCS itself,
+         * dispatch it right away, before the data string. The parser
+         * stays in STATE_DCS_PASS, so that once the caller hands control
+         * back, the string terminator (or any control cancelling the
+         * sequence) is handled as usual, and the sequence is dispatched
+         * a second time, ripe, when terminated.
+         */
+        if (parser->dispatch_unripe &&
+            parser_dcs_is_streamed(parser->seq.command)) {
+                parser->seq.unripe = true;
+                return parser->seq.type;
+        }
 
         return VTE_SEQ_NONE;
 }
@@ -960,6 +946,7 @@ parser_dcs(vte_parser_t* parser,
         /* parser->seq was already filled in parser_dcs_consume() */
 
         vte_seq_string_finish(&parser->seq.arg_str);
+        parser->seq.unripe = false;
 
         /* We only dispatch a DCS if the introducer and string
          * terminator are from the same control set, i.e. both
@@ -982,415 +969,403 @@ parser_sci(vte_parser_t* parser,
         return parser->seq.type;
 }
 
-#define ACTION_CLEAR parser_clear
-#define ACTION_CLEAR_INT parser_clear_int
-#define ACTION_CLEAR_INT_AND_PARAMS parser_clear_int_and_params
-#define ACTION_CLEAR_PARAMS_ONLY parser_clear_params
-#define ACTION_IGNORE parser_ignore
-#define ACTION_PRINT parser_print
-#define ACTION_EXECUTE parser_execute
-#define ACTION_COLLECT_ESC parser_collect_esc
-#define ACTION_COLLECT_CSI parser_collect_csi
-#define ACTION_COLLECT_DCS ACTION_COLLECT_CSI
-#define ACTION_COLLECT_PARAMETER parser_collect_parameter
-#define ACTION_PARAM parser_param
-#define ACTION_FINISH_PARAM parser_finish_param
-#define ACTION_FINISH_SUBPARAM parser_finish_subparam
-#define ACTION_ESC_DISPATCH parser_esc
-#define ACTION_CSI_DISPATCH parser_csi
-#define ACTION_DCS_START parser_dcs_start
-#define ACTION_DCS_CONSUME parser_dcs_consume
-#define ACTION_DCS_COLLECT parser_dcs_collect
-#define ACTION_DCS_DISPATCH parser_dcs
-#define ACTION_OSC_START parser_osc_start
-#define ACTION_OSC_COLLECT parser_osc_collect
-#define ACTION_OSC_DISPATCH parser_osc
-#define ACTION_SCI_DISPATCH parser_sci
+/* Performs @action on @raw; the parser is already in the new state */
+static inline __attribute__((always_inline)) int
+parser_perform(vte_parser_t* parser,
+               unsigned int action,
+               uint32_t raw)
+{
+        if (G_UNLIKELY(action & ACTION_FLAG_CLEAR_INT)) {
+                parser_clear_int(parser, 0x1b /* ESC */);
+                action &= ~ACTION_FLAG_CLEAR_INT;
+        }
 
-static int
-parser_feed_to_state(vte_parser_t* parser,
-                     uint32_t raw)
+        switch (action) {
+        case ACTION_NONE:                 return VTE_SEQ_NONE;
+        case ACTION_CLEAR:                return parser_clear(parser, raw);
+        case ACTION_CLEAR_INT:            return parser_clear_int(parser, raw);
+        case ACTION_CLEAR_INT_AND_PARAMS: return parser_clear_int_and_params(parser, raw);
+        case ACTION_CLEAR_PARAMS_ONLY:    return parser_clear_params(parser, raw);
+        case ACTION_IGNORE:               return parser_ignore(parser, raw);
+        case ACTION_PRINT:                return parser_print(parser, raw);
+        case ACTION_EXECUTE:              return parser_execute(parser, raw);
+        case ACTION_COLLECT_ESC:          return parser_collect_esc(parser, raw);
+        case ACTION_COLLECT_CSI:          return parser_collect_csi(parser, raw);
+        case ACTION_COLLECT_PARAMETER:    return parser_collect_parameter(parser, raw);
+        case ACTION_PARAM:                return parser_param(parser, raw);
+        case ACTION_FINISH_PARAM:         return parser_finish_param(parser, raw);
+        case ACTION_FINISH_SUBPARAM:      return parser_finish_subparam(parser, raw);
+        case ACTION_ESC_DISPATCH:         return parser_esc(parser, raw);
+        case ACTION_CSI_DISPATCH:         return parser_csi(parser, raw);
+        case ACTION_DCS_START:            return parser_dcs_start(parser, raw);
+        case ACTION_DCS_CONSUME:          return parser_dcs_consume(parser, raw);
+        case ACTION_DCS_COLLECT:          return parser_dcs_collect(parser, raw);
+        case ACTION_DCS_DISPATCH:         return parser_dcs(parser, raw);
+        case ACTION_OSC_START:            return parser_osc_start(parser, raw);
+        case ACTION_OSC_COLLECT:          return parser_osc_collect(parser, raw);
+        case ACTION_OSC_DISPATCH:         return parser_osc(parser, raw);
+        case ACTION_SCI_DISPATCH:         return parser_sci(parser, raw);
+        }
+
+        g_assert_not_reached();
+        return VTE_SEQ_NONE;
+}
+
+/*
+ * Transitions
+ * The state machine is spelled out below as constexpr functions of the
+ * state and the character, from which a table of the transitions for all
+ * states and characters is built at compile time; feeding the parser is
+ * then a lookup and at most one action per character.
+ */
+
+struct parser_transition_t {
+        uint8_t action;
+        uint8_t state;
+
+        constexpr bool operator==(parser_transition_t const& other) const
+        {
+                return action == other.action && state == other.state;
+        }
+};
+
+/* Stay in @state, performing @action */
+static constexpr parser_transition_t
+parser_action(unsigned int state,
+              unsigned int action)
+{
+        return {uint8_t(action), uint8_t(state)};
+}
+
+/* Stay in @state, doing nothing */
+static constexpr parser_transition_t
+parser_nop(unsigned int state)
+{
+        return parser_action(state, ACTION_NONE);
+}
+
+/* Go to @state, performing @action */
+static constexpr parser_transition_t
+parser_transition(unsigned int state,
+                  unsigned int action)
+{
+        return parser_action(state, action);
+}
+
+/* Go to @state, doing nothing */
+static constexpr parser_transition_t
+parser_transition_no_action(unsigned int state)
+{
+        return parser_action(state, ACTION_NONE);
+}
+
+/* Do the deferred ACTION_CLEAR_INT before @transition */
+static constexpr parser_transition_t
+parser_with_clear_int(parser_transition_t transition)
 {
-        switch (parser->state) {
+        return {uint8_t(transition.action | ACTION_FLAG_CLEAR_INT), transition.state};
+}
+
+/* The transition on @raw in @state, unless it's one from anywhere */
+static constexpr parser_transition_t
+parser_state_transition(unsigned int state,
+                        uint32_t raw)
+{
+        switch (state) {
         case STATE_GROUND:
                 switch (raw) {
                 case 0x00 ... 0x1a:        /* C0 \ { ESC } */
                 case 0x1c ... 0x1f:
                 case 0x80 ... 0x9f:        /* C1 */
-                        return parser_action(parser, raw,
-                                             ACTION_EXECUTE);
+                        return parser_action(state, ACTION_EXECUTE);
                 case 0x1b:                /* ESC */
-                        return parser_transition(parser, raw, STATE_ESC,
-                                                 ACTION_CLEAR_INT);
+                        return parser_transition(STATE_ESC, ACTION_CLEAR_INT);
                 }
 
-                return parser_action(parser, raw,
-                                     ACTION_PRINT);
+                return parser_action(state, ACTION_PRINT);
 
         case STATE_DCS_PASS_ESC:
         case STATE_OSC_STRING_ESC:
                 if (raw == 0x5c /* '\' */) {
-                        switch (parser->state) {
+                        switch (state) {
                         case STATE_DCS_PASS_ESC:
-                                return parser_transition(parser, raw, STATE_GROUND,
-                                                         ACTION_DCS_DISPATCH);
+                                return parser_transition(STATE_GROUND, ACTION_DCS_DISPATCH);
                         case STATE_OSC_STRING_ESC:
-                                return parser_transition(parser, raw, STATE_GROUND,
-                                                         ACTION_OSC_DISPATCH);
+                                return parser_transition(STATE_GROUND, ACTION_OSC_DISPATCH);
                         }
                 }
 
-                /* Do the deferred clear and fallthrough to STATE_ESC */
-                parser_transition(parser, 0x1b /* ESC */, STATE_ESC,
-                                  ACTION_CLEAR_INT);
+                /* Do the deferred clear and continue as in STATE_ESC */
+                return parser_with_clear_int(parser_state_transition(STATE_ESC, raw));
 
-                [[fallthrough]];
         case STATE_ESC:
                 switch (raw) {
                 case 0x00 ... 0x1a:        /* C0 \ { ESC } */
                 case 0x1c ... 0x1f:
-                        return parser_action(parser, raw,
-                                                 ACTION_EXECUTE);
+                        return parser_action(state, ACTION_EXECUTE);
                 case 0x1b:                /* ESC */
-                        return parser_transition(parser, raw, STATE_ESC,
-                                                 ACTION_CLEAR_INT);
+                        return parser_transition(STATE_ESC, ACTION_CLEAR_INT);
                 case 0x20 ... 0x2f:        /* [' ' - '\'] */
-                        return parser_transition(parser, raw, STATE_ESC_INT,
-                                                 ACTION_COLLECT_ESC);
+                        return parser_transition(STATE_ESC_INT, ACTION_COLLECT_ESC);
                 case 0x30 ... 0x4f:        /* ['0' - '~'] \ */
                 case 0x51 ... 0x57:        /* { 'P', 'X', 'Z' '[', ']', '^', '_' } */
                 case 0x59:
                 case 0x5c:
                 case 0x60 ... 0x7e:
-                        return parser_transition(parser, raw, STATE_GROUND,
-                                                 ACTION_ESC_DISPATCH);
+                        return parser_transition(STATE_GROUND, ACTION_ESC_DISPATCH);
                 case 0x50:                /* 'P' */
-                        return parser_transition(parser, raw, STATE_DCS_ENTRY,
-                                                 ACTION_DCS_START);
+                        return parser_transition(STATE_DCS_ENTRY, ACTION_DCS_START);
                 case 0x5a:                /* 'Z' */
-                        return parser_transition(parser, raw, STATE_SCI,
-                                                 ACTION_CLEAR);
+                        return parser_transition(STATE_SCI, ACTION_CLEAR);
                 case 0x5b:                /* '[' */
-                        return parser_transition(parser, raw, STATE_CSI_ENTRY,
-                                                 ACTION_CLEAR_PARAMS_ONLY
+                        return parser_transition(STATE_CSI_ENTRY, ACTION_CLEAR_PARAMS_ONLY
                                                  /* rest already cleaned on ESC state entry */);
                 case 0x5d:                /* ']' */
-                        return parser_transition(parser, raw, STATE_OSC_STRING,
-                                                 ACTION_OSC_START);
+                        return parser_transition(STATE_OSC_STRING, ACTION_OSC_START);
                 case 0x58:                /* 'X' */
                 case 0x5e:                /* '^' */
                 case 0x5f:                /* '_' */
-                        return parser_transition_no_action(parser, raw, STATE_ST_IGNORE);
+                        return parser_transition_no_action(STATE_ST_IGNORE);
                 case 0x9c:                /* ST */
-                        return parser_transition(parser, raw, STATE_GROUND,
-                                                 ACTION_IGNORE);
+                        return parser_transition(STATE_GROUND, ACTION_IGNORE);
                 }
 
-                return parser_transition(parser, raw, STATE_GROUND,
-                                         ACTION_IGNORE);
+                return parser_transition(STATE_GROUND, ACTION_IGNORE);
         case STATE_ESC_INT:
                 switch (raw) {
                 case 0x00 ... 0x1a:        /* C0 \ { ESC } */
                 case 0x1c ... 0x1f:
-                        return parser_action(parser, raw,
-                                             ACTION_EXECUTE);
+                        return parser_action(state, ACTION_EXECUTE);
                 case 0x1b:                /* ESC */
-                        return parser_transition(parser, raw, STATE_ESC,
-                                                 ACTION_CLEAR_INT);
+                        return parser_transition(STATE_ESC, ACTION_CLEAR_INT);
                 case 0x20 ... 0x2f:        /* [' ' - '\'] */
-                        return parser_action(parser, raw,
-                                             ACTION_COLLECT_ESC);
+                        return parser_action(state, ACTION_COLLECT_ESC);
                 case 0x30 ... 0x7e:        /* ['0' - '~'] */
-                        return parser_transition(parser, raw, STATE_GROUND,
-                                                 ACTION_ESC_DISPATCH);
+                        return parser_transition(STATE_GROUND, ACTION_ESC_DISPATCH);
                 case 0x9c:                /* ST */
-                        return parser_transition(parser, raw, STATE_GROUND,
-                                                 ACTION_IGNORE);
+                        return parser_transition(STATE_GROUND, ACTION_IGNORE);
                 }
 
-                return parser_transition(parser, raw, STATE_GROUND,
-                                         ACTION_IGNORE);
+                return parser_transition(STATE_GROUND, ACTION_IGNORE);
         case STATE_CSI_ENTRY:
                 switch (raw) {
                 case 0x00 ... 0x1a:        /* C0 \ { ESC } */
                 case 0x1c ... 0x1f:
-                        return parser_action(parser, raw,
-                                             ACTION_EXECUTE);
+                        return parser_action(state, ACTION_EXECUTE);
                 case 0x1b:                /* ESC */
-                        return parser_transition(parser, raw, STATE_ESC,
-                                                 ACTION_CLEAR_INT);
+                        return parser_transition(STATE_ESC, ACTION_CLEAR_INT);
                 case 0x20 ... 0x2f:        /* [' ' - '\'] */
-                        return parser_transition(parser, raw, STATE_CSI_INT,
-                                                 ACTION_COLLECT_CSI);
+                        return parser_transition(STATE_CSI_INT, ACTION_COLLECT_CSI);
                 case 0x30 ... 0x39:        /* ['0' - '9'] */
-                        return parser_transition(parser, raw, STATE_CSI_PARAM,
-                                                 ACTION_PARAM);
+                        return parser_transition(STATE_CSI_PARAM, ACTION_PARAM);
                 case 0x3a:                 /* ':' */
-                        return parser_transition(parser, raw, STATE_CSI_PARAM,
-                                                 ACTION_FINISH_SUBPARAM);
+                        return parser_transition(STATE_CSI_PARAM, ACTION_FINISH_SUBPARAM);
                 case 0x3b:                 /* ';' */
-                        return parser_transition(parser, raw, STATE_CSI_PARAM,
-                                                 ACTION_FINISH_PARAM);
+                        return parser_transition(STATE_CSI_PARAM, ACTION_FINISH_PARAM);
                 case 0x3c ... 0x3f:        /* ['<' - '?'] */
-                        return parser_transition(parser, raw, STATE_CSI_PARAM,
-                                                 ACTION_COLLECT_PARAMETER);
+                        return parser_transition(STATE_CSI_PARAM, ACTION_COLLECT_PARAMETER);
                 case 0x40 ... 0x7e:        /* ['@' - '~'] */
-                        return parser_transition(parser, raw, STATE_GROUND,
-                                                 ACTION_CSI_DISPATCH);
+                        return parser_transition(STATE_GROUND, ACTION_CSI_DISPATCH);
                 case 0x9c:                /* ST */
-                        return parser_transition(parser, raw, STATE_GROUND,
-                                                 ACTION_IGNORE);
+                        return parser_transition(STATE_GROUND, ACTION_IGNORE);
                 }
 
-                return parser_transition_no_action(parser, raw, STATE_CSI_IGNORE);
+                return parser_transition_no_action(STATE_CSI_IGNORE);
         case STATE_CSI_PARAM:
                 switch (raw) {
                 case 0x00 ... 0x1a:        /* C0 \ { ESC } */
                 case 0x1c ... 0x1f:
-                        return parser_action(parser, raw,
-                                             ACTION_EXECUTE);
+                        return parser_action(state, ACTION_EXECUTE);
                 case 0x1b:                /* ESC */
-                        return parser_transition(parser, raw, STATE_ESC,
-                                                 ACTION_CLEAR_INT);
+                        return parser_transition(STATE_ESC, ACTION_CLEAR_INT);
                 case 0x20 ... 0x2f:        /* [' ' - '\'] */
-                        return parser_transition(parser, raw, STATE_CSI_INT,
-                                                 ACTION_COLLECT_CSI);
+                        return parser_transition(STATE_CSI_INT, ACTION_COLLECT_CSI);
                 case 0x30 ... 0x39:        /* ['0' - '9'] */
-                        return parser_action(parser, raw,
-                                             ACTION_PARAM);
+                        return parser_action(state, ACTION_PARAM);
                 case 0x3a:                 /* ':' */
-                        return parser_action(parser, raw,
-                                             ACTION_FINISH_SUBPARAM);
+                        return parser_action(state, ACTION_FINISH_SUBPARAM);
                 case 0x3b:                 /* ';' */
-                        return parser_action(parser, raw,
-                                             ACTION_FINISH_PARAM);
+                        return parser_action(state, ACTION_FINISH_PARAM);
                 case 0x3c ... 0x3f:        /* ['<' - '?'] */
-                        return parser_transition_no_action(parser, raw, STATE_CSI_IGNORE);
+                        return parser_transition_no_action(STATE_CSI_IGNORE);
                 case 0x40 ... 0x7e:        /* ['@' - '~'] */
-                        return parser_transition(parser, raw, STATE_GROUND,
-                                                 ACTION_CSI_DISPATCH);
+                        return parser_transition(STATE_GROUND, ACTION_CSI_DISPATCH);
                 case 0x9c:                /* ST */
-                        return parser_transition(parser, raw, STATE_GROUND,
-                                                 ACTION_IGNORE);
+                        return parser_transition(STATE_GROUND, ACTION_IGNORE);
                 }
 
-                return parser_transition_no_action(parser, raw, STATE_CSI_IGNORE);
+                return parser_transition_no_action(STATE_CSI_IGNORE);
         case STATE_CSI_INT:
                 switch (raw) {
                 case 0x00 ... 0x1a:        /* C0 \ { ESC } */
                 case 0x1c ... 0x1f:
-                        return parser_action(parser, raw,
-                                             ACTION_EXECUTE);
+                        return parser_action(state, ACTION_EXECUTE);
                 case 0x1b:                /* ESC */
-                        return parser_transition(parser, raw, STATE_ESC,
-                                                 ACTION_CLEAR_INT);
+                        return parser_transition(STATE_ESC, ACTION_CLEAR_INT);
                 case 0x20 ... 0x2f:        /* [' ' - '\'] */
-                        return parser_action(parser, raw,
-                                             ACTION_COLLECT_CSI);
+                        return parser_action(state, ACTION_COLLECT_CSI);
                 case 0x30 ... 0x3f:        /* ['0' - '?'] */
-                        return parser_transition_no_action(parser, raw, STATE_CSI_IGNORE);
+                        return parser_transition_no_action(STATE_CSI_IGNORE);
                 case 0x40 ... 0x7e:        /* ['@' - '~'] */
-                        return parser_transition(parser, raw, STATE_GROUND,
-                                                 ACTION_CSI_DISPATCH);
+                        return parser_transition(STATE_GROUND, ACTION_CSI_DISPATCH);
                 case 0x9c:                /* ST */
-                        return parser_transition(parser, raw, STATE_GROUND,
-                                                 ACTION_IGNORE);
+                        return parser_transition(STATE_GROUND, ACTION_IGNORE);
                 }
 
-                return parser_transition_no_action(parser, raw, STATE_CSI_IGNORE);
+                return parser_transition_no_action(STATE_CSI_IGNORE);
         case STATE_CSI_IGNORE:
                 switch (raw) {
                 case 0x00 ... 0x1a:        /* C0 \ { ESC } */
                 case 0x1c ... 0x1f:
-                        return parser_action(parser, raw,
-                                             ACTION_EXECUTE);
+                        return parser_action(state, ACTION_EXECUTE);
                 case 0x1b:                /* ESC */
-                        return parser_transition(parser, raw, STATE_ESC,
-                                                 ACTION_CLEAR_INT);
+                        return parser_transition(STATE_ESC, ACTION_CLEAR_INT);
                 case 0x20 ... 0x3f:        /* [' ' - '?'] */
-                        return parser_nop(parser, raw);
+                        return parser_nop(state);
                 case 0x40 ... 0x7e:        /* ['@' - '~'] */
-                        return parser_transition_no_action(parser, raw, STATE_GROUND);
+                        return parser_transition_no_action(STATE_GROUND);
                 case 0x9c:                /* ST */
-                        return parser_transition(parser, raw, STATE_GROUND,
-                                                 ACTION_IGNORE);
+                        return parser_transition(STATE_GROUND, ACTION_IGNORE);
                 }
 
-                return parser_nop(parser, raw);
+                return parser_nop(state);
         case STATE_DCS_ENTRY:
                 switch (raw) {
                 case 0x00 ... 0x1a:        /* C0 \ ESC */
                 case 0x1c ... 0x1f:
-                        return parser_action(parser, raw,
-                                             ACTION_IGNORE);
+                        return parser_action(state, ACTION_IGNORE);
                 case 0x1b:                /* ESC */
-                        return parser_transition(parser, raw, STATE_ESC,
-                                                 ACTION_CLEAR_INT);
+                        return parser_transition(STATE_ESC, ACTION_CLEAR_INT);
                 case 0x20 ... 0x2f:        /* [' ' - '\'] */
-                        return parser_transition(parser, raw, STATE_DCS_INT,
-                                                 ACTION_COLLECT_DCS);
+                        return parser_transition(STATE_DCS_INT, ACTION_COLLECT_DCS);
                 case 0x30 ... 0x39:        /* ['0' - '9'] */
-                        return parser_transition(parser, raw, STATE_DCS_PARAM,
-                                                 ACTION_PARAM);
+                        return parser_transition(STATE_DCS_PARAM, ACTION_PARAM);
                 case 0x3a:                 /* ':' */
-                        return parser_transition(parser, raw, STATE_DCS_PARAM,
-                                                 ACTION_FINISH_SUBPARAM);
+                        return parser_transition(STATE_DCS_PARAM, ACTION_FINISH_SUBPARAM);
                 case 0x3b:                 /* ';' */
-                        return parser_transition(parser, raw, STATE_DCS_PARAM,
-                                                 ACTION_FINISH_PARAM);
+                        return parser_transition(STATE_DCS_PARAM, ACTION_FINISH_PARAM);
                 case 0x3c ... 0x3f:        /* ['<' - '?'] */
-                        return parser_transition(parser, raw, STATE_DCS_PARAM,
-                                                 ACTION_COLLECT_PARAMETER);
+                        return parser_transition(STATE_DCS_PARAM, ACTION_COLLECT_PARAMETER);
                 case 0x40 ... 0x7e:        /* ['@' - '~'] */
-                        return parser_transition(parser, raw, STATE_DCS_PASS,
-                                                 ACTION_DCS_CONSUME);
+                        return parser_transition(STATE_DCS_PASS, ACTION_DCS_CONSUME);
                 case 0x9c:                /* ST */
-                        return parser_transition(parser, raw, STATE_GROUND,
-                                                 ACTION_IGNORE);
+                        return parser_transition(STATE_GROUND, ACTION_IGNORE);
                 }
 
-                return parser_transition(parser, raw,
-                                         STATE_DCS_PASS, ACTION_DCS_CONSUME);
+                return parser_transition(STATE_DCS_PASS, ACTION_DCS_CONSUME);
         case STATE_DCS_PARAM:
                 switch (raw) {
                 case 0x00 ... 0x1a:        /* C0 \ { ESC } */
                 case 0x1c ... 0x1f:
-                        return parser_action(parser, raw,
-                                             ACTION_IGNORE);
+                        return parser_action(state, ACTION_IGNORE);
                 case 0x1b:                /* ESC */
-                        return parser_transition(parser, raw, STATE_ESC,
-                                                 ACTION_CLEAR_INT);
+                        return parser_transition(STATE_ESC, ACTION_CLEAR_INT);
                 case 0x20 ... 0x2f:        /* [' ' - '\'] */
-                        return parser_transition(parser, raw, STATE_DCS_INT,
-                                                 ACTION_COLLECT_DCS);
+                        return parser_transition(STATE_DCS_INT, ACTION_COLLECT_DCS);
                 case 0x30 ... 0x39:        /* ['0' - '9'] */
-                        return parser_action(parser, raw,
-                                                 ACTION_PARAM);
+                        return parser_action(state, ACTION_PARAM);
                 case 0x3a:                 /* ':' */
-                        return parser_action(parser, raw,
-                                             ACTION_FINISH_SUBPARAM);
+                        return parser_action(state, ACTION_FINISH_SUBPARAM);
                 case 0x3b:                 /* ';' */
-                        return parser_action(parser, raw,
-                                             ACTION_FINISH_PARAM);
+                        return parser_action(state, ACTION_FINISH_PARAM);
                 case 0x3c ... 0x3f:        /* ['<' - '?'] */
-                        return parser_transition_no_action(parser, raw, STATE_DCS_IGNORE);
+                        return parser_transition_no_action(STATE_DCS_IGNORE);
                 case 0x40 ... 0x7e:        /* ['@' - '~'] */
-                        return parser_transition(parser, raw, STATE_DCS_PASS,
-                                                 ACTION_DCS_CONSUME);
+                        return parser_transition(STATE_DCS_PASS, ACTION_DCS_CONSUME);
                 case 0x9c:                /* ST */
-                        return parser_transition(parser, raw, STATE_GROUND,
-                                                 ACTION_IGNORE);
+                        return parser_transition(STATE_GROUND, ACTION_IGNORE);
                 }
 
-                return parser_transition(parser, raw,
-                                         STATE_DCS_PASS, ACTION_DCS_CONSUME);
+                return parser_transition(STATE_DCS_PASS, ACTION_DCS_CONSUME);
         case STATE_DCS_INT:
                 switch (raw) {
                 case 0x00 ... 0x1a:        /* C0 \ { ESC } */
                 case 0x1c ... 0x1f:
-                        return parser_action(parser, raw,
-                                             ACTION_IGNORE);
+                        return parser_action(state, ACTION_IGNORE);
                 case 0x1b:                /* ESC */
-                        return parser_transition(parser, raw, STATE_ESC,
-                                                 ACTION_CLEAR_INT);
+                        return parser_transition(STATE_ESC, ACTION_CLEAR_INT);
                 case 0x20 ... 0x2f:        /* [' ' - '\'] */
-                        return parser_action(parser, raw,
-                                             ACTION_COLLECT_DCS);
+                        return parser_action(state, ACTION_COLLECT_DCS);
                 case 0x30 ... 0x3f:        /* ['0' - '?'] */
-                        return parser_transition_no_action(parser, raw, STATE_DCS_IGNORE);
+                        return parser_transition_no_action(STATE_DCS_IGNORE);
                 case 0x40 ... 0x7e:        /* ['@' - '~'] */
-                        return parser_transition(parser, raw, STATE_DCS_PASS,
-                                                 ACTION_DCS_CONSUME);
+                        return parser_transition(STATE_DCS_PASS, ACTION_DCS_CONSUME);
                 case 0x9c:                /* ST */
-                        return parser_transition(parser, raw, STATE_GROUND,
-                                                 ACTION_IGNORE);
+                        return parser_transition(STATE_GROUND, ACTION_IGNORE);
                 }
 
-                return parser_transition(parser, raw,
-                                         STATE_DCS_PASS, ACTION_DCS_CONSUME);
+                return parser_transition(STATE_DCS_PASS, ACTION_DCS_CONSUME);
         case STATE_DCS_PASS:
                 switch (raw) {
                 case 0x00 ... 0x1a:        /* ASCII \ { ESC } */
                 case 0x1c ... 0x7f:
-                        return parser_action(parser, raw,
-                                             ACTION_DCS_COLLECT);
+                        return parser_action(state, ACTION_DCS_COLLECT);
                 case 0x1b:                /* ESC */
-                        return parser_transition_no_action(parser, raw, STATE_DCS_PASS_ESC);
+                        return parser_transition_no_action(STATE_DCS_PASS_ESC);
                 case 0x9c:                /* ST */
-                        return parser_transition(parser, raw, STATE_GROUND,
-                                                 ACTION_DCS_DISPATCH);
+                        return parser_transition(STATE_GROUND, ACTION_DCS_DISPATCH);
                 }
 
-                return parser_action(parser, raw,
-                                     ACTION_DCS_COLLECT);
+                return parser_action(state, ACTION_DCS_COLLECT);
         case STATE_DCS_IGNORE:
                 switch (raw) {
                 case 0x00 ... 0x1a:        /* ASCII \ { ESC } */
                 case 0x1c ... 0x7f:
-                        return parser_nop(parser, raw);
+                        return parser_nop(state);
                 case 0x1b:                /* ESC */
-                        return parser_transition(parser, raw, STATE_ESC,
-                                                 ACTION_CLEAR_INT);
+                        return parser_transition(STATE_ESC, ACTION_CLEAR_INT);
                 case 0x9c:                /* ST */
-                        return parser_transition_no_action(parser, raw, STATE_GROUND);
+                        return parser_transition_no_action(STATE_GROUND);
                 }
 
-                return parser_nop(parser, raw);
+                return parser_nop(state);
         case STATE_OSC_STRING:
                 switch (raw) {
                 case 0x00 ... 0x06:        /* C0 \ { BEL, ESC } */
                 case 0x08 ... 0x1a:
                 case 0x1c ... 0x1f:
-                        return parser_nop(parser, raw);
+                        return parser_nop(state);
                 case 0x1b:                /* ESC */
-                        return parser_transition_no_action(parser, raw, STATE_OSC_STRING_ESC);
+                        return parser_transition_no_action(STATE_OSC_STRING_ESC);
                 case 0x20 ... 0x7f:        /* [' ' - DEL] */
-                        return parser_action(parser, raw,
-                                             ACTION_OSC_COLLECT);
+                        return parser_action(state, ACTION_OSC_COLLECT);
                 case 0x07:                /* BEL */
                 case 0x9c:                /* ST */
-                        return parser_transition(parser, raw, STATE_GROUND,
-                                                 ACTION_OSC_DISPATCH);
+                        return parser_transition(STATE_GROUND, ACTION_OSC_DISPATCH);
                 }
 
-                return parser_action(parser, raw,
-                                     ACTION_OSC_COLLECT);
+                return parser_action(state, ACTION_OSC_COLLECT);
         case STATE_ST_IGNORE:
                 switch (raw) {
                 case 0x00 ... 0x1a:        /* ASCII \ { ESC } */
                 case 0x1c ... 0x7f:
-                        return parser_nop(parser, raw);
+                        return parser_nop(state);
                 case 0x1b:                /* ESC */
-                        return parser_transition(parser, raw, STATE_ESC,
-                                                 ACTION_CLEAR_INT);
+                        return parser_transition(STATE_ESC, ACTION_CLEAR_INT);
                 case 0x9c:                /* ST */
-                        return parser_transition(parser, raw,
-                                                 STATE_GROUND, ACTION_IGNORE);
+                        return parser_transition(STATE_GROUND, ACTION_IGNORE);
                 }
 
-                return parser_nop(parser, raw);
+                return parser_nop(state);
         case STATE_SCI:
                 switch (raw) {
                 case 0x1b:                /* ESC */
-                        return parser_transition(parser, raw,
-                                                 STATE_ESC, ACTION_CLEAR_INT);
+                        return parser_transition(STATE_ESC, ACTION_CLEAR_INT);
                 case 0x08 ... 0x0d:        /* BS, HT, LF, VT, FF, CR */
                 case 0x20 ... 0x7e:        /* [' ' - '~'] */
-                        return parser_transition(parser, raw, STATE_GROUND,
-                                                 ACTION_SCI_DISPATCH);
+                        return parser_transition(STATE_GROUND, ACTION_SCI_DISPATCH);
                 }
 
-                return parser_transition(parser, raw, STATE_GROUND,
-                                         ACTION_IGNORE);
+                return parser_transition(STATE_GROUND, ACTION_IGNORE);
         }
 
-        g_assert_not_reached();
-        return VTE_SEQ_NONE;
+        return parser_nop(state);
 }
 
-int
-vte_parser_feed(vte_parser_t* parser,
-                uint32_t raw)
+/* The transition on @raw in @state */
+static constexpr parser_transition_t
+parser_next_transition(unsigned int state,
+                       uint32_t raw)
 {
         /*
          * Notes:
@@ -1403,42 +1378,210 @@ vte_parser_feed(vte_parser_t* parser,
 
         switch (raw) {
         case 0x18:                /* CAN */
-                return parser_transition(parser, raw,
-                                         STATE_GROUND, ACTION_IGNORE);
+                return parser_transition(STATE_GROUND, ACTION_IGNORE);
         case 0x1a:                /* SUB */
-                return parser_transition(parser, raw,
-                                         STATE_GROUND, ACTION_EXECUTE);
+                return parser_transition(STATE_GROUND, ACTION_EXECUTE);
         case 0x7f:                 /* DEL */
-                return parser_nop(parser, raw);
+                return parser_nop(state);
         case 0x80 ... 0x8f:        /* C1 \ {DCS, SOS, SCI, CSI, ST, OSC, PM, APC} */
         case 0x91 ... 0x97:
         case 0x99:
-                return parser_transition(parser, raw,
-                                         STATE_GROUND, ACTION_EXECUTE);
+                return parser_transition(STATE_GROUND, ACTION_EXECUTE);
         case 0x98:                /* SOS */
         case 0x9e:                /* PM */
         case 0x9f:                /* APC */
-                return parser_transition_no_action(parser, raw, STATE_ST_IGNORE);
+                return parser_transition_no_action(STATE_ST_IGNORE);
                 // FIXMEchpe shouldn't this use ACTION_CLEAR?
         case 0x90:                /* DCS */
-                return parser_transition(parser, raw,
-                                         STATE_DCS_ENTRY, ACTION_DCS_START);
+                return parser_transition(STATE_DCS_ENTRY, ACTION_DCS_START);
         case 0x9a:                /* SCI */
-                return parser_transition(parser, raw,
-                                         STATE_SCI, ACTION_CLEAR);
+                return parser_transition(STATE_SCI, ACTION_CLEAR);
         case 0x9d:                /* OSC */
-                return parser_transition(parser, raw,
-                                         STATE_OSC_STRING, ACTION_OSC_START);
+                return parser_transition(STATE_OSC_STRING, ACTION_OSC_START);
         case 0x9b:                /* CSI */
-                return parser_transition(parser, raw,
-                                         STATE_CSI_ENTRY, ACTION_CLEAR_INT_AND_PARAMS);
+                return parser_transition(STATE_CSI_ENTRY, ACTION_CLEAR_INT_AND_PARAMS);
         default:
-                return parser_feed_to_state(parser, raw);
+                return parser_state_transition(state, raw);
+        }
+}
+
+/* Characters from U+00A0 up are all treated alike, in any state, so
+ * a row for each state with a column for each byte covers them all;
+ * rows of a power of two make the lookup cheap.
+ */
+#define PARSER_N_CLASSES (0x100)
+
+static constexpr inline unsigned int
+parser_char_class(uint32_t raw)
+{
+        return raw < PARSER_N_CLASSES ? raw : 0xa0;
+}
+
+struct parser_table_t {
+        parser_transition_t transitions[STATE_N][PARSER_N_CLASSES];
+};
+
+static constexpr parser_table_t
+parser_make_table()
+{
+        auto table = parser_table_t{};
+        for (unsigned int state = 0; state < STATE_N; ++state)
+                for (unsigned int c = 0; c < PARSER_N_CLASSES; ++c)
+                        table.transitions[state][c] = parser_next_transition(state, c);
+        return table;
+}
+
+static constexpr auto const parser_table = parser_make_table();
+
+/* A string still pointing into the input is one that was dispatched
+ * by the previous feed; it's over now, and the input may be gone.
+ */
+static inline void
+parser_drop_span(vte_parser_t* parser)
+{
+        if (G_UNLIKELY(parser->seq.arg_str.span != nullptr))
+                vte_seq_string_reset(&parser->seq.arg_str);
+}
+
+template<typename T>
+static inline size_t
+parser_feed_run(vte_parser_t* parser,
+                T const* begin,
+                T const* end,
+                int* rv)
+{
+        parser_drop_span(parser);
+
+        /* Only the actions look at the state, and only a few change it */
+        auto state = parser->state;
+        auto p = begin;
+        auto ret = int{VTE_SEQ_NONE};
+
+        while (p != end) {
+                auto const raw = uint32_t(*p);
+
+                /* Bytes are only characters when they're ASCII */
+                if (sizeof(T) == 1 && G_UNLIKELY(raw >= 0x80))
+                        break;
+
+                ++p;
+
+                auto const transition = parser_table.transitions[state][parser_char_class(raw)];
+                state = transition.state;
+                if (transition.action == ACTION_NONE)
+                        continue;
+
+                /* The body of an OSC or DCS is collected a run at a time;
+                 * from bytes, it isn't even copied if it can be helped */
+                if (transition.action == ACTION_OSC_COLLECT ||
+                    transition.action == ACTION_DCS_COLLECT) {
+                        auto const run_begin = p - 1;
+                        while (p != end &&
+                               (sizeof(T) != 1 || *p < 0x80) &&
+                               parser_table.transitions[state][parser_char_class(*p)] == transition)
+                                ++p;
+
+                        auto const n = vte_seq_string_append(&parser->seq.arg_str, run_begin, p);
+                        if (G_UNLIKELY(run_begin + n != p)) {
+                                /* Too long; ignore the rest, as parser_{osc,dcs}_collect() would */
+                                p = run_begin + n + 1;
+                                state = transition.action == ACTION_OSC_COLLECT ?
+                                        STATE_ST_IGNORE : STATE_DCS_IGNORE;
+                        }
+                        continue;
+                }
+
+                parser->state = state;
+                ret = parser_perform(parser, transition.action, raw);
+                state = parser->state;
+                if (ret != VTE_SEQ_NONE)
+                        break;
         }
+
+        /* A string of bytes of the input is only good until the caller
+         * is done with what they completed; one still being collected
+         * needs its own copy.
+         */
+        if (sizeof(T) == 1 && ret != VTE_SEQ_OSC && ret != VTE_SEQ_DCS)
+                vte_seq_string_spill(&parser->seq.arg_str);
+
+        parser->state = state;
+        *rv = ret;
+        return p - begin;
+}
+
+int
+vte_parser_feed(vte_parser_t* parser,
+                uint32_t raw)
+{
+        parser_drop_span(parser);
+
+        auto const transition = parser_table.transitions[parser->state][parser_char_class(raw)];
+        parser->state = transition.state;
+
+        return parser_perform(parser, transition.action, raw);
+}
+
+/**
+ * vte_parser_feed_run() - Feed a run of characters to the parser
+ * @parser: the struct vte_parser
+ * @begin: the first character
+ * @end: past the last character
+ * @rv: location to store the result in
+ *
+ * Feeds the characters to the parser until one of them completes
+ * something, or @end is reached; the result is then stored in @rv,
+ * as vte_parser_feed() would return it for that last character.
+ * The variant taking bytes also stops at the first byte that
+ * isn't ASCII, without consuming it. The string argument of an
+ * OSC or DCS it completes may point into the bytes.
+ *
+ * Returns: the number of characters consumed
+ */
+size_t
+vte_parser_feed_run(vte_parser_t* parser,
+                    uint8_t const* begin,
+                    uint8_t const* end,
+                    int* rv)
+{
+        return parser_feed_run(parser, begin, end, rv);
+}
+
+size_t
+vte_parser_feed_run(vte_parser_t* parser,
+                    uint32_t const* begin,
+                    uint32_t const* end,
+                    int* rv)
+{
+        return parser_feed_run(parser, begin, end, rv);
 }
 
 void
 vte_parser_reset(vte_parser_t* parser)
 {
-        parser_transition(parser, 0, STATE_GROUND, ACTION_IGNORE);
+        parser->state = STATE_GROUND;
+        parser_ignore(parser, 0);
+}
+
+/**
+ * vte_parser_set_dispatch_unripe() - Enable dispatching streamed DCS early
+ * @parser: the struct vte_parser
+ * @enable: whether to dispatch unripe sequences
+ *
+ * When enabled, DCS sequences whose data string is potentially
+ * large (e.g. DECSIXEL) are dispatched as soon as their final
+ * character is received, with seq.unripe set, and the data string
+ * is not collected into seq.arg_str (and so not subject to its
+ * length limit); the caller is expected to consume the data string
+ * from its input itself, handing back to the parser only on the
+ * first character that is not part of the data string (i.e. ESC,
+ * CAN, SUB or a C1 control). The sequence is then dispatched again,
+ * with seq.unripe unset and an empty data string, when it is
+ * terminated by ST.
+ */
+void
+vte_parser_set_dispatch_unripe(vte_parser_t* parser,
+                               bool enable)
+{
+        parser->dispatch_unripe = enable;
 }
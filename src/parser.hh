@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <cstdio>
 
@@ -195,15 +196,30 @@ struct vte_seq_t {
         vte_seq_arg_t args[VTE_PARSER_ARG_MAX];
         vte_seq_string_t arg_str;
         uint32_t introducer;
+        bool unripe;
 };
 
+/* The state between sequences, where printable characters are GRAPHIC */
+#define VTE_PARSER_STATE_GROUND 0
+
 struct vte_parser_t {
         vte_seq_t seq;
         unsigned int state;
+        bool dispatch_unripe;
 };
 
 void vte_parser_init(vte_parser_t* parser);
 void vte_parser_deinit(vte_parser_t* parser);
 int vte_parser_feed(vte_parser_t* parser,
                     uint32_t raw);
+size_t vte_parser_feed_run(vte_parser_t* parser,
+                           uint8_t const* begin,
+                           uint8_t const* end,
+                           int* rv);
+size_t vte_parser_feed_run(vte_parser_t* parser,
+                           uint32_t const* begin,
+                           uint32_t const* end,
+                           int* rv);
 void vte_parser_reset(vte_parser_t* parser);
+void vte_parser_set_dispatch_unripe(vte_parser_t* parser,
+                                    bool enable);
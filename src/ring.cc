@@ -23,10 +23,13 @@
 #include "debug.h"
 #include "ring.hh"
 #include "vterowdata.hh"
+#include "vteimage.h"
+#include "vteimageindex.h"
 
 #include <string.h>
 #include <new>
-#include <map>
+#include <unordered_set>
+#include <vector>
 
 /*
  * Copy the common attributes from VteCellAttr to VteStreamCellAttr or vice versa.
@@ -76,9 +79,8 @@ Ring::Ring(row_t max_rows,
 		m_attr_stream = _vte_file_stream_new ();
 		m_text_stream = _vte_file_stream_new ();
 		m_row_stream = _vte_file_stream_new ();
-        m_img_stream = _vte_file_stream_new ();
 	} else {
-		m_attr_stream = m_text_stream = m_row_stream = m_img_stream = nullptr;
+		m_attr_stream = m_text_stream = m_row_stream = nullptr;
 	}
 
 	m_utf8_buffer = g_string_sized_new (128);
@@ -90,7 +92,9 @@ Ring::Ring(row_t max_rows,
         g_ptr_array_add(m_hyperlinks, empty_str);
 
 // <<<<<<< HEAD
-        m_img_map = new (std::nothrow) std::map<gint, vte::image::image_object *>();
+        m_img_index = new (std::nothrow) vte::image::image_index<vte::image::image_object>();
+        m_img_store = new vte::image::image_store();
+        m_img_store->set_lost_func([this] (std::vector<guint64> const& ids) { drop_lost_images(ids); });
         m_img_onscreen_resource_counter = 0;
         m_img_offscreen_resource_counter = 0;
 
@@ -104,7 +108,7 @@ Ring::~Ring()
 {
 // <<<<<<< HEAD
 	gulong i;
-	auto image_map = m_img_map;
+	auto image_index = m_img_index;
 // =======
 	for (size_t i = 0; i <= m_mask; i++)
 		_vte_row_data_fini (&m_array[i]);
@@ -116,22 +120,19 @@ Ring::~Ring()
 	g_free (ring->array);
 
 	/* Clear SIXEL images */
-	for (auto it = image_map->begin (); it != image_map->end (); ++it)
-		delete it->second;
-	image_map->clear();
-	delete m_img_map;
+	image_index->foreach ([] (vte::image::image_object *image) { delete image; });
+	delete m_img_index;
+	delete m_img_store;
 
 // 	if (ring->has_streams) {
 // 		g_object_unref (ring->attr_stream);
 // 		g_object_unref (ring->text_stream);
 // 		g_object_unref (ring->row_stream);
-// 		g_object_unref (ring->image_stream);
 // =======
 	if (m_has_streams) {
 		g_object_unref (m_attr_stream);
 		g_object_unref (m_text_stream);
 		g_object_unref (m_row_stream);
-        g_object_unref (m_img_stream);
 // >>>>>>> origin/vte-0-58
 	}
 
@@ -626,7 +627,7 @@ Ring::row_t
 Ring::reset()
 {
 // <<<<<<< HEAD
-	auto image_map = m_img_map;
+	auto image_index = m_img_index;
 
         // _vte_debug_print (VTE_DEBUG_RING, "Reseting the ring at %lu.\n", ring->end);
 // =======
@@ -639,11 +640,9 @@ Ring::reset()
 
 // <<<<<<< HEAD
 	/* Clear SIXEL images */
-	for (auto it = image_map->begin (); it != image_map->end (); ++it)
-		delete it->second;
-	image_map->clear();
-	if (ring->has_streams)
-		_vte_stream_reset (ring->image_stream, _vte_stream_head (ring->image_stream));
+	image_index->foreach ([] (vte::image::image_object *image) { delete image; });
+	image_index->clear ();
+	m_img_store->clear ();
 
         // return ring->end;
 // =======
@@ -1457,143 +1456,123 @@ err:
 /**
  * _vte_ring_append_image:
  * @ring: a #VteRing
- * @surface: a Cairo surface object
- * @pixelwidth: image width in pixels
- * @pixelheight: image height in pixels
- * @left: left position of image in cell unit
- * @top: left position of image in cell unit
- * @width: width of image in cell unit
- * @height: width of image in cell unit
+ * @image: the image or image tile, whose ownership is taken
+ * @char_width: the cell width in pixels
+ * @char_height: the cell height in pixels
  *
- * Append an image into the internal image list.
+ * Append an image into the internal image list. Images are appended as
+ * tiles, see image_object::create_tiles(), so drawing over a part of an
+ * image only thaws or replaces the tiles involved.
  */
 void
-_vte_ring_append_image (VteRing *ring, cairo_surface_t *surface, gint pixelwidth, gint pixelheight, glong left, glong top, glong width, glong height)
+_vte_ring_append_image (VteRing *ring, vte::image::image_object *image, gulong char_width, gulong char_height)
 {
 	using namespace vte::image;
-	image_object *image;
-	auto image_map = m_img_map;
-	gulong char_width, char_height;
+	auto image_index = m_img_index;
+	std::vector<image_object *> overlapping;
 
-	g_assert_true (image_map != NULL);
-
-	image = new (std::nothrow) image_object (surface, pixelwidth, pixelheight, left, top, width, height, ring->image_stream);
-	g_assert_true (image != NULL);
-
-	char_width = pixelwidth / width;
-	char_height = pixelwidth / height;
+	g_assert_true (image_index != NULL);
 
 	/* composition */
-	for (auto it = image_map->lower_bound (top); it != image_map->end (); ++it) {
-		image_object *current = it->second;
-
-		/* Combine two images if one's area includes another's area */
-		if (image->includes (current)) {
-			/*
-			 * Replace current image with new image
-			 *
-			 *  +--------------+
-			 *  |     new      |
-			 *  | ...........  |
-			 *  | : current :  |
-			 *  | :.........:  |
-			 *  +--------------+
-			 */
-			image_map->erase (image->get_bottom ());
-			if (current->is_freezed())
-				m_img_offscreen_resource_counter -= current->resource_size ();
-			else
-				m_img_onscreen_resource_counter -= current->resource_size ();
-			delete current;
-		} else if (current->includes (image)) {
-			/*
-			 * Copy new image to current image's sub-area.
-			 *
-			 *  +--------------+
-			 *  | +-----+      |
-			 *  | | new |      |
-			 *  | +-----+      |
-			 *  |    current   |
-			 *  +--------------+
-			 */
-			if (current->is_freezed()) {
-				m_img_offscreen_resource_counter -= current->resource_size ();
-				current->thaw ();
-			} else {
-				m_img_onscreen_resource_counter -= current->resource_size ();
-			}
-			current->combine (image, char_width, char_height);
-			m_img_onscreen_resource_counter += current->resource_size ();
-			delete image;
-			goto end;
+	image_index->find_overlapping (image->get_top (), image->get_bottom (),
+	                               image->get_left (), image->get_left () + image->get_width () - 1,
+	                               overlapping);
+
+	/*
+	 * Drop the images whose area the new image includes
+	 *
+	 *  +--------------+
+	 *  |     new      |
+	 *  | ...........  |
+	 *  | : current :  |
+	 *  | :.........:  |
+	 *  +--------------+
+	 */
+	auto last = overlapping.begin ();
+	for (auto current : overlapping) {
+		if (! image->includes (current)) {
+			*last++ = current;
+			continue;
 		}
+		image_index->remove (current);
+		if (current->is_freezed())
+			m_img_offscreen_resource_counter -= current->get_charged_size ();
+		else
+			m_img_onscreen_resource_counter -= current->get_charged_size ();
+		delete current;
+	}
+	overlapping.erase (last, overlapping.end ());
+
+	/*
+	 * Copy the new image into the sub-area of the newest image it overlaps,
+	 * if that one includes it; no other image is painted over that area then.
+	 *
+	 *  +--------------+
+	 *  | +-----+      |
+	 *  | | new |      |
+	 *  | +-----+      |
+	 *  |    current   |
+	 *  +--------------+
+	 *
+	 * If it can't be thawed or drawn into, the new image is kept on its own.
+	 */
+	if (! overlapping.empty () && overlapping.back ()->includes (image)) {
+		image_object *current = overlapping.back ();
+		bool combined;
 
-		if ((current->get_bottom () - image->get_bottom ()) * (current->get_top () - image->get_top ()) <= 0) {
-                        /*
-			 * Unite two images if one's [top, bottom] includes another's [top, bottom].
-			 * This operation ensures bottom-position-based order is same to top-position-based order.
-			 *
-			 *              +------+
-			 *  +---------+ |      |
-			 *  | current | | new  |
-			 *  |         | |      |
-			 *  +---------+ |      |
-			 *              +------+
-			 *  or
-			 *
-			 *  +---------+
-			 *  | current | +------+
-			 *  |         | | new  |
-			 *  |         | +------+
-			 *  +---------+
-			 *          |
-			 *          v
-			 *  +------------------+
-			 *  | new (united)     |
-			 *  |                  |
-			 *  +------------------+
-			 */
-			image->unite (image, char_width, char_height);
-			image_map->erase (current->get_bottom ());
-			if (current->is_freezed())
-				m_img_offscreen_resource_counter -= current->resource_size ();
-			else
-				m_img_onscreen_resource_counter -= current->resource_size ();
-			delete current;
-			goto end;
+		if (current->is_freezed())
+			m_img_offscreen_resource_counter -= current->get_charged_size ();
+		else
+			m_img_onscreen_resource_counter -= current->get_charged_size ();
+
+		combined = current->thaw () && current->combine (image, char_width, char_height);
+
+		if (current->is_freezed())
+			m_img_offscreen_resource_counter += current->charge ();
+		else
+			m_img_onscreen_resource_counter += current->charge ();
+
+		if (combined) {
+			delete image;
+			return;
 		}
 	}
 
-register_to_map:
 	/*
-	 * Now register new image to the image_map container.
-	 * the key is bottom positon.
-	 *  +----------+
-	 *  |   new    |
-	 *  |          |
-	 *  +----------+ <- bottom position (key)
+	 * Otherwise register the new image as the newest one. Images that
+	 * overlap only partly are kept as they are, the index paints them in
+	 * the order they came in.
 	 */
-	image_map->insert (std::make_pair (image->get_bottom (), image));
-	m_img_onscreen_resource_counter += image->resource_size ();
-end:
-	/* noop */
-	;
+	image_index->insert (image);
+	m_img_onscreen_resource_counter += image->charge ();
 }
 
+/*
+ * Delete the frozen images whose records the image store couldn't read back
+ * while compacting, and take them out of the offscreen counter; they could
+ * never be thawed.
+ */
 void
-_vte_ring_shrink_image_stream (VteRing *ring)
+Ring::drop_lost_images (std::vector<guint64> const& ids)
 {
 	using namespace vte::image;
-	image_object *first_image;
-
-	if (m_img_map->empty())
-		return;
-
-	first_image = m_img_map->begin()->second;
+	std::unordered_set<guint64> lost (ids.begin (), ids.end ());
+	std::vector<image_object *> images;
+
+	m_img_index->foreach ([&] (image_object *image) {
+		if (image->is_freezed () && lost.count (image->get_record ()))
+			images.push_back (image);
+	});
+
+	for (auto image : images) {
+		m_img_index->remove (image);
+		m_img_offscreen_resource_counter -= image->get_charged_size ();
+		delete image;
+	}
 
-	if (first_image->is_freezed ())
-		if (first_image->get_stream_position () > _vte_stream_tail (ring->image_stream))
-			_vte_stream_advance_tail (ring->image_stream, first_image->get_stream_position ());
+	_vte_debug_print (VTE_DEBUG_IMAGE,
+	                  "dropped %zu images with lost records, offscreen: %zu\n",
+	                  images.size (), m_img_offscreen_resource_counter);
 }
 
 // static gboolean
@@ -25,11 +25,11 @@
 
 #include <gio/gio.h>
 #include <vte/vte.h>
-#include <map>
 
 #include "vterowdata.h"
 #include "vtestream.h"
 #include "vteimage.h"
+#include "vteimageindex.h"
 
 G_BEGIN_DECLS
 
@@ -73,10 +73,9 @@ struct _VteRing {
          *    As far as the ring is concerned, this hyperlink data is opaque. Only the caller cares that
          *    if nonempty, it actually contains the ID and URI separated with a semicolon. Not NUL terminated.
          *  - 2 bytes repeating attr.hyperlink_length so that we can walk backwards.
-         *
-         * image_stream contains images in PNG format.
          */
-	VteStream *attr_stream, *text_stream, *row_stream, *image_stream;
+	VteStream *attr_stream, *text_stream, *row_stream;
+	vte::image::image_store *image_store;  /* frozen images */
 	gsize last_attr_text_start_offset;
 	VteCellAttr last_attr;
 	GString *utf8_buffer;
@@ -97,8 +96,8 @@ struct _VteRing {
                                                  An idx is allocated on hover even if the cell is scrolled out to the streams. */
         gulong hyperlink_maybe_gc_counter;  /* Do a GC when it reaches 65536. */
 
-        /* The SIXEL image list, registered with bottom position of image. */
-        std::map<gint, vte::image::image_object *> *image_map;
+        /* The SIXEL images, indexed by the rows and columns they cover. */
+        vte::image::image_index<vte::image::image_object> *image_index;
 
         /* resource counters for image management */
         size_t image_onscreen_resource_counter;  /* calculated amount size of in-memory or GPU-allocated images */
@@ -129,8 +128,7 @@ void _vte_ring_remove (VteRing *ring, gulong position);
 void _vte_ring_drop_scrollback (VteRing *ring, gulong position);
 void _vte_ring_set_visible_rows (VteRing *ring, gulong rows);
 void _vte_ring_rewrap (VteRing *ring, glong columns, VteVisualPosition **markers);
-void _vte_ring_append_image (VteRing *ring, cairo_surface_t *surface, gint pixelwidth, gint pixelheight, glong left, glong top, glong width, glong height);
-void _vte_ring_shrink_image_stream (VteRing *ring);
+void _vte_ring_append_image (VteRing *ring, vte::image::image_object *image, gulong char_width, gulong char_height);
 gboolean _vte_ring_write_contents (VteRing *ring,
 				   GOutputStream *stream,
 				   VteWriteFlags flags,
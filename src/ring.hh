@@ -29,6 +29,15 @@
 #include "vtestream.h"
 
 #include <type_traits>
+#include <vector>
+
+namespace vte {
+namespace image {
+struct image_object;
+class image_store;
+template <class T> class image_index;
+}
+}
 
 typedef struct _VteVisualPosition {
 	long row, col;
@@ -183,6 +192,8 @@ private:
                       char const** hyperlink);
         void reset_streams(row_t position);
 
+        void drop_lost_images(std::vector<guint64> const& ids);
+
 	row_t m_max;
 	row_t m_start{0};
         row_t m_end{0};
@@ -207,7 +218,7 @@ private:
          *  - 2 bytes repeating attr.hyperlink_length so that we can walk backwards.
          */
 	bool m_has_streams;
-	VteStream *m_attr_stream, *m_text_stream, *m_row_stream, *m_img_stream;
+	VteStream *m_attr_stream, *m_text_stream, *m_row_stream;
 	size_t m_last_attr_text_start_offset{0};
 	VteCellAttr m_last_attr;
 	GString *m_utf8_buffer;
@@ -226,6 +237,17 @@ private:
         hyperlink_idx_t m_hyperlink_hover_idx{0};  /* The hyperlink idx of the hovered cell.
                                                  An idx is allocated on hover even if the cell is scrolled out to the streams. */
         row_t m_hyperlink_maybe_gc_counter{0};  /* Do a GC when it reaches 65536. */
+
+        /* The SIXEL images, indexed by the rows and columns they cover. */
+        vte::image::image_index<vte::image::image_object> *m_img_index;
+
+        /* Where the images are frozen; also for rings without streams, which
+         * may have to freeze images for the memory budget. */
+        vte::image::image_store *m_img_store;
+
+        /* resource counters for image management */
+        size_t m_img_onscreen_resource_counter;  /* calculated amount size of in-memory or GPU-allocated images */
+        size_t m_img_offscreen_resource_counter;  /* calculated amount size of freezed images in m_img_store */
 };
 
 }; /* namespace base */
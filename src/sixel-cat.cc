@@ -0,0 +1,430 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <locale.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+
+#include "sixel.h"
+
+/* Decodes every DECSIXEL sequence found in its input, the way the
+ * terminal does: the body is fed to the decoder in read()-sized chunks,
+ * then finalised and converted to ARGB32.
+ *
+ * Files are read into memory before decoding starts, so that the
+ * benchmark only measures the decoder.
+ */
+
+struct BenchRun {
+        int64_t time;
+        gsize bytes;
+        gsize pixels;
+};
+
+class Processor {
+private:
+        bool m_quiet;
+        bool m_render;
+        gsize m_chunk_size;
+        GArray* m_bench_runs;
+        gsize m_images{0};
+        gsize m_errors{0};
+
+        /* Decodes the DECSIXEL body in [@body, @bodyend) with DCS
+         * parameters @params.
+         * Returns the number of pixels decoded.
+         */
+        gsize
+        decode_image(char const* filename,
+                     int const* params,
+                     int nparams,
+                     guchar const* body,
+                     guchar const* bodyend,
+                     int index,
+                     bool report)
+        {
+                sixel_state_t st;
+                if (sixel_parser_init(&st, 0xffffff, 0x000000, 1) < 0) {
+                        sixel_parser_deinit(&st);
+                        m_errors++;
+                        return 0;
+                }
+
+                sixel_parser_start(&st, params, nparams);
+
+                for (auto p = body; p < bodyend; ) {
+                        auto const len = std::min(gsize(bodyend - p), m_chunk_size);
+                        if (sixel_parser_parse(&st, p, len) < 0) {
+                                if (report)
+                                        g_printerr("%s: Decoder error at offset %" G_GSIZE_FORMAT "\n",
+                                                   filename, gsize(p - body));
+                                m_errors++;
+                                break;
+                        }
+                        p += len;
+                }
+
+                int width, height;
+                if (sixel_parser_finalize(&st, &width, &height) < 0) {
+                        sixel_parser_deinit(&st);
+                        m_errors++;
+                        return 0;
+                }
+
+                if (m_render) {
+                        auto const stride = width * 4;
+                        auto pixels = (unsigned char*)g_malloc(gsize(stride) * height);
+                        if (sixel_parser_render_rows(&st, pixels, stride, width, 0, height) < 0)
+                                m_errors++;
+                        g_free(pixels);
+                }
+
+                if (report && !m_quiet)
+                        g_print("%s: image %d: %dx%d, %d colors\n",
+                                filename, index, width, height, int(st.image.ncolors));
+
+                sixel_parser_deinit(&st);
+                return gsize(width) * height;
+        }
+
+        /* Finds the DECSIXEL sequences in @data and decodes them.
+         * Anything outside of a DECSIXEL sequence is skipped.
+         */
+        void
+        process_data(char const* filename,
+                     guchar const* data,
+                     gsize size,
+                     bool report)
+        {
+                auto const start_time = g_get_monotonic_time();
+
+                gsize pixels = 0;
+                int index = 0;
+                auto const end = data + size;
+                auto p = data;
+                while (p < end) {
+                        /* DCS is either ESC P or the C1 control */
+                        if (*p == 0x1b && p + 1 < end && p[1] == 'P')
+                                p += 2;
+                        else if (*p == 0x90)
+                                p += 1;
+                        else {
+                                p++;
+                                continue;
+                        }
+
+                        int params[DECSIXEL_PARAMS_MAX];
+                        int nparams = 0;
+                        int param = -1;
+                        for (; p < end; ++p) {
+                                if (*p >= '0' && *p <= '9') {
+                                        param = std::min(std::max(param, 0) * 10 + (*p - '0'),
+                                                         DECSIXEL_PARAMVALUE_MAX);
+                                } else if (*p == ';') {
+                                        if (nparams < DECSIXEL_PARAMS_MAX)
+                                                params[nparams++] = std::max(param, 0);
+                                        param = -1;
+                                } else
+                                        break;
+                        }
+                        if (param >= 0 && nparams < DECSIXEL_PARAMS_MAX)
+                                params[nparams++] = param;
+
+                        /* Not a DECSIXEL, skip it */
+                        if (p == end || *p != 'q')
+                                continue;
+                        ++p;
+
+                        /* The body runs up to ST, or anything else that aborts the DCS */
+                        auto bodyend = p;
+                        while (bodyend < end &&
+                               *bodyend != 0x1b && *bodyend != 0x9c &&
+                               *bodyend != 0x18 && *bodyend != 0x1a)
+                                ++bodyend;
+
+                        m_images++;
+                        pixels += decode_image(filename, params, nparams, p, bodyend, index++, report);
+                        p = bodyend;
+                }
+
+                BenchRun run{g_get_monotonic_time() - start_time, size, pixels};
+                g_array_append_val(m_bench_runs, run);
+        }
+
+        bool
+        process_file(char const* filename,
+                     int fd,
+                     int repeat)
+        {
+                auto data = g_byte_array_new();
+
+                gsize const buf_size = 16384;
+                guchar* buf = g_new0(guchar, buf_size);
+
+                bool rv = true;
+                for (;;) {
+                        auto len = read(fd, buf, buf_size);
+                        if (!len)
+                                break;
+                        if (len == -1) {
+                                if (errno == EAGAIN || errno == EINTR)
+                                        continue;
+                                g_printerr("Error reading %s: %m\n", filename);
+                                rv = false;
+                                break;
+                        }
+                        g_byte_array_append(data, buf, len);
+                }
+                g_free(buf);
+
+                for (auto i = 0; rv && i < repeat; ++i)
+                        process_data(filename, data->data, data->len, i == 0);
+
+                g_byte_array_unref(data);
+                return rv;
+        }
+
+        static double
+        mega_per_second(gsize count,
+                        int64_t time) noexcept
+        {
+                /* Microseconds in, millions per second out */
+                return time > 0 ? double(count) / double(time) : 0.;
+        }
+
+public:
+
+        Processor(bool quiet,
+                  bool render,
+                  int chunk_size) noexcept
+                : m_quiet{quiet},
+                  m_render{render},
+                  m_chunk_size{gsize(std::max(chunk_size, 1))}
+        {
+                m_bench_runs = g_array_new(false, true, sizeof(BenchRun));
+        }
+
+        ~Processor() noexcept
+        {
+                g_array_free(m_bench_runs, true);
+        }
+
+        inline constexpr gsize errors() const noexcept { return m_errors; }
+
+        bool process_files(char const* const* filenames,
+                           int repeat)
+        {
+                bool r = true;
+                if (filenames != nullptr) {
+                        for (auto i = 0; filenames[i] != nullptr; i++) {
+                                char const* filename = filenames[i];
+
+                                int fd = -1;
+                                if (g_str_equal(filename, "-")) {
+                                        fd = STDIN_FILENO;
+                                } else {
+                                        fd = open(filename, O_RDONLY);
+                                        if (fd == -1) {
+                                                g_printerr("Error opening file %s: %m\n", filename);
+                                        }
+                                }
+                                if (fd != -1) {
+                                        r = process_file(filename, fd, repeat);
+                                        if (fd != STDIN_FILENO)
+                                                close(fd);
+                                        if (!r)
+                                                break;
+                                }
+                        }
+                } else {
+                        r = process_file("-", STDIN_FILENO, repeat);
+                }
+
+                return r;
+        }
+
+        void print_benchmark() const noexcept
+        {
+                if (m_bench_runs->len == 0)
+                        return;
+
+                g_array_sort(m_bench_runs,
+                             [](void const* p1, void const* p2) -> int {
+                                     int64_t const t1 = ((BenchRun const*)p1)->time;
+                                     int64_t const t2 = ((BenchRun const*)p2)->time;
+                                     return t1 == t2 ? 0 : (t1 < t2 ? -1 : 1);
+                             });
+
+                int64_t total_time = 0;
+                gsize total_bytes = 0, total_pixels = 0;
+                double min_mbps = G_MAXDOUBLE, max_mbps = 0.;
+                double min_mpps = G_MAXDOUBLE, max_mpps = 0.;
+                for (unsigned int i = 0; i < m_bench_runs->len; ++i) {
+                        auto const& run = g_array_index(m_bench_runs, BenchRun, i);
+                        total_time += run.time;
+                        total_bytes += run.bytes;
+                        total_pixels += run.pixels;
+
+                        auto const mbps = mega_per_second(run.bytes, run.time);
+                        auto const mpps = mega_per_second(run.pixels, run.time);
+                        min_mbps = std::min(min_mbps, mbps);
+                        max_mbps = std::max(max_mbps, mbps);
+                        min_mpps = std::min(min_mpps, mpps);
+                        max_mpps = std::max(max_mpps, mpps);
+                }
+
+                g_printerr("\nImages: %\'" G_GSIZE_FORMAT " errors %\'" G_GSIZE_FORMAT "\n",
+                           m_images, m_errors);
+                g_printerr("Times: best %\'" G_GINT64_FORMAT "µs "
+                           "worst %\'" G_GINT64_FORMAT "µs "
+                           "average %\'" G_GINT64_FORMAT "µs\n",
+                           g_array_index(m_bench_runs, BenchRun, 0).time,
+                           g_array_index(m_bench_runs, BenchRun, m_bench_runs->len - 1).time,
+                           total_time / (int64_t)m_bench_runs->len);
+                g_printerr("MB/s: min %.2f max %.2f average %.2f\n",
+                           min_mbps, max_mbps, mega_per_second(total_bytes, total_time));
+                g_printerr("Mpixels/s: min %.2f max %.2f average %.2f\n",
+                           min_mpps, max_mpps, mega_per_second(total_pixels, total_time));
+                for (unsigned int i = 0; i < m_bench_runs->len; ++i) {
+                        auto const& run = g_array_index(m_bench_runs, BenchRun, i);
+                        g_printerr("  %\'" G_GINT64_FORMAT "µs %.2f MB/s %.2f Mpixels/s\n",
+                                   run.time,
+                                   mega_per_second(run.bytes, run.time),
+                                   mega_per_second(run.pixels, run.time));
+                }
+        }
+
+}; // class Processor
+
+class Options {
+private:
+        bool m_benchmark{false};
+        bool m_no_render{false};
+        bool m_no_simd{false};
+        bool m_quiet{false};
+        int m_chunk_size{16384};
+        int m_repeat{1};
+        char** m_filenames{nullptr};
+
+        template<typename T1, typename T2 = T1>
+        class OptionArg {
+        private:
+                T1* m_return_ptr;
+                T2 m_value;
+        public:
+                OptionArg(T1* ptr, T2 v) : m_return_ptr{ptr}, m_value{v} { }
+                ~OptionArg() { *m_return_ptr = m_value; }
+
+                inline constexpr T2* ptr() noexcept { return &m_value; }
+        };
+
+        using BoolArg = OptionArg<bool, gboolean>;
+        using IntArg = OptionArg<int>;
+        using StrvArg = OptionArg<char**>;
+
+public:
+
+        Options() noexcept = default;
+        Options(Options const&) = delete;
+        Options(Options&&) = delete;
+
+        ~Options() {
+                if (m_filenames != nullptr)
+                        g_strfreev(m_filenames);
+        }
+
+        inline constexpr bool benchmark()  const noexcept { return m_benchmark;  }
+        inline constexpr bool no_render()  const noexcept { return m_no_render;  }
+        inline constexpr bool no_simd()    const noexcept { return m_no_simd;    }
+        inline constexpr bool quiet()      const noexcept { return m_quiet;      }
+        inline constexpr int  chunk_size() const noexcept { return m_chunk_size; }
+        inline constexpr int  repeat()     const noexcept { return m_repeat;     }
+        inline constexpr char const* const* filenames() const noexcept { return m_filenames; }
+
+        bool parse(int argc,
+                   char* argv[],
+                   GError** error) noexcept
+        {
+                BoolArg benchmark{&m_benchmark, false};
+                BoolArg no_render{&m_no_render, false};
+                BoolArg no_simd{&m_no_simd, false};
+                BoolArg quiet{&m_quiet, false};
+                IntArg chunk_size{&m_chunk_size, 16384};
+                IntArg repeat{&m_repeat, 1};
+                StrvArg filenames{&m_filenames, nullptr};
+                GOptionEntry const entries[] = {
+                        { "benchmark", 'b', 0, G_OPTION_ARG_NONE, benchmark.ptr(),
+                          "Measure time spent decoding each file", nullptr },
+                        { "chunk-size", 'c', 0, G_OPTION_ARG_INT, chunk_size.ptr(),
+                          "Feed the decoder SIZE bytes at a time", "SIZE" },
+                        { "no-render", 'n', 0, G_OPTION_ARG_NONE, no_render.ptr(),
+                          "Only decode, do not convert to ARGB32", nullptr },
+                        { "no-simd", 0, 0, G_OPTION_ARG_NONE, no_simd.ptr(),
+                          "Convert to ARGB32 without SIMD", nullptr },
+                        { "quiet", 'q', 0, G_OPTION_ARG_NONE, quiet.ptr(),
+                          "Suppress output except for errors and benchmark", nullptr },
+                        { "repeat", 'r', 0, G_OPTION_ARG_INT, repeat.ptr(),
+                          "Repeat each file COUNT times", "COUNT" },
+                        { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, filenames.ptr(),
+                          nullptr, nullptr },
+                        { nullptr },
+                };
+
+                auto context = g_option_context_new("[FILE…] — sixel cat");
+                g_option_context_set_help_enabled(context, true);
+                g_option_context_add_main_entries(context, entries, nullptr);
+
+                bool rv = g_option_context_parse(context, &argc, &argv, error);
+                g_option_context_free(context);
+                return rv;
+        }
+}; // class Options
+
+int
+main(int argc,
+     char *argv[])
+{
+        setlocale(LC_ALL, "");
+
+        Options options{};
+        GError* err = nullptr;
+        if (!options.parse(argc, argv, &err)) {
+                g_printerr("Failed to parse arguments: %s\n", err->message);
+                g_error_free(err);
+                return EXIT_FAILURE;
+        }
+
+        if (options.no_simd())
+                sixel_parser_set_simd_enabled(false);
+
+        Processor proc{options.quiet(), !options.no_render(), options.chunk_size()};
+        auto rv = proc.process_files(options.filenames(), options.repeat());
+
+        if (options.benchmark())
+                proc.print_benchmark();
+
+        return rv && proc.errors() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
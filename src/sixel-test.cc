@@ -0,0 +1,404 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <glib.h>
+
+#include "sixel.h"
+
+/* Sets up @st with a @width x @height image of random colours from a random palette */
+static void
+init_random_image(sixel_state_t* st,
+                  int width,
+                  int height)
+{
+        g_assert_cmpint(sixel_parser_init(st, 0xffffff, 0x000000, 1), ==, 0);
+
+        int const params[] = { 0, 1, 0 };
+        sixel_parser_start(st, params, G_N_ELEMENTS(params));
+
+        /* DECGRA sizes the image buffer */
+        auto const raster = std::string{"\"1;1;"} + std::to_string(width) + ";" + std::to_string(height) + "?";
+        g_assert_cmpint(sixel_parser_parse(st, (unsigned char const*)raster.data(), raster.size()), ==, 0);
+        g_assert_cmpint(st->image.width, ==, width);
+        g_assert_cmpint(st->image.height, ==, height);
+
+        auto rand = g_rand_new_with_seed(42);
+        for (auto i = 0; i < DECSIXEL_PALETTE_MAX; ++i)
+                st->image.palette[i] = g_rand_int_range(rand, 0, 0x1000000);
+        for (auto y = 0; y < height; ++y) {
+                auto row = sixel_parser_get_row(st, y, width);
+                g_assert_nonnull(row);
+                for (auto x = 0; x < width; ++x)
+                        row[x] = g_rand_int_range(rand, 0, DECSIXEL_PALETTE_MAX);
+        }
+        g_rand_free(rand);
+}
+
+static void
+test_sixel_render_rows(void)
+{
+        int const width = 67, height = 13;
+        sixel_state_t st;
+        init_random_image(&st, width, height);
+
+        auto const stride = (width + 1) * 4;
+        auto pixels = (unsigned char*)g_malloc0(stride * height);
+        auto simd_pixels = (unsigned char*)g_malloc0(stride * height);
+
+        sixel_parser_set_simd_enabled(false);
+        g_assert_cmpint(sixel_parser_render_rows(&st, pixels, stride, width, 0, height), ==, 0);
+
+        for (auto y = 0; y < height; ++y) {
+                for (auto x = 0; x < width; ++x) {
+                        uint32_t pixel;
+                        memcpy(&pixel, pixels + y * stride + x * 4, sizeof(pixel));
+
+                        auto const color = st.image.palette[sixel_parser_get_row(&st, y, width)[x]];
+                        g_assert_cmphex(pixel >> 24, ==, 0xff);
+                        g_assert_cmphex(pixel >> 16 & 0xff, ==, color & 0xff);
+                        g_assert_cmphex(pixel >> 8 & 0xff, ==, color >> 8 & 0xff);
+                        g_assert_cmphex(pixel & 0xff, ==, color >> 16 & 0xff);
+                }
+        }
+
+        /* Whatever kernel is available must produce the same pixels */
+        sixel_parser_set_simd_enabled(true);
+        g_assert_cmpint(sixel_parser_render_rows(&st, simd_pixels, stride, width, 0, height), ==, 0);
+        g_assert_cmpint(memcmp(pixels, simd_pixels, stride * height), ==, 0);
+
+        /* Partial renders only touch their rows */
+        memset(simd_pixels, 0, stride * height);
+        g_assert_cmpint(sixel_parser_render_rows(&st, simd_pixels, stride, width, 6, 12), ==, 0);
+        g_assert_cmpint(memcmp(pixels + 6 * stride, simd_pixels + 6 * stride, 6 * stride), ==, 0);
+        for (auto i = 0; i < 6 * stride; ++i)
+                g_assert_cmpint(simd_pixels[i], ==, 0);
+
+        /* Out of bounds */
+        g_assert_cmpint(sixel_parser_render_rows(&st, pixels, stride, width + 1, 0, height), <, 0);
+        g_assert_cmpint(sixel_parser_render_rows(&st, pixels, stride, width, 0, height + 1), <, 0);
+
+        g_free(simd_pixels);
+        g_free(pixels);
+        sixel_parser_deinit(&st);
+}
+
+/* Decodes the sixel data string @data into @st */
+static void
+parse_sixel(sixel_state_t* st,
+            std::string const& data)
+{
+        g_assert_cmpint(sixel_parser_init(st, 0xffffff, 0x000000, 1), ==, 0);
+
+        int const params[] = { 0, 1, 0 };
+        sixel_parser_start(st, params, G_N_ELEMENTS(params));
+        g_assert_cmpint(sixel_parser_parse(st, (unsigned char const*)data.data(), data.size()), ==, 0);
+}
+
+/* Renders the finished image in @st */
+static std::vector<uint32_t>
+render_image(sixel_state_t* st,
+             int* width,
+             int* height)
+{
+        g_assert_cmpint(sixel_parser_finalize(st, width, height), ==, 0);
+
+        auto pixels = std::vector<uint32_t>(*width * *height);
+        g_assert_cmpint(sixel_parser_render_rows(st, (unsigned char*)pixels.data(), *width * 4,
+                                                 *width, 0, *height), ==, 0);
+        return pixels;
+}
+
+static void
+assert_same_image(sixel_state_t* a,
+                  sixel_state_t* b)
+{
+        int a_width, a_height, b_width, b_height;
+        auto const a_pixels = render_image(a, &a_width, &a_height);
+        auto const b_pixels = render_image(b, &b_width, &b_height);
+
+        g_assert_cmpint(a_width, ==, b_width);
+        g_assert_cmpint(a_height, ==, b_height);
+        g_assert_true(a_pixels == b_pixels);
+}
+
+static void
+test_sixel_parse_repeat(void)
+{
+        /* A repeat must decode to the same pixels as the spelled out sixels,
+         * for each bit pattern and for runs not multiple of the fill width.
+         */
+        for (auto bits = 0; bits < 64; ++bits) {
+                for (auto count : {2, 3, 4, 5, 9, 300}) {
+                        auto const c = char('?' + bits);
+                        auto const prefix = std::string{"#1;2;100;0;0#2;2;0;100;0#2~~~~~~~~-#1"} + c;
+
+                        sixel_state_t repeated, spelled;
+                        parse_sixel(&repeated, prefix + "!" + std::to_string(count) + c + "$#2!3" + c);
+                        parse_sixel(&spelled, prefix + std::string(count, c) + "$#2" + std::string(3, c));
+                        assert_same_image(&repeated, &spelled);
+
+                        sixel_parser_deinit(&repeated);
+                        sixel_parser_deinit(&spelled);
+                }
+        }
+}
+
+static void
+assert_finalize(std::string const& data,
+                int expected_width,
+                int expected_height)
+{
+        sixel_state_t st;
+        parse_sixel(&st, data);
+
+        int width, height;
+        g_assert_cmpint(sixel_parser_finalize(&st, &width, &height), ==, 0);
+        g_assert_cmpint(width, ==, expected_width);
+        g_assert_cmpint(height, ==, expected_height);
+        g_assert_cmpint(width, <=, st.image.width);
+        g_assert_cmpint(height, <=, st.image.height);
+
+        sixel_parser_deinit(&st);
+}
+
+static void
+test_sixel_finalize(void)
+{
+        /* Size from the pixels drawn */
+        assert_finalize("#1~~~", 3, 6);
+        assert_finalize("#1~~~-~", 3, 12);
+        assert_finalize("#1~~~-!5@", 5, 7);
+
+        /* Raster attributes extend the size, but don't crop */
+        assert_finalize("\"1;1;10;7#1~~~", 10, 7);
+        assert_finalize("\"1;1;2;2#1~~~-~", 3, 12);
+}
+
+static void
+test_sixel_parse_growth(void)
+{
+        /* Bands grow on their own; narrower bands read as background */
+        auto image = std::string{"#1;2;0;0;100#1~-#2;2;100;0;0#2!500~$#1!5~-#1"};
+        for (auto x = 0; x < 700; ++x)
+                image += char('?' + (x & 0x3f));
+        image += "--#2!3~";
+
+        sixel_state_t st;
+        parse_sixel(&st, image);
+
+        int width, height;
+        auto const pixels = render_image(&st, &width, &height);
+        g_assert_cmpint(width, ==, 700);
+        g_assert_cmpint(height, ==, 30);
+
+        auto const bg = pixels[1];
+        auto const blue = pixels[0];
+        auto const red = pixels[6 * width + 5];
+        g_assert_cmphex(blue, ==, 0xff0000ffu);
+        g_assert_cmphex(red, ==, 0xffff0000u);
+        g_assert_cmphex(bg, ==, 0xff000000u);
+        g_assert_cmphex(pixels[6 * width + 4], ==, blue);
+        g_assert_cmphex(pixels[11 * width + 499], ==, red);
+        g_assert_cmphex(pixels[11 * width + 500], ==, bg);
+        g_assert_cmphex(pixels[5 * width + 699], ==, bg);
+        /* an empty band */
+        for (auto x = 0; x < width; ++x)
+                g_assert_cmphex(pixels[18 * width + x], ==, bg);
+        g_assert_cmphex(pixels[24 * width + 2], ==, red);
+        g_assert_cmphex(pixels[24 * width + 3], ==, bg);
+
+        sixel_parser_deinit(&st);
+
+        /* Don't grow past the maximum size */
+        parse_sixel(&st, "#1!5000~" + std::string(1000, '-') + "~");
+        g_assert_cmpint(st.image.width, ==, DECSIXEL_WIDTH_MAX);
+        g_assert_cmpint(st.image.height, <=, DECSIXEL_HEIGHT_MAX);
+        sixel_parser_deinit(&st);
+}
+
+static void
+test_sixel_render_indices(void)
+{
+        auto image = std::string{"#1;2;0;0;100#1~-#300;2;100;0;0#300!50~$#1!5~-#1"};
+        for (auto x = 0; x < 70; ++x)
+                image += char('?' + (x & 0x3f));
+        image += "--#2!3~";
+
+        sixel_state_t st;
+        parse_sixel(&st, image);
+
+        int width, height;
+        auto const pixels = render_image(&st, &width, &height);
+
+        unsigned int table[DECSIXEL_PALETTE_MAX];
+        auto const ncolors = sixel_parser_get_palette(&st, table);
+        g_assert_cmpint(ncolors, >, 300);
+
+        /* Expanding the indices through the palette gives the rendered pixels */
+        auto indices = std::vector<sixel_color_no_t>(width * height);
+        g_assert_cmpint(sixel_parser_render_indices(&st, (unsigned char*)indices.data(), width * 2, 2,
+                                                    width, 0, height), ==, 0);
+        auto expanded = std::vector<uint32_t>(width * height);
+        for (auto y = 0; y < height; ++y) {
+                for (auto x = 0; x < width; ++x)
+                        g_assert_cmpint(indices[y * width + x], <, ncolors);
+                sixel_expand_indices(indices.data() + y * width, expanded.data() + y * width, width, table);
+        }
+        g_assert_true(expanded == pixels);
+
+        /* Byte indices, as long as they fit */
+        auto narrow = std::vector<unsigned char>(width * height);
+        g_assert_cmpint(sixel_parser_render_indices(&st, narrow.data(), width, 1, width, 0, height), ==, 0);
+        for (auto i = 0; i < width * height; ++i)
+                g_assert_cmpint(narrow[i], ==, indices[i] & 0xff);
+
+        /* Out of bounds */
+        g_assert_cmpint(sixel_parser_render_indices(&st, narrow.data(), width, 1, width + 1, 0, height), <, 0);
+        g_assert_cmpint(sixel_parser_render_indices(&st, narrow.data(), width, 4, width, 0, height), <, 0);
+
+        sixel_parser_deinit(&st);
+}
+
+static void
+test_sixel_parse_perf(void)
+{
+        /* Plotting tools mostly emit long repeats of few colours */
+        auto plot = std::string{"\"1;1;2000;1200#1;2;100;100;100#2;2;0;0;100#3;2;100;0;0"};
+        for (auto band = 0; band < 200; ++band) {
+                plot += "#1!800~#2!37{!400~#3!3N!760~$";
+                plot += "#2!120?!9B!1871?-";
+        }
+
+        auto best = G_MAXDOUBLE;
+        for (auto i = 0; i < 16; ++i) {
+                sixel_state_t st;
+                g_test_timer_start();
+                parse_sixel(&st, plot);
+                best = MIN(best, g_test_timer_elapsed());
+                sixel_parser_deinit(&st);
+        }
+
+        g_test_minimized_result(best, "plot %zu bytes: %.2f ms (%.1f MB/s)",
+                                plot.size(), best * 1000., plot.size() / best / 1000000.);
+}
+
+static void
+benchmark_parse_growth(char const* what,
+                       int size,
+                       std::string const& image)
+{
+        auto best = G_MAXDOUBLE;
+        for (auto i = 0; i < (size > 1024 ? 8 : 128); ++i) {
+                sixel_state_t st;
+                parse_sixel(&st, "");
+                g_test_timer_start();
+                sixel_parser_parse(&st, (unsigned char const*)image.data(), image.size());
+                best = MIN(best, g_test_timer_elapsed());
+                sixel_parser_deinit(&st);
+        }
+
+        g_test_minimized_result(best, "%dx%d %s without raster attributes: %.2f ms (%.1f MB/s)",
+                                size, size, what, best * 1000., image.size() / best / 1000000.);
+}
+
+static void
+test_sixel_parse_growth_perf(void)
+{
+        /* Without raster attributes, the image buffer has to grow as the
+         * sixels arrive.
+         */
+        for (auto size : {256, 1024, 4000}) {
+                auto sixels = std::string{};
+                auto repeats = std::string{};
+                for (auto band = 0; band < size / 6; ++band) {
+                        for (auto color = 1; color <= 4; ++color) {
+                                sixels += "#" + std::to_string(color);
+                                for (auto x = 0; x < size; ++x)
+                                        sixels += char('?' + ((x + band * color) & 0x3f));
+                                sixels += "$";
+                        }
+                        sixels += "-";
+                        repeats += "#1!" + std::to_string(size) + "~-";
+                }
+
+                benchmark_parse_growth("sixels", size, sixels);
+                benchmark_parse_growth("repeats", size, repeats);
+        }
+}
+
+static void
+benchmark_render_rows(int size,
+                      bool simd)
+{
+        sixel_state_t st;
+        init_random_image(&st, size, size);
+
+        auto pixels = (unsigned char*)g_malloc(size * size * 4);
+        auto const have_simd = sixel_parser_set_simd_enabled(simd);
+
+        auto const repeat = size >= 4096 ? 4 : 64;
+        auto best = G_MAXDOUBLE;
+        for (auto i = 0; i < repeat; ++i) {
+                g_test_timer_start();
+                sixel_parser_render_rows(&st, pixels, size * 4, size, 0, size);
+                best = MIN(best, g_test_timer_elapsed());
+        }
+
+        g_test_minimized_result(best, "%dx%d %s: %.2f ms (%.1f Mpixels/s)",
+                                size, size,
+                                have_simd ? "simd" : "scalar",
+                                best * 1000., size * size / best / 1000000.);
+
+        sixel_parser_set_simd_enabled(true);
+        g_free(pixels);
+        sixel_parser_deinit(&st);
+}
+
+static void
+test_sixel_render_rows_perf(void)
+{
+        for (auto size : {1024, 4096}) {
+                benchmark_render_rows(size, false);
+                benchmark_render_rows(size, true);
+        }
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+        g_test_init(&argc, &argv, nullptr);
+
+        g_test_add_func("/vte/sixel/parse/repeat", test_sixel_parse_repeat);
+        g_test_add_func("/vte/sixel/parse/growth", test_sixel_parse_growth);
+        g_test_add_func("/vte/sixel/finalize", test_sixel_finalize);
+        g_test_add_func("/vte/sixel/render-rows", test_sixel_render_rows);
+        g_test_add_func("/vte/sixel/render-indices", test_sixel_render_indices);
+        if (g_test_perf()) {
+                g_test_add_func("/vte/sixel/parse/perf", test_sixel_parse_perf);
+                g_test_add_func("/vte/sixel/parse/growth/perf", test_sixel_parse_growth_perf);
+                g_test_add_func("/vte/sixel/render-rows/perf", test_sixel_render_rows_perf);
+        }
+
+        return g_test_run();
+}
@@ -21,8 +21,14 @@
 #include <stdio.h>
 #include <ctype.h>   /* isdigit */
 #include <string.h>  /* memcpy */
+#include <stdint.h>
 #include <glib.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SIXEL_HAVE_AVX2 1
+#endif
+
 #include "sixel.h"
 
 #define SIXEL_RGB(r, g, b) ((r) + ((g) << 8) +  ((b) << 16))
@@ -145,30 +151,124 @@ set_default_color(sixel_image_t *image)
 	return (0);
 }
 
+/*
+ *  Palette expansion into cairo's ARGB32 format, i.e. native-endian
+ *  32-bit words with the alpha in the top byte.
+ *  Sixel pixels are always opaque, so no premultiplication is needed.
+ */
+typedef void (*expand_func_t)(sixel_color_no_t const *src, uint32_t *dst,
+                              int n, uint32_t const *table);
+
+static expand_func_t expand_func = NULL;  /* atomic; render jobs expand on worker threads */
+static int simd_enabled = 1;
+
+static void
+build_argb_table(sixel_image_t const *image, uint32_t *table)
+{
+	int n;
+	int color;
+
+	for (n = 0; n < DECSIXEL_PALETTE_MAX; n++) {
+		color = image->palette[n];
+		table[n] = 0xff000000u |
+		           (uint32_t)(color >> 0 & 0xff) << 16 |  /* r */
+		           (uint32_t)(color >> 8 & 0xff) << 8 |   /* g */
+		           (uint32_t)(color >> 16 & 0xff);        /* b */
+	}
+}
+
+static void
+expand_row_scalar(sixel_color_no_t const *src, uint32_t *dst,
+                  int n, uint32_t const *table)
+{
+	int x;
+
+	for (x = 0; x < n; ++x)
+		dst[x] = table[src[x]];
+}
+
+#ifdef SIXEL_HAVE_AVX2
+/* eight pixels at a time: widen the indices and gather from the table */
+__attribute__((target("avx2")))
+static void
+expand_row_avx2(sixel_color_no_t const *src, uint32_t *dst,
+                int n, uint32_t const *table)
+{
+	int x;
+	__m256i idx;
+
+	for (x = 0; x + 8 <= n; x += 8) {
+		idx = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i const *)(src + x)));
+		_mm256_storeu_si256((__m256i *)(dst + x),
+		                    _mm256_i32gather_epi32((int const *)table, idx, 4));
+	}
+
+	for (; x < n; ++x)
+		dst[x] = table[src[x]];
+}
+#endif
+
+static expand_func_t
+select_expand_func(void)
+{
+#ifdef SIXEL_HAVE_AVX2
+	if (simd_enabled && __builtin_cpu_supports("avx2"))
+		return expand_row_avx2;
+#endif
+
+	return expand_row_scalar;
+}
+
+/* the kernel, chosen on first use */
+static expand_func_t
+get_expand_func(void)
+{
+	expand_func_t func = (expand_func_t)g_atomic_pointer_get(&expand_func);
+
+	if (func == NULL) {
+		func = select_expand_func();
+		g_atomic_pointer_set(&expand_func, func);
+	}
+
+	return func;
+}
+
+/* fill n pixels with a colour index, i.e. a memset() for 16-bit values */
+static inline void
+fill_span(sixel_color_no_t *dst, sixel_color_no_t color, int n)
+{
+	uint64_t pattern;
+
+	pattern = color * UINT64_C(0x0001000100010001);
+	for (; n >= 4; n -= 4, dst += 4)
+		memcpy(dst, &pattern, sizeof(pattern));
+	for (; n > 0; n--)
+		*dst++ = color;
+}
+
 static int
 sixel_image_init(
     sixel_image_t    *image,
-    int              width,
-    int              height,
     int              fgcolor,
     int              bgcolor,
     int              use_private_register)
 {
 	int status = (-1);
-	size_t size;
 
-	size = (size_t)(width * height) * sizeof(sixel_color_no_t);
-	image->width = width;
-	image->height = height;
-	image->data = (sixel_color_no_t *)g_malloc(size);
+	/* the bands are only allocated when something is drawn into them */
+	image->nbands = 16;
+	image->bands = (sixel_band_t *)g_malloc0_n((size_t)image->nbands, sizeof(sixel_band_t));
+	image->nchunks = 0;
+	image->nchunked = 0;
+	image->width = 0;
+	image->height = 0;
 	image->ncolors = 2;
 	image->use_private_register = use_private_register;
 
-	if (image->data == NULL) {
+	if (image->bands == NULL) {
 		status = (-1);
 		goto end;
 	}
-	memset(image->data, 0, size);
 
 	image->palette[0] = bgcolor;
 
@@ -183,75 +283,184 @@ end:
 	return status;
 }
 
-
 static int
-image_buffer_resize(
-    sixel_image_t   *image,
-    int              width,
-    int              height)
+image_grow_bands(sixel_image_t *image, int count)
 {
-	int status = (-1);
-	size_t size;
-	sixel_color_no_t *alt_buffer;
+	sixel_band_t *bands;
+	int nbands;
+
+	if (count <= image->nbands)
+		return (0);
+
+	nbands = image->nbands * 2;
+	while (nbands < count)
+		nbands *= 2;
+
+	bands = (sixel_band_t *)g_realloc_n(image->bands, (size_t)nbands, sizeof(sixel_band_t));
+	if (bands == NULL)
+		return (-1);
+	memset(bands + image->nbands, 0, (size_t)(nbands - image->nbands) * sizeof(sixel_band_t));
+
+	image->bands = bands;
+	image->nbands = nbands;
+
+	return (0);
+}
+
+/*
+ * Get row y of the image, growing its band to hold at least width pixels.
+ *
+ * New bands are allocated in chunks of consecutive bands, doubling the
+ * chunk size each time, and are as wide as the image so far. A band only
+ * grows on its own when drawn wider than that, by doubling its width.
+ * This way growing the image is amortised O(1) per pixel, and the bands
+ * already drawn are never copied however large the image gets.
+ */
+static sixel_color_no_t *
+image_grow_row(sixel_image_t *image, int y, int width, int *stride)
+{
+	sixel_band_t *band;
+	sixel_color_no_t *data;
+	int bandwidth;
+	int count;
 	int n;
-	int min_height;
-
-	size = (size_t)(width * height) * sizeof(sixel_color_no_t);
-	alt_buffer = (sixel_color_no_t *)g_malloc(size);
-	if (alt_buffer == NULL) {
-		/* free source image */
-		g_free(image->data);
-		image->data = NULL;
-		status = (-1);
-		goto end;
-	}
 
-	min_height = height > image->height ? image->height: height;
-	if (width > image->width) {  /* if width is extended */
-		for (n = 0; n < min_height; ++n) {
-			/* copy from source image */
-			memcpy(alt_buffer + width * n,
-			       image->data + image->width * n,
-			       (size_t)image->width * sizeof(sixel_color_no_t));
-			/* fill extended area with background color */
-			memset(alt_buffer + width * n + image->width,
-			       0,
-			       (size_t)(width - image->width) * sizeof(sixel_color_no_t));
-		}
-	} else {
-		for (n = 0; n < min_height; ++n) {
-			/* copy from source image */
-			memcpy(alt_buffer + width * n,
-			       image->data + image->width * n,
-			       (size_t)width * sizeof(sixel_color_no_t));
+	if (image_grow_bands(image, y / 6 + 1) < 0)
+		return NULL;
+
+	band = &image->bands[y / 6];
+	if (band->data == NULL && image->nchunks < DECSIXEL_CHUNKS_MAX) {
+		count = image->nchunked > 0 ? image->nchunked : 1;
+		if (count > (DECSIXEL_HEIGHT_MAX + 5) / 6 - y / 6)
+			count = (DECSIXEL_HEIGHT_MAX + 5) / 6 - y / 6;
+		bandwidth = image->width > width ? image->width : width;
+
+		if (image_grow_bands(image, y / 6 + count) < 0)
+			return NULL;
+
+		/* new pixels are background colour */
+		data = (sixel_color_no_t *)g_malloc0_n((size_t)bandwidth * 6 * count, sizeof(sixel_color_no_t));
+		if (data == NULL)
+			return NULL;
+		image->chunks[image->nchunks++] = data;
+		image->nchunked += count;
+
+		for (n = 0; n < count; ++n) {
+			band = &image->bands[y / 6 + n];
+			if (band->data)
+				continue;
+			band->data = data + (size_t)bandwidth * 6 * n;
+			band->width = bandwidth;
+			band->shared = 1;
 		}
+		band = &image->bands[y / 6];
 	}
 
-	if (height > image->height) {  /* if height is extended */
-		/* fill extended area with background color */
-		memset(alt_buffer + width * image->height,
-		       0,
-		       (size_t)(width * (height - image->height)) * sizeof(sixel_color_no_t));
+	if (band->width < width) {
+		bandwidth = band->width * 2;
+		if (bandwidth < width)
+			bandwidth = width;
+		if (bandwidth > DECSIXEL_WIDTH_MAX)
+			bandwidth = DECSIXEL_WIDTH_MAX;
+
+		data = (sixel_color_no_t *)g_malloc0_n((size_t)bandwidth * 6, sizeof(sixel_color_no_t));
+		if (data == NULL)
+			return NULL;
+		for (n = 0; n < 6 && band->data; ++n)
+			memcpy(data + bandwidth * n,
+			       band->data + band->width * n,
+			       (size_t)band->width * sizeof(sixel_color_no_t));
+
+		if (! band->shared)
+			g_free(band->data);
+		band->data = data;
+		band->width = bandwidth;
+		band->shared = 0;
 	}
 
-	/* free source image */
-	g_free(image->data);
+	*stride = band->width;
+	return band->data + band->width * (y % 6);
+}
 
-	image->data = alt_buffer;
-	image->width = width;
-	image->height = height;
+static inline sixel_color_no_t *
+image_get_row(sixel_image_t *image, int y, int width, int *stride)
+{
+	sixel_band_t *band;
 
-	status = (0);
+	if (y / 6 < image->nbands) {
+		band = &image->bands[y / 6];
+		if (band->width >= width) {
+			*stride = band->width;
+			return band->data + band->width * (y % 6);
+		}
+	}
 
-end:
-	return status;
+	return image_grow_row(image, y, width, stride);
 }
 
 static void
 sixel_image_deinit(sixel_image_t *image)
 {
-	g_free(image->data);
-	image->data = NULL;
+	int n;
+
+	for (n = 0; n < image->nbands && image->bands; ++n)
+		if (! image->bands[n].shared)
+			g_free(image->bands[n].data);
+	for (n = 0; n < image->nchunks; ++n)
+		g_free(image->chunks[n]);
+	g_free(image->bands);
+	image->bands = NULL;
+	image->nbands = 0;
+	image->nchunks = 0;
+	image->nchunked = 0;
+}
+
+/* apply the DCS parameters P1 (pixel aspect ratio) and P3 (grid size) */
+static void
+set_dcs_params(sixel_state_t *st)
+{
+	if (st->nparams > 0) {
+		/* Pn1 */
+		switch (st->params[0]) {
+		case 0:
+		case 1:
+			st->attributed_pad = 2;
+			break;
+		case 2:
+			st->attributed_pad = 5;
+			break;
+		case 3:
+		case 4:
+			st->attributed_pad = 4;
+			break;
+		case 5:
+		case 6:
+			st->attributed_pad = 3;
+			break;
+		case 7:
+		case 8:
+			st->attributed_pad = 2;
+			break;
+		case 9:
+			st->attributed_pad = 1;
+			break;
+		default:
+			st->attributed_pad = 2;
+			break;
+		}
+	}
+
+	if (st->nparams > 2) {
+		/* Pn3 */
+		if (st->params[2] == 0)
+			st->params[2] = 10;
+		st->attributed_pan = st->attributed_pan * st->params[2] / 10;
+		st->attributed_pad = st->attributed_pad * st->params[2] / 10;
+		if (st->attributed_pan <= 0)
+			st->attributed_pan = 1;
+		if (st->attributed_pad <= 0)
+			st->attributed_pad = 1;
+	}
 }
 
 int
@@ -276,28 +485,48 @@ sixel_parser_init(sixel_state_t *st,
 	st->param = 0;
 
 	/* buffer initialization */
-	status = sixel_image_init(&st->image, 1, 1, fgcolor, bgcolor, use_private_register);
+	status = sixel_image_init(&st->image, fgcolor, bgcolor, use_private_register);
 
 	return status;
 }
 
+/* start parsing the sixel body of a DCS whose parameters were already parsed */
+int
+sixel_parser_start(sixel_state_t *st, int const *params, int nparams)
+{
+	int i;
+
+	st->nparams = 0;
+	for (i = 0; i < nparams && i < DECSIXEL_PARAMS_MAX; i++)
+		st->params[st->nparams++] = params[i];
+
+	set_dcs_params(st);
+
+	st->nparams = 0;
+	st->param = 0;
+	st->state = PS_DECSIXEL;
+
+	return (0);
+}
+
 int
 sixel_parser_set_default_color(sixel_state_t *st)
 {
 	return set_default_color(&st->image);
 }
 
+/*
+ * get the final image size, to be rendered with sixel_parser_render_rows();
+ * the buffer may be larger than that, but isn't shrunk to avoid a copy
+ */
 int
-sixel_parser_finalize(sixel_state_t *st, unsigned char *pixels)
+sixel_parser_finalize(sixel_state_t *st, int *width, int *height)
 {
 	int status = (-1);
-	int sx;
-	int sy;
 	sixel_image_t *image = &st->image;
-	int x, y;
-	sixel_color_no_t *src;
-	unsigned char *dst;
-	int color;
+
+	if (! image->bands)
+		goto end;
 
 	if (++st->max_x < st->attributed_ph)
 		st->max_x = st->attributed_ph;
@@ -305,32 +534,14 @@ sixel_parser_finalize(sixel_state_t *st, unsigned char *pixels)
 	if (++st->max_y < st->attributed_pv)
 		st->max_y = st->attributed_pv;
 
-	sx = st->max_x;
-	sy = st->max_y;
-
-	if (image->width > sx || image->height > sy) {
-		status = image_buffer_resize(image, sx, sy);
-		if (status < 0)
-			goto end;
-	}
-
 	if (image->use_private_register && image->ncolors > 2 && !image->palette_modified) {
 		status = set_default_color(image);
 		if (status < 0)
 			goto end;
 	}
 
-	src = st->image.data;
-	dst = pixels;
-	for (y = 0; y < st->image.height; ++y) {
-		for (x = 0; x < st->image.width; ++x) {
-			color = st->image.palette[*src++];
-			*dst++ = color >> 16 & 0xff;   /* b */
-			*dst++ = color >> 8 & 0xff;    /* g */
-			*dst++ = color >> 0 & 0xff;    /* r */
-			*dst++ = 0xff;                 /* a */
-		}
-	}
+	*width = st->max_x < image->width ? st->max_x : image->width;
+	*height = st->max_y < image->height ? st->max_y : image->height;
 
 	status = (0);
 
@@ -338,25 +549,166 @@ end:
 	return status;
 }
 
+/* get the size of the part of the image whose sixel bands are complete */
+void
+sixel_parser_get_progress(sixel_state_t const *st, int *width, int *height)
+{
+	int sx;
+	int sy;
+
+	sx = st->max_x + 1;
+	if (sx < st->attributed_ph)
+		sx = st->attributed_ph;
+	if (sx > st->image.width)
+		sx = st->image.width;
+
+	/* every band above the current one was ended by DECGNL */
+	sy = st->pos_y;
+	if (sy > st->image.height)
+		sy = st->image.height;
+
+	*width = sx;
+	*height = sy;
+}
+
+/* convert rows [y0, y1) of the first width columns into ARGB32 pixels */
+int
+sixel_parser_render_rows(sixel_state_t const *st, unsigned char *pixels,
+                         int stride, int width, int y0, int y1)
+{
+	sixel_image_t const *image = &st->image;
+	uint32_t table[DECSIXEL_PALETTE_MAX];
+	expand_func_t expand;
+	sixel_band_t const *band;
+	uint32_t *dst;
+	int x, y;
+
+	if (! image->bands || width > image->width || y0 < 0 || y1 > image->height)
+		return (-1);
+
+	build_argb_table(image, table);
+
+	expand = get_expand_func();
+
+	for (y = y0; y < y1; ++y) {
+		dst = (uint32_t *)(pixels + stride * y);
+		x = 0;
+
+		band = y / 6 < image->nbands ? &image->bands[y / 6] : NULL;
+		if (band && band->data) {
+			x = width < band->width ? width : band->width;
+			expand(band->data + band->width * (y % 6), dst, x, table);
+		}
+
+		/* the rest of the row was never drawn */
+		for (; x < width; ++x)
+			dst[x] = table[0];
+	}
+
+	return (0);
+}
+
+/*
+ * copy rows [y0, y1) of the first width columns as palette indices of
+ * index_size bytes each, which may only be 1 if the palette has no more
+ * than 256 entries
+ */
+int
+sixel_parser_render_indices(sixel_state_t const *st, unsigned char *indices,
+                            int stride, int index_size, int width, int y0, int y1)
+{
+	sixel_image_t const *image = &st->image;
+	sixel_band_t const *band;
+	sixel_color_no_t const *src;
+	unsigned char *dst;
+	int i, x, y;
+
+	if (! image->bands || width > image->width || y0 < 0 || y1 > image->height ||
+	    (index_size != 1 && index_size != 2))
+		return (-1);
+
+	for (y = y0; y < y1; ++y) {
+		dst = indices + stride * y;
+		x = 0;
+
+		band = y / 6 < image->nbands ? &image->bands[y / 6] : NULL;
+		if (band && band->data) {
+			x = width < band->width ? width : band->width;
+			src = band->data + band->width * (y % 6);
+			if (index_size == 2)
+				memcpy(dst, src, x * sizeof(sixel_color_no_t));
+			else
+				for (i = 0; i < x; ++i)
+					dst[i] = (unsigned char)src[i];
+		}
+
+		/* the rest of the row was never drawn */
+		memset(dst + x * index_size, 0, (width - x) * index_size);
+	}
+
+	return (0);
+}
+
+/*
+ * get the ARGB32 palette into table, which has DECSIXEL_PALETTE_MAX
+ * entries; returns the number of entries the image may use
+ */
+int
+sixel_parser_get_palette(sixel_state_t const *st, unsigned int *table)
+{
+	build_argb_table(&st->image, (uint32_t *)table);
+
+	return MIN(st->image.ncolors + 1, DECSIXEL_PALETTE_MAX);
+}
+
+/* convert n palette indices into ARGB32 pixels, like sixel_parser_render_rows() */
+void
+sixel_expand_indices(sixel_color_no_t const *src, unsigned int *dst, int n, unsigned int const *table)
+{
+	get_expand_func()(src, (uint32_t *)dst, n, (uint32_t const *)table);
+}
+
+/* get row y for writing, with room for at least width pixels */
+sixel_color_no_t *
+sixel_parser_get_row(sixel_state_t *st, int y, int width)
+{
+	int stride;
+
+	if (! st->image.bands || y < 0 || y >= DECSIXEL_HEIGHT_MAX ||
+	    width <= 0 || width > DECSIXEL_WIDTH_MAX)
+		return NULL;
+
+	return image_get_row(&st->image, y, width, &stride);
+}
+
+/* select the kernel used by sixel_parser_render_rows(), for tests and benchmarks */
+int
+sixel_parser_set_simd_enabled(int enabled)
+{
+	expand_func_t func;
+
+	simd_enabled = enabled;
+	func = select_expand_func();
+	g_atomic_pointer_set(&expand_func, func);
+
+	return func != expand_row_scalar;
+}
+
 /* convert sixel data into indexed pixel bytes and palette data */
 int
-sixel_parser_parse(sixel_state_t *st, unsigned char *p, size_t len)
+sixel_parser_parse(sixel_state_t *st, unsigned char const *p, size_t len)
 {
 	int status = (-1);
-	int n;
 	int i;
-	int x;
-	int y;
 	int bits;
 	int sixel_vertical_mask;
-	int sx;
-	int sy;
-	int c;
-	int pos;
-	unsigned char *p0 = p;
+	unsigned char const *p0 = p;
 	sixel_image_t *image = &st->image;
+	sixel_color_no_t *row = NULL;  /* the band being drawn into */
+	int row_y = 0;
+	int stride = 0;
 
-	if (! image->data)
+	if (! image->bands)
 		goto end;
 
 	while (p < p0 + len) {
@@ -412,48 +764,7 @@ sixel_parser_parse(sixel_state_t *st, unsigned char *p, size_t len)
 				if (st->param >= 0 && st->nparams < DECSIXEL_PARAMS_MAX) {
 					st->params[st->nparams++] = st->param;
 				}
-				if (st->nparams > 0) {
-					/* Pn1 */
-					switch (st->params[0]) {
-					case 0:
-					case 1:
-						st->attributed_pad = 2;
-						break;
-					case 2:
-						st->attributed_pad = 5;
-						break;
-					case 3:
-					case 4:
-						st->attributed_pad = 4;
-						break;
-					case 5:
-					case 6:
-						st->attributed_pad = 3;
-						break;
-					case 7:
-					case 8:
-						st->attributed_pad = 2;
-						break;
-					case 9:
-						st->attributed_pad = 1;
-						break;
-					default:
-						st->attributed_pad = 2;
-						break;
-					}
-				}
-
-				if (st->nparams > 2) {
-					/* Pn3 */
-					if (st->params[2] == 0)
-						st->params[2] = 10;
-					st->attributed_pan = st->attributed_pan * st->params[2] / 10;
-					st->attributed_pad = st->attributed_pad * st->params[2] / 10;
-					if (st->attributed_pan <= 0)
-						st->attributed_pan = 1;
-					if (st->attributed_pad <= 0)
-						st->attributed_pad = 1;
-				}
+				set_dcs_params(st);
 				st->nparams = 0;
 				st->state = PS_DECSIXEL;
 				p++;
@@ -504,40 +815,35 @@ sixel_parser_parse(sixel_state_t *st, unsigned char *p, size_t len)
 				break;
 			default:
 				if (*p >= '?' && *p <= '~') {  /* sixel characters */
-					if ((image->width < (st->pos_x + st->repeat_count) || image->height < (st->pos_y + 6))
-					        && image->width < DECSIXEL_WIDTH_MAX && image->height < DECSIXEL_HEIGHT_MAX) {
-						sx = image->width * 2;
-						sy = image->height * 2;
-						while (sx < (st->pos_x + st->repeat_count) || sy < (st->pos_y + 6)) {
-							sx *= 2;
-							sy *= 2;
-						}
-
-						if (sx > DECSIXEL_WIDTH_MAX)
-							sx = DECSIXEL_WIDTH_MAX;
-						if (sy > DECSIXEL_HEIGHT_MAX)
-							sy = DECSIXEL_HEIGHT_MAX;
-
-						status = image_buffer_resize(image, sx, sy);
-						if (status < 0)
-							goto end;
-					}
-
 					if (st->color_index > image->ncolors)
 						image->ncolors = st->color_index;
 
-					if (st->pos_x + st->repeat_count > image->width)
-						st->repeat_count = image->width - st->pos_x;
+					if (st->pos_x + st->repeat_count > DECSIXEL_WIDTH_MAX)
+						st->repeat_count = DECSIXEL_WIDTH_MAX - st->pos_x;
+
+					if (st->repeat_count > 0 && st->pos_y < DECSIXEL_HEIGHT_MAX) {
+						if (image->width < st->pos_x + st->repeat_count)
+							image->width = st->pos_x + st->repeat_count;
+						if (image->height < st->pos_y + 6)
+							image->height = MIN(st->pos_y + 6, DECSIXEL_HEIGHT_MAX);
 
-					if (st->repeat_count > 0 && st->pos_y - 5 < image->height) {
 						bits = *p - '?';
+						/* clip the band at the bottom of a maximum size image */
+						if (st->pos_y + 6 > DECSIXEL_HEIGHT_MAX)
+							bits &= (1 << (DECSIXEL_HEIGHT_MAX - st->pos_y)) - 1;
 						if (bits != 0) {
+							if (row == NULL || row_y != st->pos_y || stride < st->pos_x + st->repeat_count) {
+								row = image_get_row(image, st->pos_y, st->pos_x + st->repeat_count, &stride);
+								if (row == NULL)
+									goto end;
+								row_y = st->pos_y;
+							}
+
 							sixel_vertical_mask = 0x01;
 							if (st->repeat_count <= 1) {
 								for (i = 0; i < 6; i++) {
 									if ((bits & sixel_vertical_mask) != 0) {
-										pos = image->width * (st->pos_y + i) + st->pos_x;
-										image->data[pos] = st->color_index;
+										row[stride * i + st->pos_x] = st->color_index;
 										if (st->max_x < st->pos_x)
 											st->max_x = st->pos_x;
 										if (st->max_y < (st->pos_y + i))
@@ -546,28 +852,16 @@ sixel_parser_parse(sixel_state_t *st, unsigned char *p, size_t len)
 									sixel_vertical_mask <<= 1;
 								}
 							} else {
-								/* st->repeat_count > 1 */
+								/* st->repeat_count > 1: one span per set bit */
 								for (i = 0; i < 6; i++) {
-									if ((bits & sixel_vertical_mask) != 0) {
-										c = sixel_vertical_mask << 1;
-										for (n = 1; (i + n) < 6; n++) {
-											if ((bits & c) == 0)
-												break;
-											c <<= 1;
-										}
-										for (y = st->pos_y + i; y < st->pos_y + i + n; ++y) {
-											for (x = st->pos_x; x < st->pos_x + st->repeat_count; ++x)
-												image->data[image->width * y + x] = st->color_index;
-										}
-										if (st->max_x < (st->pos_x + st->repeat_count - 1))
-											st->max_x = st->pos_x + st->repeat_count - 1;
-										if (st->max_y < (st->pos_y + i + n - 1))
-											st->max_y = st->pos_y + i + n - 1;
-										i += (n - 1);
-										sixel_vertical_mask <<= (n - 1);
-									}
+									if ((bits & sixel_vertical_mask) != 0)
+										fill_span(row + stride * i + st->pos_x, st->color_index, st->repeat_count);
 									sixel_vertical_mask <<= 1;
 								}
+								if (st->max_x < (st->pos_x + st->repeat_count - 1))
+									st->max_x = st->pos_x + st->repeat_count - 1;
+								if (st->max_y < (st->pos_y + g_bit_nth_msf(bits, -1)))
+									st->max_y = st->pos_y + g_bit_nth_msf(bits, -1);
 							}
 						}
 					}
@@ -625,25 +919,11 @@ sixel_parser_parse(sixel_state_t *st, unsigned char *p, size_t len)
 				if (st->attributed_pad <= 0)
 					st->attributed_pad = 1;
 
-				if (image->width < st->attributed_ph ||
-				        image->height < st->attributed_pv) {
-					sx = st->attributed_ph;
-					if (image->width > st->attributed_ph)
-						sx = image->width;
-
-					sy = st->attributed_pv;
-					if (image->height > st->attributed_pv)
-						sy = image->height;
-
-					if (sx > DECSIXEL_WIDTH_MAX)
-						sx = DECSIXEL_WIDTH_MAX;
-					if (sy > DECSIXEL_HEIGHT_MAX)
-						sy = DECSIXEL_HEIGHT_MAX;
-
-					status = image_buffer_resize(image, sx, sy);
-					if (status < 0)
-						goto end;
-				}
+				/* the bands are allocated as they are drawn into */
+				if (image->width < st->attributed_ph)
+					image->width = MIN(st->attributed_ph, DECSIXEL_WIDTH_MAX);
+				if (image->height < st->attributed_pv)
+					image->height = MIN(st->attributed_pv, DECSIXEL_HEIGHT_MAX);
 				st->state = PS_DECSIXEL;
 				st->param = 0;
 				st->nparams = 0;
@@ -24,10 +24,21 @@
 #define DECSIXEL_PARAMVALUE_MAX 65535
 #define DECSIXEL_WIDTH_MAX 4096
 #define DECSIXEL_HEIGHT_MAX 4096
+#define DECSIXEL_CHUNKS_MAX 16
 
 typedef unsigned short sixel_color_no_t;
+typedef struct sixel_band {
+	sixel_color_no_t *data;  /* 6 rows of width pixels, NULL if nothing was drawn yet */
+	int width;
+	int shared;              /* data is part of one of the image's chunks */
+} sixel_band_t;
+
 typedef struct sixel_image_buffer {
-	sixel_color_no_t *data;
+	sixel_band_t *bands;     /* the image in 6-row sixel bands, each grown on its own */
+	int nbands;              /* allocated entries in bands */
+	sixel_color_no_t *chunks[DECSIXEL_CHUNKS_MAX];  /* storage of consecutive bands */
+	int nchunks;
+	int nchunked;            /* bands allocated in chunks */
 	int width;
 	int height;
 	int palette[DECSIXEL_PALETTE_MAX];
@@ -65,7 +76,15 @@ typedef struct parser_context {
 } sixel_state_t;
 
 int sixel_parser_init(sixel_state_t *st, int fgcolor, int bgcolor, int use_private_register);
-int sixel_parser_parse(sixel_state_t *st, unsigned char *p, size_t len);
+int sixel_parser_start(sixel_state_t *st, int const *params, int nparams);
+int sixel_parser_parse(sixel_state_t *st, unsigned char const *p, size_t len);
 int sixel_parser_set_default_color(sixel_state_t *st);
-int sixel_parser_finalize(sixel_state_t *st, unsigned char *pixels);
+int sixel_parser_finalize(sixel_state_t *st, int *width, int *height);
+void sixel_parser_get_progress(sixel_state_t const *st, int *width, int *height);
+int sixel_parser_render_rows(sixel_state_t const *st, unsigned char *pixels, int stride, int width, int y0, int y1);
+int sixel_parser_render_indices(sixel_state_t const *st, unsigned char *indices, int stride, int index_size, int width, int y0, int y1);
+int sixel_parser_get_palette(sixel_state_t const *st, unsigned int *table);
+void sixel_expand_indices(sixel_color_no_t const *src, unsigned int *dst, int n, unsigned int const *table);
+int sixel_parser_set_simd_enabled(int enabled);
+sixel_color_no_t *sixel_parser_get_row(sixel_state_t *st, int y, int width);
 void sixel_parser_deinit(sixel_state_t *st);
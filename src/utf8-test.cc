@@ -21,6 +21,7 @@
 
 #include <cstring>
 #include <string>
+#include <string_view>
 
 #include <glib.h>
 
@@ -87,6 +88,25 @@ decode(uint8_t const* in,
         }
 }
 
+/* As decode(), with decode_run() on the pieces of @in split at @split */
+static void
+decode_run(uint8_t const* in,
+           size_t len,
+           size_t split,
+           std::u32string& out)
+{
+        decoder.reset();
+
+        auto buf = std::u32string(len + 2, U'\0');
+        auto n = decoder.decode_run(in, in + std::min(split, len), (uint32_t*)buf.data());
+        if (split < len)
+                n += decoder.decode_run(in + split, in + len, (uint32_t*)buf.data() + n);
+        out.append(buf, 0, n);
+
+        if (decoder.state() != UTF8Decoder::ACCEPT)
+                out.push_back(0xfffdu);
+}
+
 static void
 assert_u32streq(std::u32string const& str1,
                 std::u32string const& str2)
@@ -100,9 +120,17 @@ assert_decode(char const* in,
               ssize_t len,
               std::u32string const& expected)
 {
+        auto const size = len != -1 ? size_t(len) : strlen(in);
         std::u32string converted;
-        decode((uint8_t const*)in, len != -1 ? size_t(len) : strlen(in), converted);
+        decode((uint8_t const*)in, size, converted);
         assert_u32streq(converted, expected);
+
+        /* Whereever a chunk ends */
+        for (auto split = size_t{0}; split <= size; ++split) {
+                std::u32string run;
+                decode_run((uint8_t const*)in, size, split, run);
+                assert_u32streq(run, expected);
+        }
 }
 
 static void
@@ -298,6 +326,135 @@ test_utf8_decoder_replacement(void)
         assert_decode("a\xF4\x8F\xBF\xFFZ", -1, U"a\uFFFD\uFFFDZ"s);
 }
 
+/* Random UTF-8, with the odd malformed or cut off sequence */
+static std::string
+make_text(GRand* rand,
+          size_t len,
+          uint32_t max_cp,
+          int error_rate)
+{
+        auto text = std::string{};
+        while (text.size() < len) {
+                if (error_rate && g_rand_int_range(rand, 0, error_rate) == 0) {
+                        text.push_back(char(g_rand_int_range(rand, 0x80, 0x100)));
+                        continue;
+                }
+
+                auto cp = uint32_t(g_rand_int_range(rand, 0x20, max_cp));
+                if ((cp & 0xfffff800) == 0xd800u)
+                        continue;
+
+                char buf[7];
+                auto const n = g_unichar_to_utf8(cp, buf);
+                text.append(buf, error_rate && g_rand_int_range(rand, 0, error_rate) == 0 ? n - 1 : n);
+        }
+        return text;
+}
+
+static void
+test_utf8_decoder_run(void)
+{
+        auto rand = g_rand_new_with_seed(22);
+
+        for (auto round = 0; round < 2000; ++round) {
+                auto const max_cp = round % 3 == 0 ? 0x80 : round % 3 == 1 ? 0x10000 : 0x110000;
+                auto const text = make_text(rand, g_rand_int_range(rand, 0, 200), max_cp, round % 2 ? 20 : 0);
+                auto const in = (uint8_t const*)text.data();
+
+                std::u32string expected;
+                decode(in, text.size(), expected);
+
+                std::u32string run;
+                decode_run(in, text.size(), g_rand_int_range(rand, 0, text.size() + 1), run);
+                assert_u32streq(run, expected);
+        }
+
+        g_rand_free(rand);
+}
+
+static void
+benchmark_decoder(char const* name,
+                  std::string const& text)
+{
+        auto const in = (uint8_t const*)text.data();
+        auto const end = in + text.size();
+        auto const repeat = 50;
+        auto out = std::u32string(text.size() + 1, U'\0');
+
+        g_test_timer_start();
+        for (auto i = 0; i < repeat; ++i) {
+                auto o = (uint32_t*)out.data();
+                decoder.reset();
+                for (auto p = in; p < end; ++p) {
+                        if (decoder.decode(*p) == UTF8Decoder::ACCEPT)
+                                *o++ = decoder.codepoint();
+                }
+        }
+        auto const decode_time = g_test_timer_elapsed();
+
+        g_test_timer_start();
+        for (auto i = 0; i < repeat; ++i) {
+                decoder.reset();
+                decoder.decode_run(in, end, (uint32_t*)out.data());
+        }
+        auto const run_time = g_test_timer_elapsed();
+
+        g_test_maximized_result(text.size() * repeat / run_time / 1e6,
+                                "%s: decode %.1f MB/s, decode_run %.1f MB/s",
+                                name,
+                                text.size() * repeat / decode_time / 1e6,
+                                text.size() * repeat / run_time / 1e6);
+}
+
+static void
+test_utf8_decoder_perf(void)
+{
+        auto rand = g_rand_new_with_seed(22);
+        auto const size = 1u << 20;
+
+        benchmark_decoder("ASCII", make_text(rand, size, 0x7f, 0));
+        benchmark_decoder("Latin and Greek", make_text(rand, size, 0x400, 0));
+        benchmark_decoder("CJK and other BMP", make_text(rand, size, 0xa000, 0));
+        benchmark_decoder("emoji and CJK", make_text(rand, size, 0x20000, 0));
+        benchmark_decoder("malformed", make_text(rand, size, 0x10000, 10));
+
+        g_rand_free(rand);
+}
+
+static void
+test_utf8_printable_ascii(void)
+{
+        auto rand = g_rand_new_with_seed(21);
+        uint8_t buf[256];
+
+        for (auto round = 0; round < 10000; ++round) {
+                /* Mostly printable, with the odd control, DEL or non-ASCII byte */
+                for (auto& b : buf) {
+                        auto const r = g_rand_int_range(rand, 0, 64);
+                        b = r == 0 ? g_rand_int_range(rand, 0, 0x20) :
+                                r == 1 ? 0x7f :
+                                r == 2 ? g_rand_int_range(rand, 0x80, 0x100) :
+                                g_rand_int_range(rand, 0x20, 0x7f);
+                }
+
+                /* Any start and end, for the unaligned head and the tail */
+                auto const start = g_rand_int_range(rand, 0, 32);
+                auto const end = g_rand_int_range(rand, start, sizeof(buf) + 1);
+                auto expected = buf + start;
+                while (expected < buf + end && *expected >= 0x20 && *expected < 0x7f)
+                        ++expected;
+
+                g_assert_true(find_printable_ascii_end(buf + start, buf + end) == expected);
+        }
+
+        auto const text = "The quick brown fox jumps over the lazy dog. ~"sv;
+        auto const p = (uint8_t const*)text.data();
+        g_assert_true(find_printable_ascii_end(p, p + text.size()) == p + text.size());
+        g_assert_true(find_printable_ascii_end(p, p) == p);
+
+        g_rand_free(rand);
+}
+
 int
 main(int argc,
      char* argv[])
@@ -306,6 +463,10 @@ main(int argc,
 
         g_test_add_func("/vte/utf8/decoder/decode", test_utf8_decoder_decode);
         g_test_add_func("/vte/utf8/decoder/replacement", test_utf8_decoder_replacement);
+        g_test_add_func("/vte/utf8/decoder/run", test_utf8_decoder_run);
+        g_test_add_func("/vte/utf8/printable-ascii", test_utf8_printable_ascii);
+        if (g_test_perf())
+                g_test_add_func("/vte/utf8/decoder/perf", test_utf8_decoder_perf);
 
         return g_test_run();
 }
@@ -25,6 +25,10 @@
 
 #include "utf8.hh"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define RJ vte::base::UTF8Decoder::REJECT
 #define RW vte::base::UTF8Decoder::REJECT_REWIND
 
@@ -111,3 +115,138 @@ uint8_t const vte::base::UTF8Decoder::kTable[] = {
         RW, 36, RW, RW, RW, RW, RW, RW, RW, RW, RW, RW, // state 96
         RJ, RJ, RJ, RJ, RJ, RJ, RJ, RJ, RJ, RJ, RJ, RJ, // state 108 (reject-rewind)
 };
+
+uint8_t const*
+vte::base::find_printable_ascii_end(uint8_t const* p,
+                                    uint8_t const* end) noexcept
+{
+#if defined(__SSE2__)
+        /* 16 bytes at a time. As signed bytes, 0x80 and up are negative,
+         * so two comparisons tell printable ASCII from everything else. */
+        auto const low = _mm_set1_epi8(0x1f);
+        auto const high = _mm_set1_epi8(0x7f);
+        while (end - p >= 16) {
+                auto const v = _mm_loadu_si128((__m128i const*)p);
+                auto const printable = _mm_and_si128(_mm_cmpgt_epi8(v, low),
+                                                     _mm_cmplt_epi8(v, high));
+                auto const mask = unsigned(_mm_movemask_epi8(printable)) ^ 0xffffu;
+                if (mask != 0)
+                        return p + __builtin_ctz(mask);
+                p += 16;
+        }
+#endif
+
+        while (p < end && *p >= 0x20 && *p < 0x7f)
+                ++p;
+        return p;
+}
+
+/* Feeds the byte at @p to the DFA, and writes out the codepoint or the
+ * replacement character it yields, if any. Returns the next byte to decode,
+ * which is @p again when the byte has to start over. */
+inline uint8_t const*
+vte::base::UTF8Decoder::decode_one(uint8_t const* p,
+                                   uint32_t*& out) noexcept
+{
+        switch (decode(*p)) {
+        case REJECT_REWIND:
+                reset();
+                *out++ = m_codepoint;
+                return p;
+        case REJECT:
+                reset();
+                [[fallthrough]];
+        case ACCEPT:
+                *out++ = m_codepoint;
+                [[fallthrough]];
+        default:
+                return p + 1;
+        }
+}
+
+static inline constexpr bool
+is_continuation(uint8_t b) noexcept
+{
+        return (b & 0xc0) == 0x80;
+}
+
+size_t
+vte::base::UTF8Decoder::decode_run(uint8_t const* begin,
+                                   uint8_t const* end,
+                                   uint32_t* out) noexcept
+{
+        auto const start = out;
+        auto p = begin;
+
+        while (p < end) {
+                /* The rest of a sequence begun before */
+                if (m_state != ACCEPT) {
+                        p = decode_one(p, out);
+                        continue;
+                }
+
+                auto const b0 = p[0];
+                if (b0 < 0x80) {
+#if defined(__SSE2__)
+                        /* 16 bytes at a time while they're all ASCII,
+                         * zero-extended to codepoints */
+                        auto const zero = _mm_setzero_si128();
+                        while (end - p >= 16) {
+                                auto const v = _mm_loadu_si128((__m128i const*)p);
+                                if (_mm_movemask_epi8(v) != 0)
+                                        break;
+
+                                auto const lo = _mm_unpacklo_epi8(v, zero);
+                                auto const hi = _mm_unpackhi_epi8(v, zero);
+                                _mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi16(lo, zero));
+                                _mm_storeu_si128((__m128i*)(out + 4), _mm_unpackhi_epi16(lo, zero));
+                                _mm_storeu_si128((__m128i*)(out + 8), _mm_unpacklo_epi16(hi, zero));
+                                _mm_storeu_si128((__m128i*)(out + 12), _mm_unpackhi_epi16(hi, zero));
+                                out += 16;
+                                p += 16;
+                        }
+#endif
+                        while (p < end && *p < 0x80)
+                                *out++ = *p++;
+                        continue;
+                }
+
+                /* Well-formed sequences, as in table 3-7 of the Unicode
+                 * standard; anything else is left to the DFA. */
+                auto const avail = end - p;
+                if (b0 >= 0xc2 && b0 <= 0xdf) {
+                        if (avail >= 2 && is_continuation(p[1])) {
+                                *out++ = (uint32_t(b0 & 0x1f) << 6) | (p[1] & 0x3f);
+                                p += 2;
+                                continue;
+                        }
+                } else if (b0 >= 0xe0 && b0 <= 0xef) {
+                        uint8_t const lo = b0 == 0xe0 ? 0xa0 : 0x80;
+                        uint8_t const hi = b0 == 0xed ? 0x9f : 0xbf;
+                        if (avail >= 3 && p[1] >= lo && p[1] <= hi && is_continuation(p[2])) {
+                                *out++ = (uint32_t(b0 & 0x0f) << 12) |
+                                        (uint32_t(p[1] & 0x3f) << 6) |
+                                        (p[2] & 0x3f);
+                                p += 3;
+                                continue;
+                        }
+                } else if (b0 >= 0xf0 && b0 <= 0xf4) {
+                        uint8_t const lo = b0 == 0xf0 ? 0x90 : 0x80;
+                        uint8_t const hi = b0 == 0xf4 ? 0x8f : 0xbf;
+                        if (avail >= 4 && p[1] >= lo && p[1] <= hi &&
+                            is_continuation(p[2]) && is_continuation(p[3])) {
+                                *out++ = (uint32_t(b0 & 0x07) << 18) |
+                                        (uint32_t(p[1] & 0x3f) << 12) |
+                                        (uint32_t(p[2] & 0x3f) << 6) |
+                                        (p[3] & 0x3f);
+                                p += 4;
+                                continue;
+                        }
+                }
+
+                /* Malformed, or cut off by @end */
+                p = decode_one(p, out);
+        }
+
+        return out - start;
+}
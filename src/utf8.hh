@@ -25,6 +25,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 namespace vte {
@@ -51,6 +52,7 @@ public:
         UTF8Decoder& operator= (UTF8Decoder&&) = delete;
 
         inline constexpr uint32_t codepoint() const noexcept { return m_codepoint; }
+        inline constexpr uint32_t state() const noexcept { return m_state; }
 
         inline uint32_t decode(uint32_t byte) noexcept {
                 uint32_t type = kTable[byte];
@@ -67,14 +69,33 @@ public:
                 m_codepoint = 0xfffdU;
         }
 
+        /* Decodes the bytes in [@begin, @end) into @out, which has room for
+         * @end - @begin + 1 codepoints, and returns how many it wrote. Errors
+         * are replaced with U+FFFD the way a loop over decode() does it, and
+         * a sequence cut off by @end is continued by the next call.
+         * Well-formed sequences don't go through the DFA; codepoint() is
+         * not updated for them.
+         */
+        size_t decode_run(uint8_t const* begin,
+                          uint8_t const* end,
+                          uint32_t* out) noexcept;
+
 private:
         uint32_t m_state{ACCEPT};
         uint32_t m_codepoint{0};
 
+        inline uint8_t const* decode_one(uint8_t const* p,
+                                         uint32_t*& out) noexcept;
+
         static uint8_t const kTable[];
 
 }; // class UTF8Decoder
 
+/* Returns the end of the run of printable ASCII, 0x20 to 0x7e, that
+ * starts at @p; @end at the latest. */
+uint8_t const* find_printable_ascii_end(uint8_t const* p,
+                                        uint8_t const* end) noexcept;
+
 } // namespace base
 
 } // namespace vte
@@ -66,6 +66,7 @@
 #include "vtepty-private.h"
 #include "vtegtk.hh"
 
+#include <algorithm>
 #include <new> /* placement new */
 
 #ifndef HAVE_ROUND
@@ -94,6 +95,7 @@ static void remove_update_timeout(vte::terminal::Terminal* that);
 static gboolean process_timeout (gpointer data);
 static gboolean update_timeout (gpointer data);
 static cairo_region_t *vte_cairo_get_clip_region (cairo_t *cr);
+static gboolean vte_cairo_clip_damage (cairo_t *cr, cairo_region_t const *region, cairo_rectangle_int_t const *rect);
 
 /* these static variables are guarded by the GDK mutex */
 static guint process_timeout_tag = 0;
@@ -102,6 +104,12 @@ static guint update_timeout_tag = 0;
 static gboolean in_update_timeout;
 static GList *g_active_terminals;
 
+/* the image memory budget is shared by all terminals in the process */
+static GList *g_image_terminals;
+static gsize g_image_memory_limit = VTE_DEFAULT_IMAGE_MEMORY_LIMIT;
+static gsize g_image_frozen_limit = VTE_DEFAULT_IMAGE_FROZEN_LIMIT;
+static guint g_image_budget_tag = 0;
+
 static int
 _vte_unichar_width(gunichar c, int utf8_ambiguous_width)
 {
@@ -3183,6 +3191,84 @@ not_inserted:
         m_line_wrapped = line_wrapped;
 }
 
+/* Insert a run of characters that are all @columns wide, as GRAPHIC does a
+ * character at a time, up to the right margin: the row grows, and the
+ * fragments under the run are cleaned up, once for the whole run. Returns
+ * the number of characters inserted. */
+template<typename T>
+size_t
+Terminal::insert_text_run(T const* text,
+                          size_t len,
+                          int columns)
+{
+	VteCellAttr attr;
+	VteRowData *row;
+	long col;
+	size_t i, n;
+
+	/* Wrapping, insert mode and charset translation are rare; let
+	 * insert_char() do those. */
+        col = m_screen->cursor.col;
+	if (G_UNLIKELY (col + columns > m_column_count ||
+	                m_modes_ecma.IRM() ||
+	                *m_character_replacement != VTE_CHARACTER_REPLACEMENT_NONE)) {
+		insert_char(text[0], false, false);
+		return 1;
+	}
+
+	n = MIN (len, (size_t)((m_column_count - col) / columns));
+
+	_vte_debug_print(VTE_DEBUG_PARSER,
+			"Inserting %" G_GSIZE_FORMAT " characters of %d columns (colors %" G_GUINT64_FORMAT ") (%ld, %ld), delta = %ld\n",
+                         n, columns, m_color_defaults.attr.colors(),
+                         col, (long)m_screen->cursor.row,
+			(long)m_screen->insert_delta);
+
+	/* Make sure we have enough rows to hold this data. */
+	row = ensure_cursor();
+	g_assert(row != NULL);
+
+        cleanup_fragments(col, col + n * columns);
+	_vte_row_data_fill (row, &basic_cell, col + n * columns);
+
+        attr = m_defaults.attr;
+	attr.set_columns(columns);
+	if (columns == 1) {
+		for (i = 0; i < n; i++) {
+			VteCell *pcell = _vte_row_data_get_writable (row, col++);
+			pcell->c = text[i];
+			pcell->attr = attr;
+		}
+	} else {
+		VteCellAttr fragment_attr = attr;
+		fragment_attr.set_fragment(true);
+		for (i = 0; i < n; i++) {
+			VteCell *pcell = _vte_row_data_get_writable (row, col++);
+			pcell->c = text[i];
+			pcell->attr = attr;
+
+			/* insert wide-char fragments */
+			for (int j = 1; j < columns; j++) {
+				pcell = _vte_row_data_get_writable (row, col++);
+				pcell->c = text[i];
+				pcell->attr = fragment_attr;
+			}
+		}
+	}
+	if (_vte_row_data_length (row) > m_column_count)
+		cleanup_fragments(m_column_count, _vte_row_data_length (row));
+	_vte_row_data_shrink (row, m_column_count);
+
+        m_screen->cursor.col = col;
+        m_last_graphic_character = text[n - 1];
+
+	/* We added text, so make a note of it. */
+	m_text_inserted_flag = TRUE;
+
+        m_line_wrapped = false;
+        return n;
+}
+
 guint8
 Terminal::get_bidi_flags() const noexcept
 {
@@ -3770,6 +3856,242 @@ Terminal::convert_incoming() noexcept
 
 #endif /* WITH_ICONV */
 
+/*
+ * Terminal::process_incoming_decsixel:
+ * @ip: the start of the input
+ * @iend: the end of the input
+ *
+ * Feeds the DECSIXEL data string from [@ip, @iend) directly into
+ * the sixel decoder, without going through the UTF-8 decoder and
+ * the parser and without collecting it into the sequence string.
+ * Stops at the first byte that ends the data string (ESC, CAN, SUB,
+ * or a C1 control, e.g. ST), and hands that back to the parser, which
+ * is still in the DCS passthrough state and so will dispatch (or cancel)
+ * the DECSIXEL as usual. Other non-ASCII characters can't be part of
+ * the sixel data, and are skipped like the parser would ignore them.
+ * If the data string ends in anything but an ST, the image is dropped.
+ *
+ * Returns: the position of the first byte not consumed
+ */
+uint8_t const*
+Terminal::process_incoming_decsixel(uint8_t const* ip,
+                                    uint8_t const* iend)
+{
+        /* The previous chunk ended in an ESC, or in a UTF-8 lead byte that
+         * may start a C1 control; this one tells whether that's an ST */
+        if (G_UNLIKELY(m_sixel_lead_byte != 0) && ip < iend) {
+                auto const lead = m_sixel_lead_byte;
+                m_sixel_lead_byte = 0;
+                if (lead == 0x1b /* ESC */) {
+                        if (*ip != 0x5c /* '\\' */)
+                                cancel_decsixel();
+                        return ip;
+                }
+                if (*ip >= 0x80 && *ip < 0xa0) {
+                        m_utf8_decoder.decode(lead);
+                        m_sixel_streaming = false;
+                        if (*ip != 0x9c /* ST */)
+                                cancel_decsixel();
+                        return ip;
+                }
+        }
+
+        if (!m_sixel_streaming)
+                return ip;
+
+        auto p = ip;
+        auto parsed = false;
+        while (p < iend) {
+                auto q = p;
+                while (q < iend && *q < 0x80 &&
+                       *q != 0x1b /* ESC */ && *q != 0x18 /* CAN */ && *q != 0x1a /* SUB */)
+                        ++q;
+
+                if (q != p) {
+                        sixel_parser_parse(&m_sixel_state, p, q - p);
+                        parsed = true;
+                        p = q;
+                }
+
+                if (p == iend || *p < 0x80)
+                        break;
+
+                /* U+0080..U+009F, the C1 controls, are 0xc2 0x80..0x9f */
+                if (*p == 0xc2) {
+                        if (p + 1 == iend) {
+                                m_sixel_lead_byte = *p++;
+                                break;
+                        }
+                        if (p[1] >= 0x80 && p[1] < 0xa0)
+                                break;
+                }
+
+                ++p;
+        }
+
+        if (parsed)
+                update_sixel_preview();
+
+        if (p == iend)
+                return p;
+
+        m_sixel_streaming = false;
+
+        /* Unless it's an ST, the DECSIXEL won't be dispatched again */
+        if (*p == 0x1b /* ESC */) {
+                if (p + 1 == iend)
+                        m_sixel_lead_byte = *p;
+                else if (p[1] != 0x5c /* '\\' */)
+                        cancel_decsixel();
+        } else if (*p == 0xc2) {
+                if (p[1] != 0x9c /* ST */)
+                        cancel_decsixel();
+        } else {
+                /* CAN or SUB */
+                cancel_decsixel();
+        }
+
+        return p;
+}
+
+/*
+ * Terminal::cancel_decsixel:
+ *
+ * Drops the DECSIXEL image being streamed, and its preview, when the
+ * data string ends in anything but a string terminator.
+ */
+void
+Terminal::cancel_decsixel()
+{
+        m_sixel_streaming = false;
+        m_sixel_lead_byte = 0;
+        sixel_parser_deinit(&m_sixel_state);
+        clear_sixel_preview();
+}
+
+/*
+ * Terminal::update_sixel_preview:
+ *
+ * Shows the part of the DECSIXEL image being streamed whose sixel
+ * bands are complete, so that a large or slowly arriving image is
+ * painted band by band instead of all at once when its ST arrives.
+ * Only the newly completed bands are converted and invalidated.
+ */
+void
+Terminal::update_sixel_preview()
+{
+        int pixelwidth, pixelheight;
+        sixel_parser_get_progress(&m_sixel_state, &pixelwidth, &pixelheight);
+        if (pixelwidth <= 0 || pixelheight <= m_sixel_preview_rows)
+                return;
+
+        auto first_row = m_sixel_preview_rows;
+        auto surface = m_sixel_preview_surface;
+
+        /* (Re)allocate the surface if the image got wider or outgrew it,
+         * reserving room for more bands to keep the reallocations rare.
+         */
+        if (surface == nullptr ||
+            pixelwidth != cairo_image_surface_get_width(surface) ||
+            pixelheight > cairo_image_surface_get_height(surface)) {
+                auto const capacity = std::min(pixelheight * 2, m_sixel_state.image.height);
+                surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, pixelwidth, capacity);
+                if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+                        cairo_surface_destroy(surface);
+                        return;
+                }
+                first_row = 0;
+        }
+
+        cairo_surface_flush(surface);
+        if (sixel_parser_render_rows(&m_sixel_state,
+                                     cairo_image_surface_get_data(surface),
+                                     cairo_image_surface_get_stride(surface),
+                                     pixelwidth, first_row, pixelheight) < 0) {
+                if (surface != m_sixel_preview_surface)
+                        cairo_surface_destroy(surface);
+                return;
+        }
+        cairo_surface_mark_dirty_rectangle(surface, 0, first_row, pixelwidth, pixelheight - first_row);
+
+        auto const width = (pixelwidth + m_cell_width - 1) / m_cell_width;
+        auto const height = (pixelheight + m_cell_height - 1) / m_cell_height;
+
+        /* The ring it's charged to, even if the screen changes meanwhile */
+        if (m_sixel_preview == nullptr)
+                m_sixel_preview_ring = m_screen->row_data;
+        auto ring = m_sixel_preview_ring;
+
+        if (m_sixel_preview == nullptr) {
+                m_sixel_preview = new vte::image::image_object(cairo_surface_reference(surface),
+                                                               pixelwidth, pixelheight,
+                                                               m_screen->cursor.col,
+                                                               m_screen->cursor.row,
+                                                               width, height,
+                                                               m_cell_width, m_cell_height,
+                                                               ring->image_store);
+        } else {
+                ring->image_onscreen_resource_counter -= sixel_preview_resource_size();
+                m_sixel_preview->update(surface == m_sixel_preview_surface ? surface
+                                        : cairo_surface_reference(surface),
+                                        pixelwidth, pixelheight, width, height);
+        }
+
+        if (surface != m_sixel_preview_surface) {
+                if (m_sixel_preview_surface != nullptr)
+                        cairo_surface_destroy(m_sixel_preview_surface);
+                m_sixel_preview_surface = surface;
+        }
+        ring->image_onscreen_resource_counter += sixel_preview_resource_size();
+
+        auto const top = m_sixel_preview->get_top();
+        invalidate_rows(top + first_row / m_cell_height,
+                        top + (pixelheight - 1) / m_cell_height);
+
+        m_sixel_preview_rows = pixelheight;
+}
+
+/*
+ * Terminal::sixel_preview_resource_size:
+ *
+ * Returns: the memory the preview takes, which is its whole surface,
+ *   including the rows reserved for the bands still to come, not only
+ *   the pixels it shows so far
+ */
+size_t
+Terminal::sixel_preview_resource_size() const
+{
+        auto const surface = m_sixel_preview_surface;
+        auto const reserved = size_t(cairo_image_surface_get_stride(surface)) *
+                cairo_image_surface_get_height(surface) -
+                size_t(m_sixel_preview->get_pixelwidth()) * m_sixel_preview->get_pixelheight() * 4;
+
+        return m_sixel_preview->resource_size() + reserved;
+}
+
+/*
+ * Terminal::clear_sixel_preview:
+ *
+ * Removes the partially decoded DECSIXEL image, once the final image
+ * has been decoded or the DECSIXEL was cancelled.
+ */
+void
+Terminal::clear_sixel_preview()
+{
+        if (m_sixel_preview == nullptr)
+                return;
+
+        m_sixel_preview_ring->image_onscreen_resource_counter -= sixel_preview_resource_size();
+        invalidate_rows(m_sixel_preview->get_top(), m_sixel_preview->get_bottom());
+
+        delete m_sixel_preview;
+        m_sixel_preview = nullptr;
+        m_sixel_preview_ring = nullptr;
+        cairo_surface_destroy(m_sixel_preview_surface);
+        m_sixel_preview_surface = nullptr;
+        m_sixel_preview_rows = 0;
+}
+
 void
 Terminal::process_incoming()
 {
@@ -3821,8 +4143,140 @@ Terminal::process_incoming()
 
         m_line_wrapped = false;
 
+        /* Account for text inserted at the cursor, by GRAPHIC or a run of ASCII */
+        auto const graphic_inserted = [&]() {
+                if (m_line_wrapped) {
+                        m_line_wrapped = false;
+                        /* line wrapped, correct bbox */
+                        if (invalidated_text &&
+                            (m_screen->cursor.row > bbox_bottom + VTE_CELL_BBOX_SLACK ||
+                             m_screen->cursor.row < bbox_top - VTE_CELL_BBOX_SLACK)) {
+                                invalidate_rows_and_context(bbox_top, bbox_bottom);
+                                bbox_bottom = -G_MAXINT;
+                                bbox_top = G_MAXINT;
+                        }
+                        bbox_top = std::min(bbox_top,
+                                            m_screen->cursor.row);
+                }
+                /* Add the cells over which we have moved to the region
+                 * which we need to refresh for the user. */
+                bbox_bottom = std::max(bbox_bottom,
+                                       m_screen->cursor.row);
+                invalidated_text = TRUE;
+
+                /* We *don't* emit flush pending signals here. */
+                modified = TRUE;
+        };
+
+        /* Act on what the parser made of the codepoint @c */
+        auto const process_result = [&](int rv,
+                                         uint32_t c,
+                                         uint8_t const*& ip,
+                                         uint8_t const* iend) {
+                if (G_UNLIKELY(rv < 0)) {
+                        char c_buf[7];
+                        g_snprintf(c_buf, sizeof(c_buf), "%lc", c);
+                        char const* wp_str = g_unichar_isprint(c) ? c_buf : _vte_debug_sequence_to_string(c_buf, -1);
+                        _vte_debug_print(VTE_DEBUG_PARSER, "Parser error on U+%04X [%s]!\n",
+                                         c, wp_str);
+                        return;
+                }
+
+#ifdef VTE_DEBUG
+                if (rv != VTE_SEQ_NONE)
+                        g_assert((bool)seq);
+#endif
+
+                _VTE_DEBUG_IF(VTE_DEBUG_PARSER) {
+                        if (rv != VTE_SEQ_NONE) {
+                                seq.print();
+                        }
+                }
+
+                // FIXMEchpe this assumes that the only handler inserting
+                // a character is GRAPHIC, which isn't true (at least ICH, REP, SUB
+                // also do, and invalidate directly for now)...
+
+                switch (rv) {
+                case VTE_SEQ_GRAPHIC: {
+
+                        bbox_top = std::min(bbox_top,
+                                            m_screen->cursor.row);
+
+                        // does insert_char(c, false, false)
+                        GRAPHIC(seq);
+                        _vte_debug_print(VTE_DEBUG_PARSER,
+                                         "Last graphic is now U+%04X %lc\n",
+                                         m_last_graphic_character,
+                                         g_unichar_isprint(m_last_graphic_character) ? m_last_graphic_character : 0xfffd);
+
+                        graphic_inserted();
+                        break;
+                }
+
+                case VTE_SEQ_NONE:
+                case VTE_SEQ_IGNORE:
+                        break;
+
+                default: {
+                        switch (seq.command()) {
+#define _VTE_CMD(cmd)   case VTE_CMD_##cmd: cmd(seq); break;
+#define _VTE_NOP(cmd)
+#include "parser-cmd.hh"
+#undef _VTE_CMD
+#undef _VTE_NOP
+                        default:
+                                _vte_debug_print(VTE_DEBUG_PARSER,
+                                                 "Unknown parser command %d\n", seq.command());
+                                break;
+                        }
+
+                        m_last_graphic_character = 0;
+
+                        modified = TRUE;
+
+                        /* An unripe DECSIXEL: consume its data string directly */
+                        if (G_UNLIKELY(m_sixel_streaming))
+                                ip = process_incoming_decsixel(ip + 1, iend) - 1;
+
+                        // FIXME m_screen may be != previous_screen, check for that!
+
+                        gboolean new_in_scroll_region = m_scrolling_restricted
+                                && (m_screen->cursor.row >= (m_screen->insert_delta + m_scrolling_region.start))
+                                && (m_screen->cursor.row <= (m_screen->insert_delta + m_scrolling_region.end));
+
+                        /* if we have moved greatly during the sequence handler, or moved
+                         * into a scroll_region from outside it, restart the bbox.
+                         */
+                        if (invalidated_text &&
+                            ((new_in_scroll_region && !in_scroll_region) ||
+                             (m_screen->cursor.row > bbox_bottom + VTE_CELL_BBOX_SLACK ||
+                              m_screen->cursor.row < bbox_top - VTE_CELL_BBOX_SLACK))) {
+                                invalidate_rows_and_context(bbox_top, bbox_bottom);
+                                invalidated_text = FALSE;
+                                bbox_bottom = -G_MAXINT;
+                                bbox_top = G_MAXINT;
+                        }
+
+                        in_scroll_region = new_in_scroll_region;
+
+                        break;
+                }
+                }
+        };
+
+        /* Feed a codepoint to the parser, and act on what it makes of it */
+        auto const process_codepoint = [&](uint32_t c,
+                                           uint8_t const*& ip,
+                                           uint8_t const* iend) {
+                process_result(m_parser.feed(c), c, ip, iend);
+        };
+
         size_t bytes_processed = 0;
 
+        constexpr size_t k_decode_run_size = 256;
+        uint32_t codepoints[k_decode_run_size + 1];
+
         while (!m_incoming_queue.empty()) {
                 auto chunk = std::move(m_incoming_queue.front());
                 m_incoming_queue.pop();
@@ -3838,8 +4292,83 @@ Terminal::process_incoming()
                 auto const* ip = chunk->data;
                 auto const* iend = chunk->data + chunk->len;
 
+                /* Continue a DECSIXEL data string from the previous chunk,
+                 * or see whether an ESC it ended with starts an ST */
+                if (G_UNLIKELY(m_sixel_streaming || m_sixel_lead_byte != 0))
+                        ip = process_incoming_decsixel(ip, iend);
+
                 for ( ; ip < iend; ++ip) {
 
+                        /* Runs of printable ASCII between sequences skip the
+                         * decoder and the parser, and go in a line at a time */
+                        if (*ip >= 0x20 && *ip < 0x7f &&
+                            m_utf8_decoder.state() == vte::base::UTF8Decoder::ACCEPT &&
+                            m_parser.is_ground()) {
+                                auto const run_end = vte::base::find_printable_ascii_end(ip, iend);
+                                while (ip < run_end) {
+                                        bbox_top = std::min(bbox_top,
+                                                            m_screen->cursor.row);
+                                        ip += insert_text_run(ip, run_end - ip, 1);
+                                        graphic_inserted();
+                                }
+                                /* Undo the loop's increment */
+                                --ip;
+                                continue;
+                        }
+
+                        /* Other ASCII, e.g. controls and the insides of sequences,
+                         * goes to the parser a run at a time, up to the first
+                         * byte that completes something */
+                        if (*ip < 0x80 &&
+                            m_utf8_decoder.state() == vte::base::UTF8Decoder::ACCEPT) {
+                                int rv;
+                                ip += m_parser.feed_run(ip, iend, rv) - 1;
+                                if (rv != VTE_SEQ_NONE)
+                                        process_result(rv, *ip, ip, iend);
+                                continue;
+                        }
+
+                        /* Runs of non-ASCII bytes, e.g. CJK text or emoji, are
+                         * decoded in bulk. No DECSIXEL data string starts in
+                         * them, so nothing needs their byte positions. */
+                        if (*ip >= 0x80) {
+                                auto run_end = ip;
+                                while (run_end < iend && *run_end >= 0x80)
+                                        ++run_end;
+                                while (ip < run_end) {
+                                        auto const piece_end = ip + std::min(run_end - ip, ptrdiff_t(k_decode_run_size));
+                                        auto const n = m_utf8_decoder.decode_run(ip, piece_end, codepoints);
+                                        ip = piece_end;
+                                        for (size_t i = 0; i < n; ) {
+                                                auto const c = codepoints[i];
+
+                                                /* Between sequences, everything from U+00A0 up is
+                                                 * GRAPHIC; characters of the same width go in together */
+                                                auto const columns = c >= 0xa0 && m_parser.is_ground() ?
+                                                        _vte_unichar_width(c, m_utf8_ambiguous_width) : 0;
+                                                if (columns == 0) {
+                                                        process_codepoint(c, ip, iend);
+                                                        ++i;
+                                                        continue;
+                                                }
+
+                                                auto j = i + 1;
+                                                while (j < n && codepoints[j] >= 0xa0 &&
+                                                       _vte_unichar_width(codepoints[j], m_utf8_ambiguous_width) == columns)
+                                                        ++j;
+                                                while (i < j) {
+                                                        bbox_top = std::min(bbox_top,
+                                                                            m_screen->cursor.row);
+                                                        i += insert_text_run(codepoints + i, j - i, columns);
+                                                        graphic_inserted();
+                                                }
+                                        }
+                                }
+                                /* Undo the loop's increment */
+                                --ip;
+                                continue;
+                        }
+
                         switch (m_utf8_decoder.decode(*ip)) {
                         case vte::base::UTF8Decoder::REJECT_REWIND:
                                 /* Rewind the stream.
@@ -3852,119 +4381,10 @@ Terminal::process_incoming()
                                 m_utf8_decoder.reset();
                                 /* Fall through to insert the U+FFFD replacement character. */
                                 [[fallthrough]];
-                        case vte::base::UTF8Decoder::ACCEPT: {
-                                auto rv = m_parser.feed(m_utf8_decoder.codepoint());
-                                if (G_UNLIKELY(rv < 0)) {
-                                        uint32_t c = m_utf8_decoder.codepoint();
-                                        char c_buf[7];
-                                        g_snprintf(c_buf, sizeof(c_buf), "%lc", c);
-                                        char const* wp_str = g_unichar_isprint(c) ? c_buf : _vte_debug_sequence_to_string(c_buf, -1);
-                                        _vte_debug_print(VTE_DEBUG_PARSER, "Parser error on U+%04X [%s]!\n",
-                                                         c, wp_str);
-                                        break;
-                                }
-
-#ifdef VTE_DEBUG
-                                if (rv != VTE_SEQ_NONE)
-                                        g_assert((bool)seq);
-#endif
-
-                                _VTE_DEBUG_IF(VTE_DEBUG_PARSER) {
-                                        if (rv != VTE_SEQ_NONE) {
-                                                seq.print();
-                                        }
-                                }
-
-                                // FIXMEchpe this assumes that the only handler inserting
-                                // a character is GRAPHIC, which isn't true (at least ICH, REP, SUB
-                                // also do, and invalidate directly for now)...
-
-                                switch (rv) {
-                                case VTE_SEQ_GRAPHIC: {
-
-                                        bbox_top = std::min(bbox_top,
-                                                            m_screen->cursor.row);
-
-                                        // does insert_char(c, false, false)
-                                        GRAPHIC(seq);
-                                        _vte_debug_print(VTE_DEBUG_PARSER,
-                                                         "Last graphic is now U+%04X %lc\n",
-                                                         m_last_graphic_character,
-                                                         g_unichar_isprint(m_last_graphic_character) ? m_last_graphic_character : 0xfffd);
-
-                                        if (m_line_wrapped) {
-                                                m_line_wrapped = false;
-                                                /* line wrapped, correct bbox */
-                                                if (invalidated_text &&
-                                                    (m_screen->cursor.row > bbox_bottom + VTE_CELL_BBOX_SLACK ||
-                                                     m_screen->cursor.row < bbox_top - VTE_CELL_BBOX_SLACK)) {
-                                                        invalidate_rows_and_context(bbox_top, bbox_bottom);
-                                                        bbox_bottom = -G_MAXINT;
-                                                        bbox_top = G_MAXINT;
-                                                }
-                                                bbox_top = std::min(bbox_top,
-                                                                    m_screen->cursor.row);
-                                        }
-                                        /* Add the cells over which we have moved to the region
-                                         * which we need to refresh for the user. */
-                                        bbox_bottom = std::max(bbox_bottom,
-                                                               m_screen->cursor.row);
-                                        invalidated_text = TRUE;
-
-                                        /* We *don't* emit flush pending signals here. */
-                                        modified = TRUE;
-
-                                        break;
-                                }
-
-                                case VTE_SEQ_NONE:
-                                case VTE_SEQ_IGNORE:
-                                        break;
-
-                                default: {
-                                        switch (seq.command()) {
-#define _VTE_CMD(cmd)   case VTE_CMD_##cmd: cmd(seq); break;
-#define _VTE_NOP(cmd)
-#include "parser-cmd.hh"
-#undef _VTE_CMD
-#undef _VTE_NOP
-                                        default:
-                                                _vte_debug_print(VTE_DEBUG_PARSER,
-                                                                 "Unknown parser command %d\n", seq.command());
-                                                break;
-                                        }
-
-                                        m_last_graphic_character = 0;
-
-                                        modified = TRUE;
-
-                                        // FIXME m_screen may be != previous_screen, check for that!
-
-                                        gboolean new_in_scroll_region = m_scrolling_restricted
-                                                && (m_screen->cursor.row >= (m_screen->insert_delta + m_scrolling_region.start))
-                                                && (m_screen->cursor.row <= (m_screen->insert_delta + m_scrolling_region.end));
-
-                                        /* if we have moved greatly during the sequence handler, or moved
-                                         * into a scroll_region from outside it, restart the bbox.
-                                         */
-                                        if (invalidated_text &&
-                                            ((new_in_scroll_region && !in_scroll_region) ||
-                                             (m_screen->cursor.row > bbox_bottom + VTE_CELL_BBOX_SLACK ||
-                                              m_screen->cursor.row < bbox_top - VTE_CELL_BBOX_SLACK))) {
-                                                invalidate_rows_and_context(bbox_top, bbox_bottom);
-                                                invalidated_text = FALSE;
-                                                bbox_bottom = -G_MAXINT;
-                                                bbox_top = G_MAXINT;
-                                        }
-
-                                        in_scroll_region = new_in_scroll_region;
-
-                                        break;
-                                }
-                                }
+                        case vte::base::UTF8Decoder::ACCEPT:
+                                process_codepoint(m_utf8_decoder.codepoint(), ip, iend);
                                 break;
                         }
-                        }
                 }
         }
 
@@ -4049,26 +4469,21 @@ void
 VteTerminalPrivate::maybe_remove_images ()
 {
 	VteRing *ring = m_screen->row_data;
-	auto image_map = ring->image_map;
+	auto image_index = ring->image_index;
 	vte::image::image_object *image;
 
-	auto it = image_map->begin();
-
-	/* step 1. collect images out of scroll-back area */
-	while (it != image_map->end()) {
-		/* image_map is sorted from oldest to new */
-		image = it->second;
-
+	/* step 1. collect images out of scroll-back area, from the oldest */
+	while ((image = image_index->oldest ()) != NULL) {
 		/* break if the image is still in scrollback area */
 		if (image->get_bottom () >= ring->start)
 			break;
 
 		/* otherwise, delete it */
 		if (image->is_freezed ())
-			ring->image_offscreen_resource_counter -= image->resource_size ();
+			ring->image_offscreen_resource_counter -= image->get_charged_size ();
 		else
-			ring->image_onscreen_resource_counter -= image->resource_size ();
-		image_map->erase (image->get_bottom ());
+			ring->image_onscreen_resource_counter -= image->get_charged_size ();
+		image_index->remove (image);
 		delete image;
 		_vte_debug_print (VTE_DEBUG_IMAGE,
 		                  "deleted, offscreen: %zu\n",
@@ -4083,16 +4498,13 @@ VteTerminalPrivate::maybe_remove_images ()
 		                  "checked, offscreen: %zu, max: %zu\n",
 		                  ring->image_offscreen_resource_counter,
 		                  m_freezed_image_limit);
-		while (it != image_map->end()) {
-			image = it->second;
-			++it;
-
+		while ((image = image_index->oldest ()) != NULL) {
 			/* remove */
-			image_map->erase (image->get_bottom ());
+			image_index->remove (image);
 			if (image->is_freezed ())
-				ring->image_offscreen_resource_counter -= image->resource_size ();
+				ring->image_offscreen_resource_counter -= image->get_charged_size ();
 			else
-				ring->image_onscreen_resource_counter -= image->resource_size ();
+				ring->image_onscreen_resource_counter -= image->get_charged_size ();
 			_vte_debug_print (VTE_DEBUG_IMAGE,
 			                  "deleted, offscreen: %zu\n",
 			                  ring->image_offscreen_resource_counter);
@@ -4104,61 +4516,492 @@ VteTerminalPrivate::maybe_remove_images ()
 		}
 	}
 
-	/* step 3. shrink image stream with calling _vte_stream_advance_tail() */
-	if (ring->has_streams)
-		_vte_ring_shrink_image_stream (ring);
+	/* The image store gives back the space of the deleted images by itself */
+
+	/* step 3. check the budget shared with the other terminals */
+	queue_image_budget_check ();
 }
 
 void
 VteTerminalPrivate::freeze_hidden_images_before_view_area (double start_pos, double end_pos)
 {
 	VteRing *ring = m_screen->row_data;
-	auto image_map = ring->image_map;
 	/* for images before view area */
 	vte::grid::row_t top_of_view = (vte::grid::row_t)start_pos;
-	typedef std::remove_pointer<decltype(ring->image_map)>::type map_t;
+	std::vector<vte::image::image_object *> images;
 
-	/* iterate from new to old */
-	for (auto it = map_t::reverse_iterator (image_map->lower_bound (top_of_view)); it != image_map->rend (); ++it) {
-		vte::image::image_object *image = it->second;
-		if (image->get_bottom () + 1 < end_pos)
-			break;
-		if (! image->is_freezed ()) {
-			ring->image_onscreen_resource_counter -= image->resource_size ();
+	/* images that were in view at @end_pos and now end above it */
+	ring->image_index->find_by_bottom ((glong)end_pos - 1, top_of_view - 1, images);
+	for (auto image : images)
+		queue_image_freeze (ring, image);
+}
+
+void
+VteTerminalPrivate::freeze_hidden_images_after_view_area (double start_pos, double end_pos)
+{
+	VteRing *ring = m_screen->row_data;
+	vte::grid::row_t bottom_of_view = (vte::grid::row_t)(start_pos + m_row_count);
+	std::vector<vte::image::image_object *> images;
+
+	/* images that were in view at @end_pos and now start below it */
+	ring->image_index->find_by_top (bottom_of_view + 1, (glong)(end_pos + m_row_count), images);
+	for (auto image : images)
+		queue_image_freeze (ring, image);
+}
+
+/*
+ * Images scrolled out of view are frozen in the background: indexed images
+ * are encoded on a worker thread right away, and a low priority timeout
+ * writes them to the stream once they're done, and freezes the others
+ * within a time budget. Images that come back into view before that are
+ * left alone.
+ */
+void
+VteTerminalPrivate::queue_image_freeze (VteRing *ring, vte::image::image_object *image)
+{
+	if (image->is_freezed () || image->is_freezing ())
+		return;
+
+	image->freeze_async ();
+	m_image_freeze_queue.emplace_back (ring, image);
+
+	if (m_image_freeze_tag == 0)
+		m_image_freeze_tag = g_timeout_add_full (G_PRIORITY_LOW,
+		                                         VTE_IMAGE_FREEZE_INTERVAL,
+		                                         (GSourceFunc)image_freeze_timeout_cb,
+		                                         this,
+		                                         NULL);
+}
+
+/* Returns whether there are images left to freeze */
+bool
+VteTerminalPrivate::process_image_freeze_queue ()
+{
+	gint64 deadline = g_get_monotonic_time () + VTE_IMAGE_FREEZE_BUDGET;
+	vte::grid::row_t top_row = first_displayed_row ();
+	vte::grid::row_t bottom_row = last_displayed_row ();
+	auto last = m_image_freeze_queue.begin ();
+
+	for (auto const &entry : m_image_freeze_queue) {
+		VteRing *ring = entry.first;
+		vte::image::image_object *image = entry.second;
+
+		/* It may have been deleted, or frozen some other way, meanwhile */
+		if (! ring->image_index->contains (image) || image->is_freezed ())
+			continue;
+
+		if (ring == m_screen->row_data &&
+		    image->get_bottom () >= top_row && image->get_top () <= bottom_row) {
+			image->cancel_freeze ();
+			continue;
+		}
+
+		size_t size = image->get_charged_size ();
+		if (image->is_freezing ()) {
+			if (! image->freeze_finish ()) {
+				*last++ = entry;
+				continue;
+			}
+		} else if (image->freeze_async ()) {
+			/* It was cancelled, and is out of view again */
+			*last++ = entry;
+			continue;
+		} else if (g_get_monotonic_time () < deadline) {
+			/* Nothing to encode, the store has it already */
 			image->freeze ();
-			ring->image_offscreen_resource_counter += image->resource_size ();
+		} else {
+			*last++ = entry;
+			continue;
+		}
+
+		if (image->is_freezed ()) {
+			ring->image_onscreen_resource_counter -= size;
+			ring->image_offscreen_resource_counter += image->charge ();
 			_vte_debug_print (VTE_DEBUG_IMAGE,
 			                  "freezed, onscreen: %zu, offscreen: %zu\n",
 			                  ring->image_onscreen_resource_counter,
 			                  ring->image_offscreen_resource_counter);
 		}
 	}
+	m_image_freeze_queue.erase (last, m_image_freeze_queue.end ());
+	queue_image_budget_check ();
+
+	return ! m_image_freeze_queue.empty ();
+}
+
+gboolean
+VteTerminalPrivate::image_freeze_timeout_cb (vte::terminal::Terminal *that)
+{
+	if (that->process_image_freeze_queue ())
+		return G_SOURCE_CONTINUE;
+
+	that->m_image_freeze_tag = 0;
+	return G_SOURCE_REMOVE;
 }
 
 void
-VteTerminalPrivate::freeze_hidden_images_after_view_area (double start_pos, double end_pos)
+VteTerminalPrivate::clear_image_freeze_queue ()
+{
+	for (auto const &entry : m_image_freeze_queue)
+		if (entry.first->image_index->contains (entry.second))
+			entry.second->cancel_freeze ();
+	m_image_freeze_queue.clear ();
+
+	if (m_image_freeze_tag == 0)
+		return;
+
+	g_source_remove (m_image_freeze_tag);
+	m_image_freeze_tag = 0;
+}
+
+/*
+ * The scroll velocity, fading to nothing over VTE_IMAGE_PREFETCH_LOOKAHEAD
+ * milliseconds after the view last moved
+ */
+double
+VteTerminalPrivate::get_scroll_velocity () const
+{
+	gint64 elapsed = g_get_monotonic_time () - m_scroll_time;
+
+	if (elapsed >= VTE_IMAGE_PREFETCH_LOOKAHEAD * 1000)
+		return 0;
+	return m_scroll_velocity * (1. - elapsed / (VTE_IMAGE_PREFETCH_LOOKAHEAD * 1000.));
+}
+
+/*
+ * Frozen images near the view are decoded on worker threads ahead of time,
+ * so scrolling to them doesn't wait for that in the paint handler. The
+ * window reaches m_image_prefetch_rows above and below the view, and
+ * further in the direction the view scrolls, the faster the further.
+ */
+void
+VteTerminalPrivate::get_image_prefetch_window (vte::grid::row_t *first_row, vte::grid::row_t *last_row)
+{
+	double velocity = get_scroll_velocity ();
+	double ahead = MIN (ABS (velocity) * VTE_IMAGE_PREFETCH_LOOKAHEAD / 1000.,
+	                    (double)m_row_count * VTE_IMAGE_PREFETCH_SCREENS_MAX);
+
+	*first_row = first_displayed_row () - m_image_prefetch_rows;
+	*last_row = last_displayed_row () + m_image_prefetch_rows;
+	if (velocity < 0)
+		*first_row -= (vte::grid::row_t)ahead;
+	else
+		*last_row += (vte::grid::row_t)ahead;
+}
+
+void
+VteTerminalPrivate::prefetch_images ()
 {
 	VteRing *ring = m_screen->row_data;
-	auto image_map = ring->image_map;
-	vte::grid::row_t bottom_of_view = (vte::grid::row_t)(start_pos + m_row_count);
+	vte::grid::row_t first_row, last_row;
+	std::vector<vte::image::image_object *> images;
 
-	/* for images after view area */
-	for (auto it = image_map->lower_bound (bottom_of_view); it != image_map->end (); ++it) {
-		vte::image::image_object *image = it->second;
-		if (image->get_top () < end_pos + m_row_count)
-			break;
-		if (image->get_top () > bottom_of_view && ! image->is_freezed ()) {
-			ring->image_onscreen_resource_counter -= image->resource_size ();
-			image->freeze ();
-			ring->image_offscreen_resource_counter += image->resource_size ();
+	if (m_image_prefetch_rows <= 0 && get_scroll_velocity () == 0)
+		return;
+
+	/* Let go of what was fetched for the previous window */
+	process_image_prefetch_queue ();
+
+	get_image_prefetch_window (&first_row, &last_row);
+	ring->image_index->find_overlapping (first_row, last_row, images);
+	for (auto image : images) {
+		if (! image->is_freezed () || image->is_thawing ())
+			continue;
+		if (image->thaw_async ())
+			m_image_prefetch_queue.emplace_back (ring, image);
+	}
+
+	if (m_image_prefetch_tag == 0 && ! m_image_prefetch_queue.empty ())
+		m_image_prefetch_tag = g_timeout_add_full (G_PRIORITY_LOW,
+		                                           VTE_IMAGE_FREEZE_INTERVAL,
+		                                           (GSourceFunc)image_prefetch_timeout_cb,
+		                                           this,
+		                                           NULL);
+}
+
+/*
+ * Account for the thaws that are done, and freeze again the prefetched
+ * images that the window left before they were shown. Returns whether
+ * any thaw is still in progress.
+ */
+bool
+VteTerminalPrivate::process_image_prefetch_queue ()
+{
+	vte::grid::row_t first_row, last_row;
+	vte::grid::row_t top_row = first_displayed_row ();
+	vte::grid::row_t bottom_row = last_displayed_row ();
+	bool thawing = false;
+	auto last = m_image_prefetch_queue.begin ();
+
+	get_image_prefetch_window (&first_row, &last_row);
+
+	for (auto const &entry : m_image_prefetch_queue) {
+		VteRing *ring = entry.first;
+		vte::image::image_object *image = entry.second;
+
+		if (! ring->image_index->contains (image))
+			continue;
+
+		bool current = ring == m_screen->row_data;
+		bool in_window = current && image->get_bottom () >= first_row && image->get_top () <= last_row;
+
+		if (image->is_thawing ()) {
+			if (! in_window) {
+				image->cancel_thaw ();
+				continue;
+			}
+			size_t size = image->get_charged_size ();
+			if (! image->thaw_finish (false)) {
+				thawing = true;
+				*last++ = entry;
+				continue;
+			}
+			if (image->is_freezed ())
+				continue;
+			ring->image_offscreen_resource_counter -= size;
+			ring->image_onscreen_resource_counter += image->charge ();
 			_vte_debug_print (VTE_DEBUG_IMAGE,
-			                  "freezed, onscreen: %zu, offscreen: %zu\n",
+			                  "prefetched, onscreen: %zu, offscreen: %zu\n",
 			                  ring->image_onscreen_resource_counter,
 			                  ring->image_offscreen_resource_counter);
 		}
+
+		if (image->is_freezed ())
+			continue;
+
+		/* Shown now, it's frozen again when scrolled out of view */
+		if (current && image->get_bottom () >= top_row && image->get_top () <= bottom_row)
+			continue;
+
+		/* Unchanged, so freezing it again costs nothing */
+		if (! in_window) {
+			queue_image_freeze (ring, image);
+			continue;
+		}
+
+		*last++ = entry;
+	}
+	m_image_prefetch_queue.erase (last, m_image_prefetch_queue.end ());
+	queue_image_budget_check ();
+
+	return thawing;
+}
+
+gboolean
+VteTerminalPrivate::image_prefetch_timeout_cb (vte::terminal::Terminal *that)
+{
+	if (that->process_image_prefetch_queue ())
+		return G_SOURCE_CONTINUE;
+
+	that->m_image_prefetch_tag = 0;
+	return G_SOURCE_REMOVE;
+}
+
+void
+VteTerminalPrivate::clear_image_prefetch_queue ()
+{
+	for (auto const &entry : m_image_prefetch_queue)
+		if (entry.first->image_index->contains (entry.second))
+			entry.second->cancel_thaw ();
+	m_image_prefetch_queue.clear ();
+
+	if (m_image_prefetch_tag == 0)
+		return;
+
+	g_source_remove (m_image_prefetch_tag);
+	m_image_prefetch_tag = 0;
+}
+
+/*
+ * Besides the per-terminal limit on freezed images, the images of all the
+ * terminals in the process share a budget for the memory their pixels take
+ * (g_image_memory_limit) and for what they take frozen (g_image_frozen_limit).
+ * The surfaces indexed images are expanded into for painting count towards
+ * the first too. Over it, the least recently painted of those surfaces are
+ * dropped, then the least recently painted images out of view are frozen;
+ * over the second, the least recently painted frozen images are deleted.
+ * The check is coalesced into a low priority timeout, which also emits
+ * image-memory-changed on the terminals whose usage changed.
+ */
+void
+VteTerminalPrivate::get_image_memory_usage (gsize *resident, gsize *frozen) const
+{
+	*resident = m_normal_screen.row_data->image_onscreen_resource_counter +
+	            m_alternate_screen.row_data->image_onscreen_resource_counter;
+	*frozen = m_normal_screen.row_data->image_offscreen_resource_counter +
+	          m_alternate_screen.row_data->image_offscreen_resource_counter;
+}
+
+void
+VteTerminalPrivate::get_image_memory_totals (gsize *resident, gsize *frozen)
+{
+	*resident = *frozen = 0;
+	for (GList *l = g_image_terminals; l != NULL; l = l->next) {
+		gsize r, f;
+		((vte::terminal::Terminal *)l->data)->get_image_memory_usage (&r, &f);
+		*resident += r;
+		*frozen += f;
+	}
+	*resident += vte::image::image_object::get_cache_size ();
+}
+
+void
+VteTerminalPrivate::set_image_memory_limits (gsize resident, gsize frozen)
+{
+	g_image_memory_limit = resident;
+	g_image_frozen_limit = frozen;
+	vte::image::image_object::set_cache_limit (resident);
+	queue_image_budget_check ();
+}
+
+void
+VteTerminalPrivate::get_image_memory_limits (gsize *resident, gsize *frozen)
+{
+	*resident = g_image_memory_limit;
+	*frozen = g_image_frozen_limit;
+}
+
+bool
+VteTerminalPrivate::image_is_visible (VteRing *ring, vte::image::image_object *image)
+{
+	return ring == m_screen->row_data &&
+	       image->get_bottom () >= first_displayed_row () &&
+	       image->get_top () <= last_displayed_row ();
+}
+
+void
+VteTerminalPrivate::queue_image_budget_check ()
+{
+	if (g_image_budget_tag != 0 || g_image_terminals == NULL)
+		return;
+
+	g_image_budget_tag = g_timeout_add_full (G_PRIORITY_LOW,
+	                                         VTE_IMAGE_FREEZE_INTERVAL,
+	                                         (GSourceFunc)image_budget_timeout_cb,
+	                                         NULL,
+	                                         NULL);
+}
+
+gboolean
+VteTerminalPrivate::image_budget_timeout_cb (gpointer data)
+{
+	g_image_budget_tag = 0;
+
+	enforce_image_budget ();
+
+	for (GList *l = g_image_terminals; l != NULL; l = l->next)
+		((vte::terminal::Terminal *)l->data)->emit_image_memory_changed ();
+
+	return G_SOURCE_REMOVE;
+}
+
+void
+VteTerminalPrivate::enforce_image_budget ()
+{
+	struct candidate {
+		vte::terminal::Terminal *terminal;
+		VteRing *ring;
+		vte::image::image_object *image;
+	};
+	std::vector<candidate> candidates;
+	auto lru = [] (candidate const &a, candidate const &b) {
+		return a.image->get_last_used () < b.image->get_last_used ();
+	};
+	gsize resident, frozen;
+
+	/* What images sharing their pixels or frozen copy take changes as the
+	 * others come and go, so charge them again for what they take now */
+	for (GList *l = g_image_terminals; l != NULL; l = l->next) {
+		auto that = (vte::terminal::Terminal *)l->data;
+		for (VteRing *ring : {that->m_normal_screen.row_data, that->m_alternate_screen.row_data})
+			ring->image_index->foreach ([&] (vte::image::image_object *image) {
+				size_t size = image->get_charged_size ();
+				if (image->is_freezed ())
+					ring->image_offscreen_resource_counter += image->charge () - size;
+				else
+					ring->image_onscreen_resource_counter += image->charge () - size;
+			});
+	}
+
+	get_image_memory_totals (&resident, &frozen);
+
+	/* step 1. drop the least recently painted surfaces of indexed images,
+	 * which are expanded again from their indices when needed */
+	if (resident > g_image_memory_limit) {
+		gsize cache_size = vte::image::image_object::get_cache_size ();
+		vte::image::image_object::cache_trim (cache_size - MIN (cache_size, resident - g_image_memory_limit));
+		resident -= cache_size - vte::image::image_object::get_cache_size ();
+	}
+
+	/* step 2. freeze the least recently painted images out of view. They
+	 * are frozen in the background, so count them as freezed already. */
+	if (resident > g_image_memory_limit) {
+		for (GList *l = g_image_terminals; l != NULL; l = l->next) {
+			auto that = (vte::terminal::Terminal *)l->data;
+			for (VteRing *ring : {that->m_normal_screen.row_data, that->m_alternate_screen.row_data})
+				ring->image_index->foreach ([&] (vte::image::image_object *image) {
+					if (! image->is_freezed () && ! that->image_is_visible (ring, image))
+						candidates.push_back ({that, ring, image});
+				});
+		}
+		std::sort (candidates.begin (), candidates.end (), lru);
+
+		for (auto const &c : candidates) {
+			if (resident <= g_image_memory_limit)
+				break;
+			resident -= MIN (resident, c.image->get_charged_size ());
+			c.terminal->queue_image_freeze (c.ring, c.image);
+		}
+		_vte_debug_print (VTE_DEBUG_IMAGE,
+		                  "over the image memory budget, freezing down to %zu of %zu\n",
+		                  resident, g_image_memory_limit);
+		candidates.clear ();
+	}
+
+	/* step 3. delete the least recently painted freezed images */
+	if (frozen > g_image_frozen_limit) {
+		for (GList *l = g_image_terminals; l != NULL; l = l->next) {
+			auto that = (vte::terminal::Terminal *)l->data;
+			for (VteRing *ring : {that->m_normal_screen.row_data, that->m_alternate_screen.row_data})
+				ring->image_index->foreach ([&] (vte::image::image_object *image) {
+					if (image->is_freezed () && ! image->is_thawing () &&
+					    ! that->image_is_visible (ring, image))
+						candidates.push_back ({that, ring, image});
+				});
+		}
+		std::sort (candidates.begin (), candidates.end (), lru);
+
+		for (auto const &c : candidates) {
+			if (frozen <= g_image_frozen_limit)
+				break;
+			size_t size = c.image->get_charged_size ();
+			frozen -= MIN (frozen, size);
+			c.ring->image_offscreen_resource_counter -= size;
+			c.ring->image_index->remove (c.image);
+			delete c.image;
+		}
+		_vte_debug_print (VTE_DEBUG_IMAGE,
+		                  "over the freezed image budget, deleted down to %zu of %zu\n",
+		                  frozen, g_image_frozen_limit);
 	}
 }
 
+void
+VteTerminalPrivate::emit_image_memory_changed ()
+{
+	gsize resident, frozen;
+
+	get_image_memory_usage (&resident, &frozen);
+	if (resident + frozen == m_image_memory_notified)
+		return;
+	m_image_memory_notified = resident + frozen;
+
+	_vte_debug_print (VTE_DEBUG_SIGNALS,
+	                  "Emitting `image-memory-changed' (%zu + %zu).\n", resident, frozen);
+	g_object_notify_by_pspec (G_OBJECT (m_terminal), pspecs[PROP_IMAGE_MEMORY_USAGE]);
+	g_signal_emit (m_terminal, signals[SIGNAL_IMAGE_MEMORY_CHANGED], 0);
+}
+
 void
 VteTerminalPrivate::feed_chunks(struct _vte_incoming_chunk *chunks)
 {
@@ -7886,6 +8729,18 @@ VteTerminalPrivate::set_freezed_image_limit(gulong limit)
 
         return true;
 }
+
+bool
+VteTerminalPrivate::set_image_prefetch_rows(long rows)
+{
+        g_assert(rows >= 0);
+
+        if (rows == m_image_prefetch_rows)
+                return false;
+
+        m_image_prefetch_rows = rows;
+        return true;
+}
 // =======
 Terminal::set_cell_width_scale(double scale)
 {
@@ -8088,6 +8943,7 @@ bool
 VteTerminalPrivate::set_sixel_enabled(gboolean enabled)
 {
         m_sixel_enabled = enabled;
+        m_parser.set_dispatch_unripe(enabled);
 
         return true;
 }
@@ -8177,6 +9033,15 @@ Terminal::vadjustment_value_changed()
 			freeze_hidden_images_after_view_area (adj, adj - dy);
 		}
 
+		/* Smoothed with what's left of the previous velocity */
+		gint64 now = g_get_monotonic_time ();
+		double velocity = dy * G_USEC_PER_SEC / MAX (now - m_scroll_time, 1);
+		m_scroll_velocity = (get_scroll_velocity () + velocity) / 2;
+		m_scroll_time = now;
+
+		if (m_sixel_enabled)
+			prefetch_images ();
+
 // =======
 	if (!_vte_double_equal(dy, 0)) {
 // >>>>>>> origin/vte-0-58
@@ -8374,6 +9239,7 @@ Terminal::Terminal(vte::platform::Widget* w,
         save_cursor(&m_alternate_screen);
 
 	/* Initialize SIXEL color register */
+	m_sixel_state.image.bands = nullptr;
 	sixel_parser_set_default_color(&m_sixel_state);
 
 	/* Matching data. */
@@ -8412,7 +9278,10 @@ Terminal::Terminal(vte::platform::Widget* w,
 // <<<<<<< HEAD
         /* Image */
         m_freezed_image_limit = VTE_DEFAULT_FREEZED_IMAGE_LIMIT;
+        m_image_prefetch_rows = VTE_DEFAULT_IMAGE_PREFETCH_ROWS;
+        m_image_terminals_link = g_image_terminals = g_list_prepend(g_image_terminals, this);
         m_sixel_enabled = TRUE;
+        m_parser.set_dispatch_unripe(m_sixel_enabled);
 
 	/* Not all backends generate GdkVisibilityNotify, so mark the
 	 * window as unobscured initially. */
@@ -8595,6 +9464,10 @@ Terminal::widget_unrealize()
         /* Remove the contents blink timeout function. */
         remove_text_blink_timeout();
 
+	/* Stop freezing and thawing images in the background. */
+	clear_image_freeze_queue();
+	clear_image_prefetch_queue();
+
 	/* Cancel any pending redraws. */
 	remove_update_timeout(this);
 
@@ -8651,6 +9524,25 @@ Terminal::~Terminal()
 		_vte_draw_free(m_draw);
 	}
 
+	/* Leave the image memory budget, and stop freezing and thawing. */
+	g_image_terminals = g_list_delete_link(g_image_terminals, m_image_terminals_link);
+	if (g_image_terminals == nullptr && g_image_budget_tag != 0) {
+		g_source_remove(g_image_budget_tag);
+		g_image_budget_tag = 0;
+	}
+	clear_image_freeze_queue();
+	clear_image_prefetch_queue();
+
+	/* Free any partially received SIXEL image. */
+	sixel_parser_deinit(&m_sixel_state);
+	delete m_sixel_preview;
+	if (m_sixel_preview_surface != nullptr)
+		cairo_surface_destroy(m_sixel_preview_surface);
+
+	_VTE_DEBUG_IF(VTE_DEBUG_IMAGE) {
+		vte::image::image_codec_print_stats();
+	}
+
 	/* Free the font description. */
         if (m_unscaled_font_desc != NULL) {
                 pango_font_description_free(m_unscaled_font_desc);
@@ -9971,30 +10863,78 @@ Terminal::widget_draw(cairo_t *cr)
                                  get_color(VTE_DEFAULT_BG), m_background_alpha);
         }
 
-	/* Draw SIXEL images */
+	/* Draw SIXEL images, only where the frame is damaged */
 	if (m_sixel_enabled) {
-		vte::grid::row_t top_row = first_displayed_row();
-		vte::grid::row_t bottom_row = last_displayed_row();
-		auto image_map = ring->image_map;
-		auto it = image_map->lower_bound (top_row);
-		for (; it != image_map->end (); ++it) {
-			vte::image::image_object *image = it->second;
-			if (image->get_top () > bottom_row)
-				break;
+		cairo_rectangle_int_t damage;
+		vte::grid::row_t top_row, bottom_row;
+		vte::grid::column_t left_col, right_col;
+		std::vector<vte::image::image_object *> images;
+
+		cairo_region_get_extents (region, &damage);
+		top_row = MAX (pixel_to_row (MAX (damage.y - m_padding.top, 0)), first_displayed_row ());
+		bottom_row = MIN (pixel_to_row (damage.y + damage.height - 1 - m_padding.top), last_displayed_row ());
+		left_col = MAX (damage.x - m_padding.left, 0) / m_cell_width;
+		right_col = (damage.x + damage.width - 1 - m_padding.left) / m_cell_width;
+
+		/* Older images first, so newer ones are painted over them */
+		if (top_row <= bottom_row && right_col >= 0)
+			ring->image_index->find_overlapping (top_row, bottom_row, left_col, right_col, images);
+		for (auto image : images) {
+			cairo_rectangle_int_t rect;
+			rect.x = m_padding.left + image->get_left () * m_cell_width;
+			rect.y = m_padding.top + row_to_pixel (image->get_top ());
+			rect.width = image->get_width () * m_cell_width;
+			rect.height = image->get_height () * m_cell_height;
+
+			/* The damaged rectangles may all miss it */
+			if (! vte_cairo_clip_damage (cr, region, &rect))
+				continue;
+
+			/* Visible again before it was frozen */
+			image->cancel_freeze ();
 			if (image->is_freezed ()) {
-				ring->image_offscreen_resource_counter -= image->resource_size ();
-				image->thaw ();
-				ring->image_onscreen_resource_counter += image->resource_size ();
+				size_t size = image->get_charged_size ();
+				if (! image->thaw ()) {
+					/* Lost, there's nothing to paint */
+					cairo_restore (cr);
+					continue;
+				}
+				ring->image_offscreen_resource_counter -= size;
+				ring->image_onscreen_resource_counter += image->charge ();
 				_vte_debug_print (VTE_DEBUG_IMAGE,
 				                  "thawn, onscreen: %zu, offscreen: %zu\n",
 				                  ring->image_onscreen_resource_counter,
 				                  ring->image_offscreen_resource_counter);
 			}
-			/* Display images */
-			int x = m_padding.left + image->get_left () * m_char_width;
-			int y = m_padding.top + (image->get_top () - m_screen->scroll_delta) * m_char_height;
-			image->paint (cr, x, y);
+			/* Large indexed images get their pixels on a worker, and a redraw when done */
+			image->materialize (m_widget);
+			/* Resampling for the cell size and device scale takes memory too */
+			size_t size = image->get_charged_size ();
+			image->paint (cr, rect.x, rect.y, m_cell_width, m_cell_height);
+			ring->image_onscreen_resource_counter += image->charge () - size;
+			cairo_restore (cr);
+		}
+
+		/* Display the part of a DECSIXEL image received so far */
+		if (m_sixel_preview != nullptr &&
+		    m_sixel_preview->get_bottom () >= top_row &&
+		    m_sixel_preview->get_top () <= bottom_row) {
+			cairo_rectangle_int_t rect;
+			rect.x = m_padding.left + m_sixel_preview->get_left () * m_cell_width;
+			rect.y = m_padding.top + row_to_pixel (m_sixel_preview->get_top ());
+			rect.width = m_sixel_preview->get_width () * m_cell_width;
+			rect.height = m_sixel_preview->get_height () * m_cell_height;
+
+			if (vte_cairo_clip_damage (cr, region, &rect)) {
+				size_t size = m_sixel_preview->resource_size ();
+				m_sixel_preview->paint (cr, rect.x, rect.y, m_cell_width, m_cell_height);
+				m_sixel_preview_ring->image_onscreen_resource_counter += m_sixel_preview->resource_size () - size;
+				cairo_restore (cr);
+			}
 		}
+
+		if (! images.empty ())
+			queue_image_budget_check ();
 	}
 
         /* Clip vertically, for the sake of smooth scrolling. We want the top and bottom paddings to be unused.
@@ -10108,6 +11048,36 @@ vte_cairo_get_clip_region (cairo_t *cr)
         return region;
 }
 
+/* Saves @cr and clips it to the part of @rect within @region. Returns FALSE,
+ * without saving, when none of @rect needs drawing. */
+static gboolean
+vte_cairo_clip_damage (cairo_t *cr,
+                       cairo_region_t const *region,
+                       cairo_rectangle_int_t const *rect)
+{
+        cairo_region_t *damage;
+        int i, n;
+
+        if (cairo_region_contains_rectangle (region, rect) == CAIRO_REGION_OVERLAP_OUT)
+                return FALSE;
+
+        damage = cairo_region_create_rectangle (rect);
+        cairo_region_intersect (damage, region);
+
+        cairo_save (cr);
+        n = cairo_region_num_rectangles (damage);
+        for (i = 0; i < n; i++) {
+                cairo_rectangle_int_t clip_rect;
+
+                cairo_region_get_rectangle (damage, i, &clip_rect);
+                cairo_rectangle (cr, clip_rect.x, clip_rect.y, clip_rect.width, clip_rect.height);
+        }
+        cairo_clip (cr);
+        cairo_region_destroy (damage);
+
+        return TRUE;
+}
+
 void
 Terminal::widget_scroll(GdkEventScroll *event)
 {
@@ -10598,6 +11568,10 @@ Terminal::reset(bool clear_tabstops,
         /* Reset parser */
         m_parser.reset();
         m_last_graphic_character = 0;
+        m_sixel_streaming = false;
+        m_sixel_lead_byte = 0;
+        sixel_parser_deinit(&m_sixel_state);
+        clear_sixel_preview();
 
         /* Reset modes */
         m_modes_ecma.reset();
@@ -31,6 +31,18 @@ char *vte_get_user_shell(void);
 _VTE_PUBLIC
 const char *vte_get_features (void);
 
+_VTE_PUBLIC
+void vte_set_image_memory_limits(guint64 resident,
+                                 guint64 frozen);
+
+_VTE_PUBLIC
+void vte_get_image_memory_limits(guint64 *resident,
+                                 guint64 *frozen);
+
+_VTE_PUBLIC
+void vte_get_image_memory_usage(guint64 *resident,
+                                guint64 *frozen);
+
 #define VTE_TEST_FLAGS_NONE (G_GUINT64_CONSTANT(0))
 #define VTE_TEST_FLAGS_ALL (~G_GUINT64_CONSTANT(0))
 
@@ -494,6 +494,20 @@ void vte_terminal_set_freezed_image_limit(VteTerminal *terminal,
 _VTE_PUBLIC
 gulong vte_terminal_get_freezed_image_limit(VteTerminal *terminal) _VTE_GNUC_NONNULL(1);
 
+/* Get the memory taken by the terminal's images */
+_VTE_PUBLIC
+void vte_terminal_get_image_memory_usage(VteTerminal *terminal,
+                                         guint64 *resident,
+                                         guint64 *frozen) _VTE_GNUC_NONNULL(1);
+
+/* Set or get how many rows around the view have their images thawed ahead of time */
+_VTE_PUBLIC
+void vte_terminal_set_image_prefetch_rows(VteTerminal *terminal,
+                                          glong rows) _VTE_GNUC_NONNULL(1);
+
+_VTE_PUBLIC
+glong vte_terminal_get_image_prefetch_rows(VteTerminal *terminal) _VTE_GNUC_NONNULL(1);
+
 /* Set or get whether the SIXEL graphics feature is enabled */
 _VTE_PUBLIC
 void vte_terminal_set_sixel_enabled (VteTerminal *terminal,
@@ -90,6 +90,40 @@
 #define VTE_DEFAULT_UTF8_AMBIGUOUS_WIDTH 1
 #define VTE_DEFAULT_FREEZED_IMAGE_LIMIT (16 * 1024 * 1024)  /* 16 MB */
 
+/* SIXEL images at least this many pixels are rendered on a worker thread */
+#define VTE_SIXEL_ASYNC_RENDER_MIN_PIXELS (256 * 256)
+
+/* Images scrolled out of view are frozen in the background, this often (ms),
+ * spending at most this long (µs) on the main thread each time */
+#define VTE_IMAGE_FREEZE_INTERVAL 16
+#define VTE_IMAGE_FREEZE_BUDGET 2000
+
+/* Frozen images this many rows around the view are thawed ahead of time,
+ * and further ahead while scrolling, by the rows scrolled in this long (ms),
+ * up to this many screens */
+#define VTE_DEFAULT_IMAGE_PREFETCH_ROWS 25
+#define VTE_IMAGE_PREFETCH_LOOKAHEAD 250
+#define VTE_IMAGE_PREFETCH_SCREENS_MAX 4
+
+/* All the terminals in the process together keep at most this much image
+ * pixels in memory, and this much frozen in their streams */
+#define VTE_DEFAULT_IMAGE_MEMORY_LIMIT (256 * 1024 * 1024)  /* 256 MB */
+#define VTE_DEFAULT_IMAGE_FROZEN_LIMIT (512 * 1024 * 1024)  /* 512 MB */
+
+/* Indexed images keep their expanded surfaces for painting, for the most
+ * recently painted ones, up to this much or the memory limit if lower */
+#define VTE_IMAGE_SURFACE_CACHE_SIZE (64 * 1024 * 1024)  /* 64 MB */
+
+/* Frozen images are kept in a log of segments this large, which is compacted
+ * this often (ms), spending at most this long (µs) each time */
+#define VTE_IMAGE_STORE_SEGMENT_SIZE (1024 * 1024)
+#define VTE_IMAGE_STORE_COMPACT_INTERVAL 100
+#define VTE_IMAGE_STORE_COMPACT_BUDGET 2000
+
+/* SIXEL images are stored in tiles of this many cells, aligned to the screen */
+#define VTE_IMAGE_TILE_COLUMNS 32
+#define VTE_IMAGE_TILE_ROWS 16
+
 #define VTE_UTF8_BPC                    (4) /* Maximum number of bytes used per UTF-8 character */
 
 /* Keep in decreasing order of precedence. */
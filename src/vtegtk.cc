@@ -511,6 +511,15 @@ vte_terminal_get_property (GObject *object,
                 case PROP_ICON_TITLE:
                         g_value_set_string (value, vte_terminal_get_icon_title (terminal));
                         break;
+                case PROP_IMAGE_MEMORY_USAGE: {
+                        guint64 resident, frozen;
+                        vte_terminal_get_image_memory_usage (terminal, &resident, &frozen);
+                        g_value_set_uint64 (value, resident + frozen);
+                        break;
+                }
+                case PROP_IMAGE_PREFETCH_ROWS:
+                        g_value_set_long (value, vte_terminal_get_image_prefetch_rows (terminal));
+                        break;
                 case PROP_INPUT_ENABLED:
                         g_value_set_boolean (value, vte_terminal_get_input_enabled (terminal));
                         break;
@@ -618,6 +627,9 @@ vte_terminal_set_property (GObject *object,
                 case PROP_FONT_SCALE:
                         vte_terminal_set_font_scale (terminal, g_value_get_double (value));
                         break;
+                case PROP_IMAGE_PREFETCH_ROWS:
+                        vte_terminal_set_image_prefetch_rows (terminal, g_value_get_long (value));
+                        break;
                 case PROP_INPUT_ENABLED:
                         vte_terminal_set_input_enabled (terminal, g_value_get_boolean (value));
                         break;
@@ -896,6 +908,26 @@ vte_terminal_class_init(VteTerminalClass *klass)
                                    G_OBJECT_CLASS_TYPE(klass),
                                    g_cclosure_marshal_VOID__VOIDv);
 
+        /**
+         * VteTerminal::image-memory-changed:
+         * @vteterminal: the object which received the signal
+         *
+         * Emitted when the memory taken by the terminal's images changes,
+         * at most once in a while. See vte_terminal_get_image_memory_usage().
+         */
+        signals[SIGNAL_IMAGE_MEMORY_CHANGED] =
+                g_signal_new(I_("image-memory-changed"),
+                             G_OBJECT_CLASS_TYPE(klass),
+                             G_SIGNAL_RUN_LAST,
+                             0,
+                             NULL,
+                             NULL,
+                             g_cclosure_marshal_VOID__VOID,
+                             G_TYPE_NONE, 0);
+        g_signal_set_va_marshaller(signals[SIGNAL_IMAGE_MEMORY_CHANGED],
+                                   G_OBJECT_CLASS_TYPE(klass),
+                                   g_cclosure_marshal_VOID__VOIDv);
+
         /**
          * VteTerminal::hyperlink-hover-uri-changed:
          * @vteterminal: the object which received the signal
@@ -1635,6 +1667,30 @@ vte_terminal_class_init(VteTerminalClass *klass)
                                     0, G_MAXULONG, VTE_DEFAULT_FREEZED_IMAGE_LIMIT,
                                     (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY));
 
+        /**
+         * VteTerminal:image-memory-usage:
+         *
+         * The number of bytes the terminal's images take, in memory and
+         * freezed into its streams together. See vte_terminal_get_image_memory_usage()
+         * and vte_set_image_memory_limits().
+         */
+        pspecs[PROP_IMAGE_MEMORY_USAGE] =
+                g_param_spec_uint64 ("image-memory-usage", NULL, NULL,
+                                     0, G_MAXUINT64, 0,
+                                     (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY));
+
+        /**
+         * VteTerminal:image-prefetch-rows:
+         *
+         * The number of rows above and below the view whose offscreen freezed
+         * images are thawed in the background ahead of being shown. While
+         * scrolling, images further ahead are thawed too.
+         */
+        pspecs[PROP_IMAGE_PREFETCH_ROWS] =
+                g_param_spec_long ("image-prefetch-rows", NULL, NULL,
+                                   0, G_MAXLONG, VTE_DEFAULT_IMAGE_PREFETCH_ROWS,
+                                   (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_EXPLICIT_NOTIFY));
+
 
         /**
          * VteTerminal:input-enabled:
@@ -1955,6 +2011,63 @@ vte_set_test_flags(guint64 flags)
 #endif
 }
 
+/**
+ * vte_set_image_memory_limits:
+ * @resident: bytes of image pixels kept in memory
+ * @frozen: bytes of images freezed into the terminals' streams
+ *
+ * Sets the image memory budget shared by all terminals in the process.
+ * Over @resident, the least recently painted images out of view are
+ * freezed; over @frozen, the least recently painted freezed images are
+ * deleted. This is in addition to each terminal's
+ * #VteTerminal:freezed-image-limit.
+ */
+void
+vte_set_image_memory_limits(guint64 resident,
+                            guint64 frozen)
+{
+        vte::terminal::Terminal::set_image_memory_limits(MIN(resident, G_MAXSIZE),
+                                                         MIN(frozen, G_MAXSIZE));
+}
+
+/**
+ * vte_get_image_memory_limits:
+ * @resident: (out) (optional): location to store the limit of image pixels in memory
+ * @frozen: (out) (optional): location to store the limit of freezed images
+ *
+ * Gets the image memory budget shared by all terminals in the process.
+ */
+void
+vte_get_image_memory_limits(guint64 *resident,
+                            guint64 *frozen)
+{
+        gsize r, f;
+        vte::terminal::Terminal::get_image_memory_limits(&r, &f);
+        if (resident)
+                *resident = r;
+        if (frozen)
+                *frozen = f;
+}
+
+/**
+ * vte_get_image_memory_usage:
+ * @resident: (out) (optional): location to store the bytes of image pixels in memory
+ * @frozen: (out) (optional): location to store the bytes of freezed images
+ *
+ * Gets the memory taken by the images of all terminals in the process.
+ */
+void
+vte_get_image_memory_usage(guint64 *resident,
+                           guint64 *frozen)
+{
+        gsize r, f;
+        vte::terminal::Terminal::get_image_memory_totals(&r, &f);
+        if (resident)
+                *resident = r;
+        if (frozen)
+                *frozen = f;
+}
+
 /* VteTerminal public API */
 
 /**
@@ -4586,6 +4699,60 @@ vte_terminal_get_freezed_image_limit(VteTerminal *terminal)
         return IMPL(terminal)->m_freezed_image_limit;
 }
 
+/**
+ * vte_terminal_get_image_memory_usage:
+ * @terminal: a #VteTerminal
+ * @resident: (out) (optional): location to store the bytes of image pixels in memory
+ * @frozen: (out) (optional): location to store the bytes of freezed images
+ *
+ * Get the memory taken by the images of @terminal, in both screens
+ */
+void
+vte_terminal_get_image_memory_usage(VteTerminal *terminal, guint64 *resident, guint64 *frozen)
+{
+        g_return_if_fail(VTE_IS_TERMINAL(terminal));
+
+        gsize r, f;
+        IMPL(terminal)->get_image_memory_usage(&r, &f);
+        if (resident)
+                *resident = r;
+        if (frozen)
+                *frozen = f;
+}
+
+/**
+ * vte_terminal_set_image_prefetch_rows:
+ * @terminal: a #VteTerminal
+ * @rows: 0 to G_MAXLONG
+ *
+ * Set the number of rows above and below the view whose offscreen freezed
+ * images are thawed ahead of being shown
+ */
+void
+vte_terminal_set_image_prefetch_rows(VteTerminal *terminal, glong rows)
+{
+        g_return_if_fail(VTE_IS_TERMINAL(terminal));
+        g_return_if_fail(rows >= 0);
+
+        if (IMPL(terminal)->set_image_prefetch_rows(rows))
+                g_object_notify_by_pspec(G_OBJECT(terminal), pspecs[PROP_IMAGE_PREFETCH_ROWS]);
+}
+
+/**
+ * vte_terminal_get_image_prefetch_rows:
+ * @terminal: a #VteTerminal
+ *
+ * Get the number of rows above and below the view whose offscreen freezed
+ * images are thawed ahead of being shown
+ */
+glong
+vte_terminal_get_image_prefetch_rows(VteTerminal *terminal)
+{
+        g_return_val_if_fail(VTE_IS_TERMINAL(terminal), 0);
+
+        return IMPL(terminal)->m_image_prefetch_rows;
+}
+
 /**
  * vte_terminal_set_sixel_enabled:
  * @terminal: a #VteTerminal
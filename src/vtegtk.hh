@@ -42,6 +42,7 @@ enum {
         SIGNAL_HYPERLINK_HOVER_URI_CHANGED,
         SIGNAL_ICON_TITLE_CHANGED,
         SIGNAL_ICONIFY_WINDOW,
+        SIGNAL_IMAGE_MEMORY_CHANGED,
         SIGNAL_INCREASE_FONT_SIZE,
         SIGNAL_LOWER_WINDOW,
         SIGNAL_MAXIMIZE_WINDOW,
@@ -84,6 +85,8 @@ enum {
         PROP_FREEZED_IMAGE_LIMIT,
         PROP_HYPERLINK_HOVER_URI,
         PROP_ICON_TITLE,
+        PROP_IMAGE_MEMORY_USAGE,
+        PROP_IMAGE_PREFETCH_ROWS,
         PROP_INPUT_ENABLED,
         PROP_MOUSE_POINTER_AUTOHIDE,
         PROP_PTY,
@@ -17,6 +17,10 @@
 #include <config.h>
 #include <glib.h>
 #include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
 #include "vteimage.h"
 #include "vteinternal.hh"
 
@@ -24,26 +28,329 @@ namespace vte {
 
 namespace image {
 
+/* Rendering of image contents on a bounded pool of worker threads */
+
+#define VTE_IMAGE_RENDER_THREADS_MAX 4
+
+struct render_job {
+	render_func_t render;
+	cairo_surface_t *surface;   /* referenced; written by the worker until done */
+	GWeakRef widget;            /* to redraw when done */
+	GMutex lock;
+	GCond cond;
+	bool done;
+
+	render_job (render_func_t func, cairo_surface_t *s, GtkWidget *w)
+	: render (std::move (func)), surface (cairo_surface_reference (s)), done (false)
+	{
+		g_weak_ref_init (&widget, w);
+		g_mutex_init (&lock);
+		g_cond_init (&cond);
+	}
+
+	~render_job ()
+	{
+		cairo_surface_destroy (surface);
+		g_weak_ref_clear (&widget);
+		g_mutex_clear (&lock);
+		g_cond_clear (&cond);
+	}
+};
+
+static GThreadPool *render_pool = NULL;
+
+static gboolean
+render_job_notify (gpointer data)
+{
+	auto job = (std::shared_ptr<render_job> *)data;
+	auto widget = (GtkWidget *)g_weak_ref_get (&(*job)->widget);
+
+	if (widget) {
+		gtk_widget_queue_draw (widget);
+		g_object_unref (widget);
+	}
+	delete job;
+
+	return G_SOURCE_REMOVE;
+}
+
+static void
+render_job_run (gpointer data, gpointer user_data)
+{
+	auto job = (std::shared_ptr<render_job> *)data;
+
+	(*job)->render ((*job)->surface);
+	cairo_surface_mark_dirty ((*job)->surface);
+
+	g_mutex_lock (&(*job)->lock);
+	(*job)->done = true;
+	g_cond_broadcast (&(*job)->cond);
+	g_mutex_unlock (&(*job)->lock);
+
+	/* the main loop takes over our reference */
+	g_idle_add (render_job_notify, job);
+}
+
+/* Encoding of images for freezing them, on a worker thread */
+
+struct freeze_job {
+	std::shared_ptr<indexed_image const> indexed;
+	cairo_surface_t *surface;   /* a private copy of the pixels, unless indexed */
+	image_codec *codec;
+	std::vector<char> data;
+	bool ok;
+	int done;                   /* atomic; data and ok are set once it is */
+
+	freeze_job (std::shared_ptr<indexed_image const> i, image_codec *c)
+	: indexed (std::move (i)), surface (NULL), codec (c), ok (false), done (0)
+	{
+	}
+
+	freeze_job (cairo_surface_t *s, image_codec *c)
+	: surface (s), codec (c), ok (false), done (0)
+	{
+	}
+
+	~freeze_job ()
+	{
+		if (surface)
+			cairo_surface_destroy (surface);
+	}
+};
+
+static GThreadPool *freeze_pool = NULL;
+
+static void
+freeze_job_run (gpointer data, gpointer user_data)
+{
+	auto job = (std::shared_ptr<freeze_job> *)data;
+
+	if ((*job)->indexed)
+		(*job)->ok = (*job)->codec->encode_indexed (*(*job)->indexed, (*job)->data);
+	else
+		(*job)->ok = (*job)->codec->encode ((*job)->surface, (*job)->data);
+	g_atomic_int_set (&(*job)->done, 1);
+
+	delete job;
+}
+
+/* Decoding of frozen images ahead of painting them, on worker threads */
+
+struct thaw_job {
+	image_codec *codec;
+	std::vector<char> data;
+	std::shared_ptr<indexed_image const> indexed;  /* set once done, if the codec kept the image indexed */
+	cairo_surface_t *surface;   /* set once done, unless decoding failed */
+	GMutex lock;
+	GCond cond;
+	bool done;
+
+	thaw_job (image_codec *c, gsize len)
+	: codec (c), data (len), surface (NULL), done (false)
+	{
+		g_mutex_init (&lock);
+		g_cond_init (&cond);
+	}
+
+	~thaw_job ()
+	{
+		if (surface)
+			cairo_surface_destroy (surface);
+		g_mutex_clear (&lock);
+		g_cond_clear (&cond);
+	}
+};
+
+static GThreadPool *thaw_pool = NULL;
+
+static void
+thaw_job_run (gpointer data, gpointer user_data)
+{
+	auto job = (std::shared_ptr<thaw_job> *)data;
+	auto indexed = std::make_shared<indexed_image> ();
+
+	/* Indexed images get their surface here too, so painting them is cheap */
+	if ((*job)->codec->decode_indexed ((*job)->data.data (), (*job)->data.size (), *indexed)) {
+		(*job)->surface = indexed_image_to_surface (*indexed);
+		(*job)->indexed = std::move (indexed);
+	} else {
+		(*job)->surface = (*job)->codec->decode ((*job)->data.data (), (*job)->data.size ());
+	}
+
+	g_mutex_lock (&(*job)->lock);
+	(*job)->done = true;
+	g_cond_broadcast (&(*job)->cond);
+	g_mutex_unlock (&(*job)->lock);
+
+	delete job;
+}
+
+/*
+ * Indexed images get their ARGB32 surfaces when they're painted, which
+ * are kept for the most recently painted ones up to surface_cache_limit
+ * bytes. They count towards the image memory budget of the terminals,
+ * which trims the cache first when it's over. Images showing the same
+ * indexed image share one surface, which is counted once, and goes when
+ * the last of them lets go of it or it's trimmed from all of them.
+ */
+
+struct cached_surface {
+	cairo_surface_t *surface;   /* referenced by each of the users */
+	indexed_image const *indexed;
+	gsize size;
+	std::vector<image_object *> users;
+};
+
+static std::list<cached_surface> surface_cache;  /* most recently painted first */
+static gsize surface_cache_size = 0;
+static gsize surface_cache_limit = VTE_IMAGE_SURFACE_CACHE_SIZE;
+
+/* The cached surfaces by the indexed image they show, for sharing them */
+static std::unordered_multimap<indexed_image const *, std::list<cached_surface>::iterator> surface_cache_index;
+
+/* How many images hold each indexed image, to split its size between them */
+static std::unordered_map<indexed_image const *, gsize> indexed_users;
+
+/*
+ * Identical indexed images, e.g. a dashboard redrawn again and again, are
+ * kept once and shared: they're looked up here by their contents. The
+ * entries don't keep the images alive; the expired ones are swept out
+ * whenever the table doubled in size since the last time.
+ */
+static std::unordered_multimap<guint64, std::weak_ptr<indexed_image const>> interned_images;
+static gsize interned_swept_size = 0;
+
 /* image_object implementation */
-image_object::image_object (cairo_surface_t *surface, gint pixelwidth, gint pixelheight, gint col, gint row, gint w, gint h, _VteStream *stream)
+image_object::image_object (cairo_surface_t *surface, gint pixelwidth, gint pixelheight, gint col, gint row, gint w, gint h,
+                            gint cell_width, gint cell_height, image_store *store)
 {
 	m_pixelwidth = pixelwidth;
 	m_pixelheight = pixelheight;
+	m_cell_width = cell_width;
+	m_cell_height = cell_height;
 	m_left = col;
 	m_top = row;
 	m_width = w;
 	m_height = h;
 	m_surface = surface;
-	m_stream = stream;
+	m_store = store;
+	m_record = 0;
+	m_nwrite = 0;
+	m_codec = NULL;
+	m_cached = false;
+	m_cache_pinned = false;
+	m_frozen_copy = false;
+	m_scaled_surface = NULL;
+	m_last_used = g_get_monotonic_time ();
+	m_charged = 0;
+}
+
+image_object::image_object (std::shared_ptr<indexed_image const> indexed, gint col, gint row, gint w, gint h,
+                            gint cell_width, gint cell_height, image_store *store)
+	: image_object (NULL, indexed->width, indexed->height, col, row, w, h, cell_width, cell_height, store)
+{
+	set_indexed (std::move (indexed));
+}
+
+/* Replace the indexed image, keeping count of the images holding each */
+void
+image_object::set_indexed (std::shared_ptr<indexed_image const> indexed)
+{
+	if (m_indexed) {
+		auto it = indexed_users.find (m_indexed.get ());
+		if (--it->second == 0)
+			indexed_users.erase (it);
+	}
+
+	m_indexed = std::move (indexed);
+	if (m_indexed)
+		indexed_users[m_indexed.get ()]++;
+}
 
-	g_object_ref (m_stream);
+/* Return the indexed image already kept with the same contents, if any,
+ * or keep @indexed for the next ones
+ */
+std::shared_ptr<indexed_image const>
+image_object::intern (std::shared_ptr<indexed_image const> indexed)
+{
+	guint64 hash = indexed_image_hash (*indexed);
+	auto range = interned_images.equal_range (hash);
+
+	for (auto it = range.first; it != range.second; ++it) {
+		auto other = it->second.lock ();
+		if (other && indexed_image_equal (*other, *indexed))
+			return other;
+	}
+
+	if (interned_images.size () >= 2 * interned_swept_size + 64) {
+		for (auto it = interned_images.begin (); it != interned_images.end (); ) {
+			if (it->second.expired ())
+				it = interned_images.erase (it);
+			else
+				++it;
+		}
+		interned_swept_size = interned_images.size ();
+	}
+
+	interned_images.emplace (hash, indexed);
+	return indexed;
+}
+
+/*
+ * Cut an indexed image placed at (@col, @row) into tiles aligned to the grid
+ * of VTE_IMAGE_TILE_COLUMNS x VTE_IMAGE_TILE_ROWS cells. An image drawn over
+ * a part of it later only replaces, or thaws and draws into, the tiles it
+ * touches; the others stay as they are, frozen or not. Tiles identical to
+ * ones already kept share their pixels with them.
+ */
+std::vector<image_object *>
+image_object::create_tiles (std::shared_ptr<indexed_image const> indexed, gint col, gint row,
+                            gint char_width, gint char_height, image_store *store)
+{
+	std::vector<image_object *> tiles;
+	gint width = (indexed->width + char_width - 1) / char_width;
+	gint height = (indexed->height + char_height - 1) / char_height;
+	gint first_row = row - row % VTE_IMAGE_TILE_ROWS;
+	gint first_col = col - col % VTE_IMAGE_TILE_COLUMNS;
+
+	/* Small images keep their pixels as they are */
+	if (first_row + VTE_IMAGE_TILE_ROWS >= row + height &&
+	    first_col + VTE_IMAGE_TILE_COLUMNS >= col + width) {
+		tiles.push_back (new image_object (intern (std::move (indexed)), col, row, width, height,
+		                                   char_width, char_height, store));
+		return tiles;
+	}
+
+	for (gint r0 = first_row; r0 < row + height; r0 += VTE_IMAGE_TILE_ROWS) {
+		gint top = MAX (r0, row);
+		gint bottom = MIN (r0 + VTE_IMAGE_TILE_ROWS, row + height);
+		gint y = (top - row) * char_height;
+		gint tile_height = MIN ((bottom - row) * char_height, indexed->height) - y;
+
+		for (gint c0 = first_col; c0 < col + width; c0 += VTE_IMAGE_TILE_COLUMNS) {
+			gint left = MAX (c0, col);
+			gint right = MIN (c0 + VTE_IMAGE_TILE_COLUMNS, col + width);
+			gint x = (left - col) * char_width;
+			gint tile_width = MIN ((right - col) * char_width, indexed->width) - x;
+
+			auto tile = std::make_shared<indexed_image> ();
+			indexed_image_crop (*indexed, x, y, tile_width, tile_height, *tile);
+			tiles.push_back (new image_object (intern (std::move (tile)), left, top, right - left, bottom - top,
+			                                   char_width, char_height, store));
+		}
+	}
+
+	return tiles;
 }
 
 image_object::~image_object ()
 {
+	drop_scaled ();
+	cache_remove ();
+	set_indexed (NULL);
 	if (m_surface)
 		cairo_surface_destroy (m_surface);
-	g_object_unref (m_stream);
+	m_store->release (m_record);
 }
 
 glong
@@ -64,17 +371,49 @@ image_object::get_bottom () const
 	return (glong)(m_top + m_height - 1);
 }
 
-gulong
-image_object::get_stream_position () const
+gint
+image_object::get_width () const
+{
+	return m_width;
+}
+
+gint
+image_object::get_height () const
+{
+	return m_height;
+}
+
+gint
+image_object::get_pixelwidth () const
+{
+	return m_pixelwidth;
+}
+
+gint
+image_object::get_pixelheight () const
+{
+	return m_pixelheight;
+}
+
+/* When the image was last painted, for evicting the least recently used ones */
+gint64
+image_object::get_last_used () const
 {
-	return m_position;
+	return m_last_used;
 }
 
-/* Indicate whether the image is serialized to the stream */
+/* Indicate whether the image is serialized to the store */
 bool
 image_object::is_freezed () const
 {
-	return (m_surface == NULL);
+	return (m_surface == NULL && ! m_indexed);
+}
+
+/* The record of the frozen copy in the store, 0 if none */
+guint64
+image_object::get_record () const
+{
+	return m_record;
 }
 
 /* Test whether this image includes given image */
@@ -95,10 +434,18 @@ image_object::resource_size () const
 	size_t result_size;
 
 	if (is_freezed ()) {
-		/* If freezed, return the size sent to VteBoa.
+		/* If freezed, return the size sent to VteBoa, split between
+                 * the images sharing the record.
                  * In reality, it may be more compressed on the real storage.
                  */
-		result_size = m_nwrite;
+		result_size = m_nwrite / MAX (m_store->get_refs (m_record), 1u);
+	} else if (m_indexed) {
+		/* If indexed, return the size of the indices and palette,
+                 * split between the images sharing them;
+                 * the surface cache is accounted for as a whole.
+                 */
+		auto it = indexed_users.find (m_indexed.get ());
+		result_size = m_indexed->resource_size () / (it != indexed_users.end () ? it->second : 1);
 	} else {
 		/* If not freezed, return the pixel buffer size
                  * width x height x 4
@@ -106,56 +453,313 @@ image_object::resource_size () const
 		result_size = m_pixelwidth * m_pixelheight * 4;
 	}
 
+	/* Plus the pixels resampled for painting, if any */
+	if (m_scaled_surface)
+		result_size += (size_t)cairo_image_surface_get_stride (m_scaled_surface) *
+		               cairo_image_surface_get_height (m_scaled_surface);
+
 	return result_size;
 }
 
+/*
+ * What the image is charged in the counters of its ring. What images
+ * sharing their pixels or frozen copy take changes as the others come and
+ * go, not only with what's done to the image, so the counters take away
+ * the size they were charged, and charge() again for the current one.
+ */
+size_t
+image_object::get_charged_size () const
+{
+	return m_charged;
+}
+
+size_t
+image_object::charge ()
+{
+	m_charged = resource_size ();
+	return m_charged;
+}
+
 /* Deserialize the cairo image from the temporary file */
 bool
 image_object::thaw ()
 {
-	if (m_surface)
+	/* Take over a thaw in progress */
+	if (m_thaw_job)
+		thaw_finish (true);
+
+	if (! is_freezed ())
 		return true;
-	if (m_position < _vte_stream_tail (m_stream))
+	std::vector<char> data (m_nwrite);
+	if (! m_store->read (m_record, data.data (), m_nwrite))
 		return false;
 
-	m_nread = 0;
-	m_surface = cairo_image_surface_create_from_png_stream ((cairo_read_func_t)read_callback, this);
+	/* Stay indexed if the codec can */
+	auto indexed = std::make_shared<indexed_image> ();
+	if (m_codec->decode_indexed (data.data (), m_nwrite, *indexed)) {
+		set_indexed (intern (std::move (indexed)));
+		m_store->set_source (m_record, m_indexed);
+		m_frozen_copy = true;
+		return true;
+	}
+
+	m_surface = m_codec->decode (data.data (), m_nwrite);
 	if (! m_surface)
 		return false;
 
+	m_frozen_copy = true;
 	return true;
 }
 
+/*
+ * Start decoding a frozen image on a worker thread, ahead of it being
+ * painted; thaw_finish() or thaw() takes the result. Returns false if
+ * the image can't be read back.
+ */
+bool
+image_object::thaw_async ()
+{
+	if (! is_freezed () || m_thaw_job)
+		return true;
+	auto job = std::make_shared<thaw_job> (m_codec, m_nwrite);
+	if (! m_store->read (m_record, job->data.data (), m_nwrite))
+		return false;
+
+	if (thaw_pool == NULL)
+		thaw_pool = g_thread_pool_new (thaw_job_run, NULL,
+		                               MIN (g_get_num_processors (), VTE_IMAGE_RENDER_THREADS_MAX),
+		                               FALSE, NULL);
+
+	m_thaw_job = job;
+	g_thread_pool_push (thaw_pool, new std::shared_ptr<thaw_job> (job), NULL);
+
+	return true;
+}
+
+/*
+ * Take the result of thaw_async(), waiting for it if @wait. Returns false
+ * if it's not done yet; if decoding failed the image stays frozen.
+ */
+bool
+image_object::thaw_finish (bool wait)
+{
+	if (! m_thaw_job)
+		return true;
+
+	g_mutex_lock (&m_thaw_job->lock);
+	while (wait && ! m_thaw_job->done)
+		g_cond_wait (&m_thaw_job->cond, &m_thaw_job->lock);
+	bool done = m_thaw_job->done;
+	g_mutex_unlock (&m_thaw_job->lock);
+
+	if (! done)
+		return false;
+
+	auto job = std::move (m_thaw_job);
+	if (job->surface) {
+		if (job->indexed) {
+			set_indexed (intern (std::move (job->indexed)));
+			m_store->set_source (m_record, m_indexed);
+		}
+		m_surface = job->surface;
+		job->surface = NULL;
+		m_frozen_copy = true;
+		if (m_indexed)
+			cache_touch ();
+	}
+
+	return true;
+}
+
+void
+image_object::cancel_thaw ()
+{
+	m_thaw_job.reset ();
+}
+
+bool
+image_object::is_thawing () const
+{
+	return (bool)m_thaw_job;
+}
+
 /* Serialize the image for saving RAM */
 void
 image_object::freeze ()
 {
-	cairo_status_t status;
+	image_codec *codec = image_codec_get_default ();
+	std::vector<char> data;
 	double x_scale, y_scale;
 
-	if (! m_surface)
+	if (is_freezed ())
 		return;
 
-	m_position = _vte_stream_head (m_stream);
-	m_nwrite = 0;
+	wait_rendered ();
+	cancel_freeze ();
 
-	cairo_surface_get_device_scale (m_surface, &x_scale, &y_scale);
-	if (x_scale != 1.0 || y_scale != 1.0) {
-		/* If device scale exceeds 1.0, large size of PNG image created with cairo_surface_write_to_png_stream()
-                 * So we need to convert m_surface into an image surface with resizing it.
-                 */
-		cairo_surface_t *image_surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, m_pixelwidth, m_pixelheight);
-		cairo_t *cr = cairo_create (image_surface);
-		paint (cr, 0, 0);
-		cairo_destroy (cr);
-		cairo_surface_destroy (m_surface);
-		m_surface = image_surface;
+	/* Unchanged since it was thawed, the store still has it */
+	if (m_frozen_copy && m_store->contains (m_record)) {
+		drop_pixels ();
+		return;
+	}
+
+	if (freeze_shared ())
+		return;
+
+	if (m_indexed) {
+		if (! codec->encode_indexed (*m_indexed, data))
+			return;
+	} else {
+		cairo_surface_get_device_scale (m_surface, &x_scale, &y_scale);
+		if (x_scale != 1.0 || y_scale != 1.0 || cairo_surface_get_type (m_surface) != CAIRO_SURFACE_TYPE_IMAGE) {
+			/* If device scale exceeds 1.0, the codecs would store the image in device pixels,
+			 * and they only deal with image surfaces. So convert m_surface into an image surface
+			 * with resizing it.
+			 */
+			cairo_surface_t *image_surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, m_pixelwidth, m_pixelheight);
+			cairo_t *cr = cairo_create (image_surface);
+			paint (cr, 0, 0, m_cell_width, m_cell_height);
+			cairo_destroy (cr);
+			cairo_surface_destroy (m_surface);
+			m_surface = image_surface;
+		}
+
+		if (! codec->encode (m_surface, data))
+			return;
 	}
-	status = cairo_surface_write_to_png_stream (m_surface, (cairo_write_func_t)write_callback, this);
-	if (status == CAIRO_STATUS_SUCCESS) {
+
+	freeze_commit (codec, data);
+}
+
+/*
+ * Take the frozen copy of another image showing the same indexed pixels,
+ * if there's one, and let go of the pixels. So identical images are only
+ * encoded and written once. The records are all written with the default
+ * codec.
+ */
+bool
+image_object::freeze_shared ()
+{
+	guint64 id = m_indexed ? m_store->lookup (m_indexed) : 0;
+
+	if (id == 0)
+		return false;
+
+	if (id != m_record) {
+		m_store->release (m_record);
+		m_record = m_store->ref (id);
+	}
+	m_nwrite = m_store->get_length (id);
+	m_codec = image_codec_get_default ();
+
+	drop_pixels ();
+	return true;
+}
+
+/* Write the encoded image to the store, in place of an outdated copy,
+ * and let go of the pixels */
+void
+image_object::freeze_commit (image_codec *codec, std::vector<char> const &data)
+{
+	/* Another image with the same pixels was frozen meanwhile */
+	if (freeze_shared ())
+		return;
+
+	m_store->release (m_record);
+	m_record = m_store->append (data.data (), data.size ());
+	if (m_indexed)
+		m_store->set_source (m_record, m_indexed);
+	m_nwrite = data.size ();
+	m_codec = codec;
+
+	drop_pixels ();
+}
+
+/* Let go of the pixels of an image whose frozen copy is current */
+void
+image_object::drop_pixels ()
+{
+	drop_scaled ();
+	drop_indexed ();
+	if (m_surface)
 		cairo_surface_destroy (m_surface);
-		m_surface = NULL;
+	m_surface = NULL;
+	m_frozen_copy = true;
+}
+
+/*
+ * Start encoding the image on a worker thread; freeze_finish() completes
+ * the freeze once that's done. An image that isn't indexed is encoded from
+ * a copy of its surface, at device scale 1 like freeze() does. Returns
+ * false if the image needs no encoding, and freeze() is quick.
+ */
+bool
+image_object::freeze_async ()
+{
+	cairo_surface_t *copy = NULL;
+
+	if (m_freeze_job)
+		return true;
+	/* Not worth a worker if the store already has it */
+	if (is_freezed () || m_frozen_copy || (m_indexed && m_store->lookup (m_indexed)))
+		return false;
+
+	if (! m_indexed) {
+		wait_rendered ();
+		if (m_surface == NULL)
+			return false;
+
+		copy = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, m_pixelwidth, m_pixelheight);
+		cairo_t *cr = cairo_create (copy);
+		cairo_set_source_surface (cr, m_surface, 0, 0);
+		cairo_paint (cr);
+		cairo_destroy (cr);
 	}
+
+	if (freeze_pool == NULL)
+		freeze_pool = g_thread_pool_new (freeze_job_run, NULL, 1, FALSE, NULL);
+
+	if (copy)
+		m_freeze_job = std::make_shared<freeze_job> (copy, image_codec_get_default ());
+	else
+		m_freeze_job = std::make_shared<freeze_job> (m_indexed, image_codec_get_default ());
+	g_thread_pool_push (freeze_pool, new std::shared_ptr<freeze_job> (m_freeze_job), NULL);
+
+	return true;
+}
+
+/*
+ * Complete a freeze started by freeze_async(). Returns false while the
+ * image is still being encoded; if encoding failed the image stays as it was.
+ */
+bool
+image_object::freeze_finish ()
+{
+	if (! m_freeze_job)
+		return true;
+	if (! g_atomic_int_get (&m_freeze_job->done))
+		return false;
+
+	auto job = std::move (m_freeze_job);
+	if (job->ok)
+		freeze_commit (job->codec, job->data);
+
+	return true;
+}
+
+/* Forget a freeze in progress, e.g. when the image is visible again; the
+ * worker's result is dropped when it's done
+ */
+void
+image_object::cancel_freeze ()
+{
+	m_freeze_job.reset ();
+}
+
+bool
+image_object::is_freezing () const
+{
+	return (bool)m_freeze_job;
 }
 
 /* Merge another image into this image */
@@ -169,6 +773,11 @@ image_object::combine (image_object *other, gulong char_width, gulong char_heigh
 	gulong offsetx = (other->m_left - m_left) * char_width;
 	gulong offsety = (other->m_top - m_top) * char_height;
 
+	wait_rendered ();
+	other->wait_rendered ();
+	/* An encoding in progress would freeze the pixels from before */
+	cancel_freeze ();
+
 	if (is_freezed ())
 		if (! thaw ())
 			return false;
@@ -177,6 +786,19 @@ image_object::combine (image_object *other, gulong char_width, gulong char_heigh
 		if (! other->thaw ())
 			return false;
 
+	/* Giving one its surface mustn't drop the other's from the cache */
+	m_cache_pinned = other->m_cache_pinned = true;
+	bool ok = materialize (NULL) && other->materialize (NULL);
+	m_cache_pinned = other->m_cache_pinned = false;
+	if (! ok || m_surface == NULL || other->m_surface == NULL)
+		return false;
+
+	/* From now on the surface holds the pixels */
+	drop_indexed ();
+	drop_scaled ();
+	if (! unshare_surface ())
+		return false;
+
 	cr = cairo_create (m_surface);
 	cairo_rectangle (cr, offsetx, offsety, m_pixelwidth, m_pixelheight);
 	cairo_clip (cr);
@@ -187,87 +809,380 @@ image_object::combine (image_object *other, gulong char_width, gulong char_heigh
 	return true;
 }
 
+/*
+ * Paint the image into given cairo rendering context, for cells of the given
+ * size. Images made for another cell size, e.g. before the font scale changed,
+ * or painted at a device scale, are resampled once and kept like that.
+ */
 bool
-image_object::unite (image_object *other, gulong char_width, gulong char_height)
+image_object::paint (cairo_t *cr, gint offsetx, gint offsety, gint cell_width, gint cell_height)
 {
+	cairo_surface_t *surface;
+	double x_ratio = (double)cell_width / m_cell_width;
+	double y_ratio = (double)cell_height / m_cell_height;
+
+	if (is_rendering ())
+		return false;
+
+	m_last_used = g_get_monotonic_time ();
+
 	if (is_freezed ())
 		if (! thaw ())
 			return false;
 
-	gint new_left = std::min (m_left, other->m_left);
-	gint new_top = std::min (m_top, other->m_top);
-	gint new_width = std::max (m_left + m_width, other->m_left + other->m_width) - new_left;
-	gint new_height = std::max (m_top + m_height, other->m_top + other->m_width) - new_top;
-	gint pixelwidth = new_width * char_width;
-	gint pixelheight = new_height * char_height;
-	gint offsetx = (m_left - new_left) * char_width;
-	gint offsety = (m_top - new_top) * char_height;
-
-	cairo_surface_t * new_surface = cairo_surface_create_similar (other->m_surface, CAIRO_CONTENT_COLOR_ALPHA, m_pixelwidth, m_pixelheight);
-	cairo_t *cr = cairo_create (new_surface);
-	cairo_rectangle (cr, offsetx, offsety, m_pixelwidth, m_pixelheight);
+	if (! materialize (NULL))
+		return false;
+
+	surface = get_scaled_surface (cr, cell_width, cell_height);
+
+	cairo_save (cr);
+	cairo_rectangle (cr, offsetx, offsety, m_pixelwidth * x_ratio, m_pixelheight * y_ratio);
 	cairo_clip (cr);
-	cairo_set_source_surface (cr, m_surface, offsetx, offsety);
+	if (surface == m_surface && (x_ratio != 1.0 || y_ratio != 1.0)) {
+		/* Couldn't keep a resampled copy */
+		cairo_translate (cr, offsetx, offsety);
+		cairo_scale (cr, x_ratio, y_ratio);
+		cairo_set_source_surface (cr, m_surface, 0, 0);
+	} else {
+		cairo_set_source_surface (cr, surface, offsetx, offsety);
+	}
 	cairo_paint (cr);
-	cairo_destroy (cr);
+	cairo_restore (cr);
 
-	cairo_surface_destroy (m_surface);
+	return true;
+}
+
+/* The surface to paint for the given cell size, at the device scale of @cr */
+cairo_surface_t *
+image_object::get_scaled_surface (cairo_t *cr, gint cell_width, gint cell_height)
+{
+	double x_scale, y_scale;
+	double x_ratio = (double)cell_width / m_cell_width;
+	double y_ratio = (double)cell_height / m_cell_height;
+
+	cairo_surface_get_device_scale (cairo_get_target (cr), &x_scale, &y_scale);
+
+	if (x_ratio == 1.0 && y_ratio == 1.0 && x_scale == 1.0 && y_scale == 1.0) {
+		drop_scaled ();
+		return m_surface;
+	}
+
+	if (m_scaled_surface &&
+	    m_scaled_cell_width == cell_width && m_scaled_cell_height == cell_height &&
+	    m_scaled_x_scale == x_scale && m_scaled_y_scale == y_scale)
+		return m_scaled_surface;
+
+	drop_scaled ();
+
+	cairo_surface_t *scaled = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+	                                                      (int)ceil (m_pixelwidth * x_ratio * x_scale),
+	                                                      (int)ceil (m_pixelheight * y_ratio * y_scale));
+	if (cairo_surface_status (scaled) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy (scaled);
+		return m_surface;
+	}
+	cairo_surface_set_device_scale (scaled, x_scale, y_scale);
+
+	cairo_t *scaled_cr = cairo_create (scaled);
+	cairo_scale (scaled_cr, x_ratio, y_ratio);
+	cairo_set_source_surface (scaled_cr, m_surface, 0, 0);
+	cairo_pattern_set_filter (cairo_get_source (scaled_cr), CAIRO_FILTER_GOOD);
+	cairo_paint (scaled_cr);
+	cairo_destroy (scaled_cr);
+
+	m_scaled_surface = scaled;
+	m_scaled_cell_width = cell_width;
+	m_scaled_cell_height = cell_height;
+	m_scaled_x_scale = x_scale;
+	m_scaled_y_scale = y_scale;
+
+	return m_scaled_surface;
+}
+
+void
+image_object::drop_scaled ()
+{
+	if (m_scaled_surface == NULL)
+		return;
+
+	cairo_surface_destroy (m_scaled_surface);
+	m_scaled_surface = NULL;
+}
+
+/*
+ * Render the image contents on a worker thread. Until that's done the
+ * image paints nothing, and anything else needing its pixels waits for it.
+ */
+void
+image_object::render_async (render_func_t render, GtkWidget *widget)
+{
+	g_assert_true (m_surface != NULL);
+	g_assert_true (! m_job);
+
+	if (render_pool == NULL)
+		render_pool = g_thread_pool_new (render_job_run, NULL,
+		                                 MIN (g_get_num_processors (), VTE_IMAGE_RENDER_THREADS_MAX),
+		                                 FALSE, NULL);
+
+	m_job = std::make_shared<render_job> (std::move (render), m_surface, widget);
+	g_thread_pool_push (render_pool, new std::shared_ptr<render_job> (m_job), NULL);
+}
+
+bool
+image_object::is_rendering ()
+{
+	bool done;
+
+	if (! m_job)
+		return false;
+
+	g_mutex_lock (&m_job->lock);
+	done = m_job->done;
+	g_mutex_unlock (&m_job->lock);
+
+	if (done)
+		m_job.reset ();
+
+	return ! done;
+}
+
+void
+image_object::wait_rendered ()
+{
+	if (! m_job)
+		return;
+
+	g_mutex_lock (&m_job->lock);
+	while (! m_job->done)
+		g_cond_wait (&m_job->cond, &m_job->lock);
+	g_mutex_unlock (&m_job->lock);
+
+	m_job.reset ();
+}
+
+/* Replace the image contents and size, e.g. while it's still being decoded */
+void
+image_object::update (cairo_surface_t *surface, gint pixelwidth, gint pixelheight, gint w, gint h)
+{
+	g_assert_true (surface != NULL);
+
+	wait_rendered ();
+	drop_indexed ();
+	drop_scaled ();
+
+	if (surface != m_surface) {
+		if (m_surface)
+			cairo_surface_destroy (m_surface);
+		m_surface = surface;
+	}
 
-	m_left = new_left;
-	m_top = new_top;
-	m_width = new_width;
-	m_height = new_height;
 	m_pixelwidth = pixelwidth;
 	m_pixelheight = pixelheight;
-	m_surface = new_surface;
+	m_width = w;
+	m_height = h;
+}
+
+/*
+ * Give an indexed image its ARGB32 surface, if it doesn't have one.
+ * Large images are expanded on a worker thread if there's a widget
+ * to redraw when done. Returns whether the surface can be painted.
+ */
+bool
+image_object::materialize (GtkWidget *widget)
+{
+	if (! m_indexed)
+		return m_surface != NULL && ! is_rendering ();
+
+	if (m_surface == NULL && ! share_surface ()) {
+		if (widget && (gsize)m_pixelwidth * m_pixelheight >= VTE_SIXEL_ASYNC_RENDER_MIN_PIXELS) {
+			m_surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, m_indexed->width, m_indexed->height);
+			if (cairo_surface_status (m_surface) != CAIRO_STATUS_SUCCESS) {
+				cairo_surface_destroy (m_surface);
+				m_surface = NULL;
+				return false;
+			}
+			render_async ([indexed = m_indexed] (cairo_surface_t *s) {
+			                      cairo_surface_flush (s);
+			                      indexed_image_expand (*indexed,
+			                                            cairo_image_surface_get_data (s),
+			                                            cairo_image_surface_get_stride (s));
+			              },
+			              widget);
+		} else {
+			m_surface = indexed_image_to_surface (*m_indexed);
+			if (m_surface == NULL)
+				return false;
+		}
+	}
+
+	cache_touch ();
 
-	return combine (other, char_width, char_height);
+	return ! is_rendering ();
 }
 
-/* Paint the image into given cairo rendering context */
+/* Whether one of the images using the cached surface is rendering into it */
+static bool
+cached_surface_rendering (cached_surface const &entry)
+{
+	for (auto image : entry.users)
+		if (image->is_rendering ())
+			return true;
+	return false;
+}
+
+static bool
+cached_surface_pinned (cached_surface const &entry)
+{
+	for (auto image : entry.users)
+		if (image->is_cache_pinned ())
+			return true;
+	return false;
+}
+
+/* Take the cached surface of another image showing the same indexed
+ * image, if one has it ready
+ */
 bool
-image_object::paint (cairo_t *cr, gint offsetx, gint offsety)
+image_object::share_surface ()
 {
-	if (is_freezed ())
-		if (! thaw ())
-			return false;
+	auto range = surface_cache_index.equal_range (m_indexed.get ());
 
-	cairo_save (cr);
-	cairo_rectangle (cr, offsetx, offsety, m_pixelwidth, m_pixelheight);
-	cairo_clip (cr);
-	cairo_set_source_surface (cr, m_surface, offsetx, offsety);
+	for (auto it = range.first; it != range.second; ++it) {
+		auto entry = it->second;
+		if (cached_surface_rendering (*entry))
+			continue;
+
+		m_surface = cairo_surface_reference (entry->surface);
+		entry->users.push_back (this);
+		m_cache_link = entry;
+		m_cached = true;
+		return true;
+	}
+
+	return false;
+}
+
+/* Make the surface this image's own before drawing into it */
+bool
+image_object::unshare_surface ()
+{
+	if (cairo_surface_get_reference_count (m_surface) <= 1)
+		return true;
+
+	cairo_surface_t *copy = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, m_pixelwidth, m_pixelheight);
+	if (cairo_surface_status (copy) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy (copy);
+		return false;
+	}
+
+	cairo_t *cr = cairo_create (copy);
+	cairo_set_source_surface (cr, m_surface, 0, 0);
 	cairo_paint (cr);
-	cairo_restore (cr);
+	cairo_destroy (cr);
+
+	cairo_surface_destroy (m_surface);
+	m_surface = copy;
 
 	return true;
 }
 
-/* callback routines for stream I/O */
+/* Forget the indexed pixels, e.g. when the surface is drawn into */
+void
+image_object::drop_indexed ()
+{
+	m_frozen_copy = false;
+	cancel_freeze ();
+	cache_remove ();
+	set_indexed (NULL);
+}
+
+/* Move the surface of an indexed image to the front of the cache */
+void
+image_object::cache_touch ()
+{
+	if (m_cached) {
+		surface_cache.splice (surface_cache.begin (), surface_cache, m_cache_link);
+		return;
+	}
+
+	surface_cache.push_front ({ m_surface, m_indexed.get (), (gsize)m_pixelwidth * m_pixelheight * 4, { this } });
+	m_cache_link = surface_cache.begin ();
+	m_cached = true;
+	surface_cache_size += m_cache_link->size;
+	surface_cache_index.emplace (m_indexed.get (), m_cache_link);
+
+	cache_trim (surface_cache_limit);
+}
 
-cairo_status_t
-image_object::read_callback (void *closure, char *data, unsigned int length)
+/* Stop using the cached surface; it's dropped from the cache with its last user */
+void
+image_object::cache_remove ()
 {
-	image_object *image = (image_object *)closure;
+	if (! m_cached)
+		return;
 
-	g_assert_true (image != NULL);
+	auto entry = m_cache_link;
+	m_cached = false;
 
-	_vte_stream_read (image->m_stream, image->m_position + image->m_nread, data, length);
-	image->m_nread += length;
+	auto &users = entry->users;
+	users.erase (std::find (users.begin (), users.end (), this));
+	if (! users.empty ())
+		return;
 
-	return CAIRO_STATUS_SUCCESS;
+	surface_cache_size -= entry->size;
+	auto range = surface_cache_index.equal_range (entry->indexed);
+	for (auto it = range.first; it != range.second; ++it) {
+		if (it->second == entry) {
+			surface_cache_index.erase (it);
+			break;
+		}
+	}
+	surface_cache.erase (entry);
 }
 
-cairo_status_t
-image_object::write_callback (void *closure, const char *data, unsigned int length)
+bool
+image_object::is_cache_pinned () const
 {
-	image_object *image = (image_object *)closure;
+	return m_cache_pinned;
+}
 
-	g_assert_true (image != NULL);
+/* Bytes of the surfaces of indexed images, in all terminals */
+gsize
+image_object::get_cache_size ()
+{
+	return surface_cache_size;
+}
 
-	_vte_stream_append (image->m_stream, data, length);
-	image->m_nwrite += length;
+/* Keep the surface cache within @limit, e.g. the image memory budget */
+void
+image_object::set_cache_limit (gsize limit)
+{
+	surface_cache_limit = MIN (limit, (gsize)VTE_IMAGE_SURFACE_CACHE_SIZE);
+	cache_trim (surface_cache_limit);
+}
 
-	return CAIRO_STATUS_SUCCESS;
+/* Drop the least recently painted surfaces from all their users until the
+ * cache takes at most @size bytes, but never the most recent one, nor those
+ * still being rendered or pinned by a combine
+ */
+void
+image_object::cache_trim (gsize size)
+{
+	auto it = surface_cache.end ();
+
+	while (surface_cache_size > size && --it != surface_cache.begin ()) {
+		if (cached_surface_rendering (*it) || cached_surface_pinned (*it))
+			continue;
+
+		/* The last user to leave takes the entry with it */
+		auto users = it->users;
+		++it;
+		for (auto image : users) {
+			image->cache_remove ();
+			cairo_surface_destroy (image->m_surface);
+			image->m_surface = NULL;
+		}
+	}
 }
 
 } // namespace image
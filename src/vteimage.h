@@ -16,44 +16,113 @@
 
 #pragma once
 
+#include <functional>
+#include <list>
+#include <memory>
+#include <vector>
+
+#include <gtk/gtk.h>
 #include <pango/pangocairo.h>
-#include "vtestream.h"
+#include "vteimagestore.h"
+#include "vteimagecodec.h"
 
 namespace vte {
 
 namespace image {
 
+/* Draws the image contents into the surface; called on a worker thread */
+typedef std::function<void (cairo_surface_t *surface)> render_func_t;
+
+struct render_job;
+struct freeze_job;
+struct thaw_job;
+struct cached_surface;
+
 struct image_object {
 private:
 	gint m_left;                /* left position in cell unit at the vte virtual screen */
 	gint m_width;               /* width in cell unit */
 	gint m_top;                 /* top position in cell unit at the vte virtual screen */
 	gint m_height;              /* height in cell unit */
-	VteStream *m_stream;        /* NULL if it's serialized */
+	image_store *m_store;       /* where the image is frozen; outlives it */
 	gint m_pixelwidth;          /* image width in pixels */
 	gint m_pixelheight;         /* image hieght in pixels */
-	gulong m_position;          /* indicates the position at the stream if it's serialized */
-	size_t m_nread;             /* private use: for read callback */
-	size_t m_nwrite;            /* private use: for write callback */
+	gint m_cell_width;          /* cell size in pixels the image was made for */
+	gint m_cell_height;
+	guint64 m_record;           /* the frozen copy in m_store, 0 if none */
+	size_t m_nwrite;            /* size of the frozen copy */
+	image_codec *m_codec;       /* the codec the image was serialized with */
 	cairo_surface_t *m_surface; /* internal cairo image */
+	std::shared_ptr<indexed_image const> m_indexed; /* if set, m_surface only caches its pixels */
+	std::list<cached_surface>::iterator m_cache_link; /* the surface cache entry for m_surface, if m_cached */
+	bool m_cached;              /* whether m_surface is in the surface cache */
+	bool m_cache_pinned;        /* whether the surface mustn't be dropped from the cache */
+	std::shared_ptr<render_job> m_job; /* set while the surface may still be rendered into */
+	std::shared_ptr<freeze_job> m_freeze_job; /* set while the image is encoded for freezing */
+	std::shared_ptr<thaw_job> m_thaw_job; /* set while the frozen image is decoded ahead of time */
+	bool m_frozen_copy;         /* whether the store has the current pixels, so freezing is free */
+	cairo_surface_t *m_scaled_surface; /* the pixels resampled for the cell size and device scale below */
+	gint m_scaled_cell_width;
+	gint m_scaled_cell_height;
+	double m_scaled_x_scale;
+	double m_scaled_y_scale;
+	gint64 m_last_used;         /* monotonic time the image was created or last painted */
+	size_t m_charged;           /* resource_size() as of the last charge() */
+	void wait_rendered ();
+	bool freeze_shared ();
+	void freeze_commit (image_codec *codec, std::vector<char> const &data);
+	void drop_pixels ();
+	cairo_surface_t *get_scaled_surface (cairo_t *cr, gint cell_width, gint cell_height);
+	void drop_scaled ();
+	void cache_touch ();
+	void cache_remove ();
+	void set_indexed (std::shared_ptr<indexed_image const> indexed);
+	void drop_indexed ();
+	bool share_surface ();
+	bool unshare_surface ();
 public:
-	explicit image_object (cairo_surface_t *surface, gint pixelwidth, gint pixelheight, gint col, gint row, gint w, gint h, _VteStream *stream);
+	explicit image_object (cairo_surface_t *surface, gint pixelwidth, gint pixelheight, gint col, gint row, gint w, gint h,
+	                       gint cell_width, gint cell_height, image_store *store);
+	explicit image_object (std::shared_ptr<indexed_image const> indexed, gint col, gint row, gint w, gint h,
+	                       gint cell_width, gint cell_height, image_store *store);
 	~image_object ();
+	static std::shared_ptr<indexed_image const> intern (std::shared_ptr<indexed_image const> indexed);
+	static std::vector<image_object *> create_tiles (std::shared_ptr<indexed_image const> indexed, gint col, gint row,
+	                                                 gint char_width, gint char_height, image_store *store);
+	static gsize get_cache_size ();
+	static void set_cache_limit (gsize limit);
+	static void cache_trim (gsize size);
 	glong get_left () const;
 	glong get_top () const;
 	glong get_bottom () const;
-	gulong get_stream_position () const;
+	gint get_width () const;
+	gint get_height () const;
+	gint get_pixelwidth () const;
+	gint get_pixelheight () const;
+	gint64 get_last_used () const;
 	bool is_freezed () const;
+	guint64 get_record () const;
 	bool includes (const image_object *rhs) const;
 	size_t resource_size () const;
+	size_t get_charged_size () const;
+	size_t charge ();
 	void freeze ();
+	bool freeze_async ();
+	bool freeze_finish ();
+	void cancel_freeze ();
+	bool is_freezing () const;
 	bool thaw ();
+	bool thaw_async ();
+	bool thaw_finish (bool wait);
+	void cancel_thaw ();
+	bool is_thawing () const;
 	bool combine (image_object *rhs, gulong char_width, gulong char_height);
-	bool unite (image_object *rhs, gulong char_width, gulong char_height);
-	bool paint (cairo_t *cr, gint offsetx, gint offsety);
-public:
-	static cairo_status_t read_callback (void *closure, char *data, unsigned int length);
-	static cairo_status_t write_callback (void *closure, const char *data, unsigned int length);
+	bool paint (cairo_t *cr, gint offsetx, gint offsety, gint cell_width, gint cell_height);
+	bool materialize (GtkWidget *widget);
+	void update (cairo_surface_t *surface, gint pixelwidth, gint pixelheight, gint w, gint h);
+	bool is_rendering ();
+	bool is_cache_pinned () const;
+	void render_async (render_func_t render, GtkWidget *widget);
 };
 
 } // namespace image
@@ -0,0 +1,333 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <cairo.h>
+#include <string.h>
+
+#include <vector>
+
+#include "vteimagecodec.h"
+
+using namespace vte::image;
+
+static void
+assert_lz_roundtrip(std::vector<guint8> const& data)
+{
+        auto compressed = std::vector<guint8>(image_lz_compress_bound(data.size()));
+        auto len = image_lz_compress(data.data(), data.size(), compressed.data());
+        g_assert_cmpuint(len, <=, compressed.size());
+
+        auto decompressed = std::vector<guint8>(data.size());
+        g_assert_true(image_lz_decompress(compressed.data(), len, decompressed.data(), decompressed.size()));
+        g_assert_true(decompressed == data);
+
+        /* Truncated blocks and wrong sizes are rejected */
+        if (data.empty())
+                return;
+        g_assert_false(image_lz_decompress(compressed.data(), len - 1, decompressed.data(), decompressed.size()));
+        g_assert_false(image_lz_decompress(compressed.data(), len, decompressed.data(), decompressed.size() / 2));
+}
+
+static void
+test_lz_roundtrip(void)
+{
+        auto rand = g_rand_new_with_seed(2);
+
+        assert_lz_roundtrip({});
+        assert_lz_roundtrip({1, 2, 3});
+
+        /* Runs of one byte, with overlapping matches */
+        auto runs = std::vector<guint8>(100000);
+        for (auto i = 0u; i < runs.size(); ++i)
+                runs[i] = (i / 1000) & 3;
+        assert_lz_roundtrip(runs);
+
+        /* Incompressible */
+        auto noise = std::vector<guint8>(70000);
+        for (auto& b : noise)
+                b = g_rand_int_range(rand, 0, 256);
+        assert_lz_roundtrip(noise);
+
+        /* Long literal runs between long matches */
+        auto mixed = std::vector<guint8>(200000);
+        for (auto i = 0u; i < mixed.size(); ++i)
+                mixed[i] = (i / 3000) & 1 ? g_rand_int_range(rand, 0, 256) : 7;
+        assert_lz_roundtrip(mixed);
+
+        g_rand_free(rand);
+}
+
+/* Creates an image with @ncolors distinct colours in runs of @run pixels */
+static cairo_surface_t*
+create_image(int width,
+             int height,
+             int ncolors,
+             int run)
+{
+        auto surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+        auto const stride = cairo_image_surface_get_stride(surface);
+        auto data = cairo_image_surface_get_data(surface);
+
+        for (auto y = 0; y < height; ++y) {
+                auto row = (guint32*)(data + y * stride);
+                for (auto x = 0; x < width; ++x)
+                        row[x] = 0xff000000u | (((y * width + x) / run % ncolors) * 0x010203u & 0xffffff);
+        }
+        cairo_surface_mark_dirty(surface);
+
+        return surface;
+}
+
+static void
+assert_same_image(cairo_surface_t* a,
+                  cairo_surface_t* b)
+{
+        auto const width = cairo_image_surface_get_width(a);
+        auto const height = cairo_image_surface_get_height(a);
+        g_assert_cmpint(cairo_image_surface_get_width(b), ==, width);
+        g_assert_cmpint(cairo_image_surface_get_height(b), ==, height);
+
+        for (auto y = 0; y < height; ++y)
+                g_assert_cmpint(memcmp(cairo_image_surface_get_data(a) + y * cairo_image_surface_get_stride(a),
+                                       cairo_image_surface_get_data(b) + y * cairo_image_surface_get_stride(b),
+                                       width * 4), ==, 0);
+}
+
+static void
+assert_codec_roundtrip(image_codec* codec,
+                       int width,
+                       int height,
+                       int ncolors)
+{
+        auto image = create_image(width, height, ncolors, 5);
+
+        auto data = std::vector<char>{};
+        g_assert_true(codec->encode(image, data));
+
+        auto decoded = codec->decode(data.data(), data.size());
+        g_assert_nonnull(decoded);
+        assert_same_image(image, decoded);
+        cairo_surface_destroy(decoded);
+
+        /* Corrupt data doesn't decode */
+        g_assert_null(codec->decode(data.data(), data.size() / 2));
+
+        cairo_surface_destroy(image);
+}
+
+static void
+test_indexed_roundtrip(void)
+{
+        auto codec = image_codec_get("indexed");
+        g_assert_nonnull(codec);
+
+        auto const n_encoded = codec->get_stats().n_encoded;
+
+        assert_codec_roundtrip(codec, 1, 1, 1);
+        assert_codec_roundtrip(codec, 97, 61, 16);   /* 8-bit indices */
+        assert_codec_roundtrip(codec, 211, 67, 700); /* 16-bit indices */
+        assert_codec_roundtrip(codec, 300, 50, 5000); /* too many colours for a palette */
+
+        auto const stats = codec->get_stats();
+        g_assert_cmpuint(stats.n_encoded, ==, n_encoded + 4);
+        g_assert_cmpuint(stats.encoded_bytes, <, stats.pixel_bytes);
+}
+
+static void
+assert_indexed_roundtrip(image_codec* codec,
+                         int ncolors,
+                         int index_size)
+{
+        auto image = create_image(83, 29, ncolors, 3);
+
+        indexed_image indexed;
+        g_assert_true(indexed_image_from_surface(image, indexed));
+        g_assert_cmpint(indexed.index_size, ==, index_size);
+        g_assert_cmpuint(indexed.palette.size(), ==, ncolors);
+        g_assert_cmpuint(indexed.resource_size(), <, 83 * 29 * 4);
+
+        auto expanded = indexed_image_to_surface(indexed);
+        assert_same_image(image, expanded);
+        cairo_surface_destroy(expanded);
+
+        auto data = std::vector<char>{};
+        g_assert_true(codec->encode_indexed(indexed, data));
+
+        /* Codecs that can't keep the image indexed still decode a surface */
+        indexed_image decoded;
+        if (codec->decode_indexed(data.data(), data.size(), decoded)) {
+                g_assert_cmpint(decoded.width, ==, indexed.width);
+                g_assert_cmpint(decoded.height, ==, indexed.height);
+                g_assert_cmpint(decoded.index_size, ==, indexed.index_size);
+                g_assert_true(decoded.palette == indexed.palette);
+                g_assert_true(decoded.indices == indexed.indices);
+        }
+
+        auto surface = codec->decode(data.data(), data.size());
+        g_assert_nonnull(surface);
+        assert_same_image(image, surface);
+        cairo_surface_destroy(surface);
+
+        cairo_surface_destroy(image);
+}
+
+static void
+test_indexed_image(void)
+{
+        for (auto name : {"indexed", "png"}) {
+                auto codec = image_codec_get(name);
+                assert_indexed_roundtrip(codec, 1, 1);
+                assert_indexed_roundtrip(codec, 256, 1);
+                assert_indexed_roundtrip(codec, 257, 2);
+                assert_indexed_roundtrip(codec, 700, 2);
+        }
+
+        /* Too many colours */
+        auto image = create_image(100, 50, 2000, 1);
+        indexed_image indexed;
+        g_assert_false(indexed_image_from_surface(image, indexed));
+        cairo_surface_destroy(image);
+}
+
+static void
+test_indexed_crop(void)
+{
+        auto image = create_image(83, 29, 700, 3);
+        indexed_image indexed;
+        g_assert_true(indexed_image_from_surface(image, indexed));
+
+        indexed_image tile;
+        indexed_image_crop(indexed, 80, 20, 3, 9, tile);
+        g_assert_cmpint(tile.width, ==, 3);
+        g_assert_cmpint(tile.height, ==, 9);
+        g_assert_true(tile.palette == indexed.palette);
+
+        auto expanded = indexed_image_to_surface(tile);
+        for (auto y = 0; y < 9; ++y)
+                g_assert_cmpint(memcmp(cairo_image_surface_get_data(expanded) + y * cairo_image_surface_get_stride(expanded),
+                                       cairo_image_surface_get_data(image) + (20 + y) * cairo_image_surface_get_stride(image) + 80 * 4,
+                                       3 * 4), ==, 0);
+        cairo_surface_destroy(expanded);
+        cairo_surface_destroy(image);
+}
+
+static void
+test_indexed_hash(void)
+{
+        auto image = create_image(83, 29, 700, 3);
+        indexed_image a, b;
+        g_assert_true(indexed_image_from_surface(image, a));
+        g_assert_true(indexed_image_from_surface(image, b));
+        g_assert_true(indexed_image_equal(a, b));
+        g_assert_cmpuint(indexed_image_hash(a), ==, indexed_image_hash(b));
+
+        /* Any pixel, colour or the shape tells them apart */
+        b.indices[b.indices.size() - 1] ^= 1;
+        g_assert_false(indexed_image_equal(a, b));
+        g_assert_cmpuint(indexed_image_hash(a), !=, indexed_image_hash(b));
+        b.indices[b.indices.size() - 1] ^= 1;
+
+        b.palette[0] ^= 0x10;
+        g_assert_false(indexed_image_equal(a, b));
+        g_assert_cmpuint(indexed_image_hash(a), !=, indexed_image_hash(b));
+        b.palette[0] ^= 0x10;
+
+        std::swap(b.width, b.height);
+        g_assert_false(indexed_image_equal(a, b));
+        g_assert_cmpuint(indexed_image_hash(a), !=, indexed_image_hash(b));
+
+        cairo_surface_destroy(image);
+}
+
+static void
+test_png_roundtrip(void)
+{
+        auto codec = image_codec_get("png");
+        g_assert_nonnull(codec);
+
+        assert_codec_roundtrip(codec, 97, 61, 16);
+}
+
+static void
+test_codec_lookup(void)
+{
+        g_assert_null(image_codec_get("no-such-codec"));
+        g_assert_nonnull(image_codec_get_default());
+}
+
+static void
+benchmark_codec(char const* name,
+                int width,
+                int height,
+                int ncolors)
+{
+        auto codec = image_codec_get(name);
+        auto image = create_image(width, height, ncolors, 23);
+        auto const repeat = 20;
+
+        auto data = std::vector<char>{};
+        g_test_timer_start();
+        for (auto i = 0; i < repeat; ++i) {
+                data.clear();
+                codec->encode(image, data);
+        }
+        auto const encode_time = g_test_timer_elapsed();
+
+        g_test_timer_start();
+        for (auto i = 0; i < repeat; ++i)
+                cairo_surface_destroy(codec->decode(data.data(), data.size()));
+        auto const decode_time = g_test_timer_elapsed();
+
+        g_test_minimized_result(encode_time + decode_time,
+                                "%s %dx%d %d colors: %zu bytes, "
+                                "encode %.1f Mpixels/s, decode %.1f Mpixels/s",
+                                name, width, height, ncolors, data.size(),
+                                width * height * repeat / encode_time / 1e6,
+                                width * height * repeat / decode_time / 1e6);
+
+        cairo_surface_destroy(image);
+}
+
+static void
+test_codec_perf(void)
+{
+        for (auto name : {"indexed", "png"}) {
+                benchmark_codec(name, 800, 600, 16);
+                benchmark_codec(name, 800, 600, 1024);
+        }
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+        g_test_init(&argc, &argv, nullptr);
+
+        g_test_add_func("/vte/image/codec/lz", test_lz_roundtrip);
+        g_test_add_func("/vte/image/codec/indexed", test_indexed_roundtrip);
+        g_test_add_func("/vte/image/codec/png", test_png_roundtrip);
+        g_test_add_func("/vte/image/codec/indexed-image", test_indexed_image);
+        g_test_add_func("/vte/image/codec/crop", test_indexed_crop);
+        g_test_add_func("/vte/image/codec/hash", test_indexed_hash);
+        g_test_add_func("/vte/image/codec/lookup", test_codec_lookup);
+        if (g_test_perf())
+                g_test_add_func("/vte/image/codec/perf", test_codec_perf);
+
+        return g_test_run();
+}
@@ -0,0 +1,810 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+#include <glib.h>
+#include <string.h>
+#include "vteimagecodec.h"
+#include "sixel.h"
+#include "debug.h"
+
+namespace vte {
+
+namespace image {
+
+image_codec::image_codec ()
+{
+	memset (&m_stats, 0, sizeof (m_stats));
+	g_mutex_init (&m_stats_lock);
+}
+
+image_codec::~image_codec ()
+{
+	g_mutex_clear (&m_stats_lock);
+}
+
+image_codec_stats
+image_codec::get_stats ()
+{
+	image_codec_stats stats;
+
+	g_mutex_lock (&m_stats_lock);
+	stats = m_stats;
+	g_mutex_unlock (&m_stats_lock);
+
+	return stats;
+}
+
+void
+image_codec::count_encoded (gsize pixel_bytes, gsize encoded_bytes, gint64 start_time)
+{
+	gint64 elapsed = g_get_monotonic_time () - start_time;
+
+	g_mutex_lock (&m_stats_lock);
+	m_stats.n_encoded++;
+	m_stats.pixel_bytes += pixel_bytes;
+	m_stats.encoded_bytes += encoded_bytes;
+	m_stats.encode_time += elapsed;
+	g_mutex_unlock (&m_stats_lock);
+}
+
+void
+image_codec::count_decoded (gint64 start_time)
+{
+	gint64 elapsed = g_get_monotonic_time () - start_time;
+
+	g_mutex_lock (&m_stats_lock);
+	m_stats.n_decoded++;
+	m_stats.decode_time += elapsed;
+	g_mutex_unlock (&m_stats_lock);
+}
+
+void
+image_codec::count_failed ()
+{
+	g_mutex_lock (&m_stats_lock);
+	m_stats.n_failed++;
+	g_mutex_unlock (&m_stats_lock);
+}
+
+bool
+image_codec::encode (cairo_surface_t *surface, std::vector<char> &out)
+{
+	gint64 start_time = g_get_monotonic_time ();
+	gsize start_size = out.size ();
+
+	cairo_surface_flush (surface);
+	if (! do_encode (surface, out)) {
+		out.resize (start_size);
+		count_failed ();
+		return false;
+	}
+
+	count_encoded ((gsize)cairo_image_surface_get_width (surface) * cairo_image_surface_get_height (surface) * 4,
+	               out.size () - start_size, start_time);
+
+	return true;
+}
+
+bool
+image_codec::encode_indexed (indexed_image const &image, std::vector<char> &out)
+{
+	gint64 start_time = g_get_monotonic_time ();
+	gsize start_size = out.size ();
+
+	if (! do_encode_indexed (image, out)) {
+		out.resize (start_size);
+		count_failed ();
+		return false;
+	}
+
+	count_encoded ((gsize)image.width * image.height * 4, out.size () - start_size, start_time);
+
+	return true;
+}
+
+/* Returns false if the data doesn't decode into an indexed image, which
+ * decode() may still turn into a surface.
+ */
+bool
+image_codec::decode_indexed (char const *data, gsize len, indexed_image &image)
+{
+	gint64 start_time = g_get_monotonic_time ();
+
+	if (! do_decode_indexed (data, len, image))
+		return false;
+
+	count_decoded (start_time);
+
+	return true;
+}
+
+cairo_surface_t *
+image_codec::decode (char const *data, gsize len)
+{
+	gint64 start_time = g_get_monotonic_time ();
+	cairo_surface_t *surface;
+
+	surface = do_decode (data, len);
+	if (! surface) {
+		count_failed ();
+		return NULL;
+	}
+
+	count_decoded (start_time);
+
+	return surface;
+}
+
+/*
+ * LZ77 block compression
+ *
+ * A block is a sequence of (literals, match) pairs, each starting with a
+ * token byte holding the literal length in its high and the match length
+ * minus VTE_IMAGE_LZ_MIN_MATCH in its low nibble. A nibble of 15 is
+ * continued by bytes of 255 up to and including the first smaller byte.
+ * The literals follow the token, then a 16-bit little endian offset
+ * back into the output and the match length continuation. The last
+ * pair may have no match; the block ends with the input.
+ */
+
+#define VTE_IMAGE_LZ_MIN_MATCH 4
+#define VTE_IMAGE_LZ_HASH_BITS 12
+#define VTE_IMAGE_LZ_MAX_OFFSET 65535
+
+static inline guint32
+read32 (guint8 const *p)
+{
+	guint32 v;
+	memcpy (&v, p, sizeof (v));
+	return v;
+}
+
+static inline guint8 *
+write_length (guint8 *op, gsize n)
+{
+	while (n >= 255) {
+		*op++ = 255;
+		n -= 255;
+	}
+	*op++ = (guint8)n;
+	return op;
+}
+
+static inline guint8 *
+write_sequence (guint8 *op, guint8 const *literals, gsize nliterals, gsize offset, gsize match)
+{
+	guint8 *token = op++;
+	gsize match_code = match ? match - VTE_IMAGE_LZ_MIN_MATCH : 0;
+
+	*token = (guint8)((MIN (nliterals, 15) << 4) | MIN (match_code, 15));
+	if (nliterals >= 15)
+		op = write_length (op, nliterals - 15);
+	memcpy (op, literals, nliterals);
+	op += nliterals;
+
+	if (match) {
+		*op++ = offset & 0xff;
+		*op++ = offset >> 8;
+		if (match_code >= 15)
+			op = write_length (op, match_code - 15);
+	}
+
+	return op;
+}
+
+gsize
+image_lz_compress_bound (gsize len)
+{
+	return len + len / 255 + 16;
+}
+
+/* Compress @len bytes from @src into @dst, which must hold image_lz_compress_bound() bytes */
+gsize
+image_lz_compress (guint8 const *src, gsize len, guint8 *dst)
+{
+	gsize table[1 << VTE_IMAGE_LZ_HASH_BITS];
+	gsize ip = 0, anchor = 0;
+	guint8 *op = dst;
+
+	memset (table, 0, sizeof (table));
+
+	while (ip + VTE_IMAGE_LZ_MIN_MATCH <= len) {
+		guint32 seq = read32 (src + ip);
+		guint32 h = (seq * 2654435761u) >> (32 - VTE_IMAGE_LZ_HASH_BITS);
+		gsize ref = table[h];
+		gsize match;
+
+		table[h] = ip;
+		if (ref >= ip || ip - ref > VTE_IMAGE_LZ_MAX_OFFSET || read32 (src + ref) != seq) {
+			/* Skip faster through data that doesn't compress */
+			ip += 1 + ((ip - anchor) >> 6);
+			continue;
+		}
+
+		match = VTE_IMAGE_LZ_MIN_MATCH;
+		while (ip + match < len && src[ref + match] == src[ip + match])
+			match++;
+
+		op = write_sequence (op, src + anchor, ip - anchor, ip - ref, match);
+		ip += match;
+		anchor = ip;
+	}
+
+	if (anchor < len)
+		op = write_sequence (op, src + anchor, len - anchor, 0, 0);
+
+	return op - dst;
+}
+
+/* Decompress the block in @src, which must expand to exactly @dst_len bytes */
+bool
+image_lz_decompress (guint8 const *src, gsize len, guint8 *dst, gsize dst_len)
+{
+	guint8 const *ip = src, *iend = src + len;
+	gsize op = 0;
+
+	while (ip < iend) {
+		guint8 token = *ip++;
+		gsize nliterals = token >> 4;
+		gsize match = token & 0xf;
+		gsize offset;
+		guint8 b;
+
+		if (nliterals == 15) {
+			do {
+				if (ip >= iend)
+					return false;
+				b = *ip++;
+				nliterals += b;
+			} while (b == 255);
+		}
+		if (nliterals > (gsize)(iend - ip) || nliterals > dst_len - op)
+			return false;
+		memcpy (dst + op, ip, nliterals);
+		ip += nliterals;
+		op += nliterals;
+
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return false;
+		offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (match == 15) {
+			do {
+				if (ip >= iend)
+					return false;
+				b = *ip++;
+				match += b;
+			} while (b == 255);
+		}
+		match += VTE_IMAGE_LZ_MIN_MATCH;
+		if (offset == 0 || offset > op || match > dst_len - op)
+			return false;
+
+		if (offset >= match) {
+			memcpy (dst + op, dst + op - offset, match);
+		} else {
+			/* Overlapping, e.g. a run of one repeated pixel */
+			for (gsize i = 0; i < match; i++)
+				dst[op + i] = dst[op - offset + i];
+		}
+		op += match;
+	}
+
+	return op == dst_len;
+}
+
+/*
+ * The PNG codec
+ */
+
+struct png_reader {
+	char const *data;
+	gsize len;
+	gsize pos;
+};
+
+static cairo_status_t
+png_write_callback (void *closure, unsigned char const *data, unsigned int length)
+{
+	auto out = (std::vector<char> *)closure;
+
+	out->insert (out->end (), (char const *)data, (char const *)data + length);
+
+	return CAIRO_STATUS_SUCCESS;
+}
+
+static cairo_status_t
+png_read_callback (void *closure, unsigned char *data, unsigned int length)
+{
+	auto reader = (png_reader *)closure;
+
+	if (length > reader->len - reader->pos)
+		return CAIRO_STATUS_READ_ERROR;
+	memcpy (data, reader->data + reader->pos, length);
+	reader->pos += length;
+
+	return CAIRO_STATUS_SUCCESS;
+}
+
+class png_codec : public image_codec {
+protected:
+	bool
+	do_encode (cairo_surface_t *surface, std::vector<char> &out) override
+	{
+		return cairo_surface_write_to_png_stream (surface, png_write_callback, &out) == CAIRO_STATUS_SUCCESS;
+	}
+
+	cairo_surface_t *
+	do_decode (char const *data, gsize len) override
+	{
+		png_reader reader = { data, len, 0 };
+		cairo_surface_t *surface;
+
+		surface = cairo_image_surface_create_from_png_stream (png_read_callback, &reader);
+		if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS) {
+			cairo_surface_destroy (surface);
+			return NULL;
+		}
+
+		return surface;
+	}
+public:
+	char const *get_name () const override { return "png"; }
+};
+
+/*
+ * Indexed images
+ */
+
+#define VTE_IMAGE_INDEXED_HASH_SIZE (DECSIXEL_PALETTE_MAX * 4)
+
+/* Collects the palette of @surface and its pixels into @image.
+ * Returns false if there are more than DECSIXEL_PALETTE_MAX colours.
+ */
+bool
+indexed_image_from_surface (cairo_surface_t *surface, indexed_image &image)
+{
+	int width = cairo_image_surface_get_width (surface);
+	int height = cairo_image_surface_get_height (surface);
+	int stride = cairo_image_surface_get_stride (surface);
+	guint8 const *data = cairo_image_surface_get_data (surface);
+	guint16 slots[VTE_IMAGE_INDEXED_HASH_SIZE];  /* index + 1 into palette, 0 if empty */
+	std::vector<guint16> indices ((gsize)width * height);
+	std::vector<guint32> palette;
+	guint32 last_color = 0;
+	guint16 last_index = 0;
+	bool have_last = false;
+
+	if (cairo_surface_get_type (surface) != CAIRO_SURFACE_TYPE_IMAGE ||
+	    cairo_image_surface_get_format (surface) != CAIRO_FORMAT_ARGB32)
+		return false;
+
+	cairo_surface_flush (surface);
+	memset (slots, 0, sizeof (slots));
+
+	for (int y = 0; y < height; y++) {
+		guint32 const *row = (guint32 const *)(data + (gsize)y * stride);
+		guint16 *out = indices.data () + (gsize)y * width;
+
+		for (int x = 0; x < width; x++) {
+			guint32 color = row[x];
+			guint32 h;
+
+			/* Runs of one colour are the common case */
+			if (have_last && color == last_color) {
+				out[x] = last_index;
+				continue;
+			}
+
+			h = (color * 2654435761u) >> 20 & (VTE_IMAGE_INDEXED_HASH_SIZE - 1);
+			while (slots[h] && palette[slots[h] - 1] != color)
+				h = (h + 1) & (VTE_IMAGE_INDEXED_HASH_SIZE - 1);
+			if (! slots[h]) {
+				if (palette.size () == DECSIXEL_PALETTE_MAX)
+					return false;
+				palette.push_back (color);
+				slots[h] = (guint16)palette.size ();
+			}
+
+			last_color = color;
+			last_index = slots[h] - 1;
+			have_last = true;
+			out[x] = last_index;
+		}
+	}
+
+	image.width = width;
+	image.height = height;
+	image.palette = std::move (palette);
+	if (image.palette.size () <= 256) {
+		image.index_size = 1;
+		image.indices.assign (indices.begin (), indices.end ());
+	} else {
+		image.index_size = 2;
+		image.indices.resize (indices.size () * 2);
+		memcpy (image.indices.data (), indices.data (), image.indices.size ());
+	}
+
+	return true;
+}
+
+/* Convert @image into ARGB32 @pixels */
+void
+indexed_image_expand (indexed_image const &image, guint8 *pixels, int stride)
+{
+	guint32 table[DECSIXEL_PALETTE_MAX];
+
+	/* Out of range indices, from a corrupt image, read as transparent */
+	memset (table, 0, sizeof (table));
+	memcpy (table, image.palette.data (), MIN (image.palette.size (), DECSIXEL_PALETTE_MAX) * sizeof (guint32));
+
+	for (int y = 0; y < image.height; y++) {
+		guint32 *row = (guint32 *)(pixels + (gsize)y * stride);
+		guint8 const *src = image.indices.data () + (gsize)y * image.width * image.index_size;
+
+		if (image.index_size == 2) {
+			sixel_expand_indices ((sixel_color_no_t const *)src, row, image.width, table);
+		} else {
+			for (int x = 0; x < image.width; x++)
+				row[x] = table[src[x]];
+		}
+	}
+}
+
+/* Copy the @width x @height pixels at (@x, @y) of @image into @tile */
+void
+indexed_image_crop (indexed_image const &image, int x, int y, int width, int height, indexed_image &tile)
+{
+	g_assert_true (x >= 0 && y >= 0 && width > 0 && height > 0);
+	g_assert_true (x + width <= image.width && y + height <= image.height);
+
+	tile.width = width;
+	tile.height = height;
+	tile.index_size = image.index_size;
+	tile.palette = image.palette;
+	tile.indices.resize ((gsize)width * height * image.index_size);
+
+	for (int row = 0; row < height; row++)
+		memcpy (tile.indices.data () + (gsize)row * width * image.index_size,
+		        image.indices.data () + ((gsize)(y + row) * image.width + x) * image.index_size,
+		        (gsize)width * image.index_size);
+}
+
+static inline guint64
+hash_mix (guint64 h, guint64 v)
+{
+	h ^= v;
+	h *= G_GUINT64_CONSTANT (0xbf58476d1ce4e5b9);
+	return h ^ (h >> 31);
+}
+
+static guint64
+hash_bytes (guint64 h, guint8 const *data, gsize len)
+{
+	guint64 v;
+	gsize i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy (&v, data + i, 8);
+		h = hash_mix (h, v);
+	}
+	v = 0;
+	memcpy (&v, data + i, len - i);
+	return hash_mix (h, v ^ ((guint64)len << 56));
+}
+
+/* A hash of the size, palette and indices, for finding identical images */
+guint64
+indexed_image_hash (indexed_image const &image)
+{
+	guint64 h = G_GUINT64_CONSTANT (0x9e3779b97f4a7c15);
+
+	h = hash_mix (h, (guint64)image.width << 32 | (guint32)image.height);
+	h = hash_mix (h, image.index_size);
+	h = hash_bytes (h, (guint8 const *)image.palette.data (), image.palette.size () * sizeof (guint32));
+	return hash_bytes (h, image.indices.data (), image.indices.size ());
+}
+
+bool
+indexed_image_equal (indexed_image const &a, indexed_image const &b)
+{
+	return a.width == b.width && a.height == b.height && a.index_size == b.index_size &&
+	       a.palette == b.palette && a.indices == b.indices;
+}
+
+cairo_surface_t *
+indexed_image_to_surface (indexed_image const &image)
+{
+	cairo_surface_t *surface;
+
+	surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, image.width, image.height);
+	if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy (surface);
+		return NULL;
+	}
+
+	cairo_surface_flush (surface);
+	indexed_image_expand (image, cairo_image_surface_get_data (surface), cairo_image_surface_get_stride (surface));
+	cairo_surface_mark_dirty (surface);
+
+	return surface;
+}
+
+/* Codecs that don't store indexed images serialize them as surfaces */
+bool
+image_codec::do_encode_indexed (indexed_image const &image, std::vector<char> &out)
+{
+	cairo_surface_t *surface;
+	bool result;
+
+	surface = indexed_image_to_surface (image);
+	if (! surface)
+		return false;
+
+	result = do_encode (surface, out);
+	cairo_surface_destroy (surface);
+
+	return result;
+}
+
+bool
+image_codec::do_decode_indexed (char const *data, gsize len, indexed_image &image)
+{
+	return false;
+}
+
+/*
+ * The indexed codec
+ *
+ * Sixel images have at most DECSIXEL_PALETTE_MAX colours, so they're
+ * stored as a palette and one 8- or 16-bit index per pixel, which is
+ * then LZ compressed. Images with more colours, e.g. after being
+ * composed with scaled ones, store the LZ compressed ARGB32 pixels.
+ */
+
+#define VTE_IMAGE_INDEXED_MAGIC 0x69657476 /* "vtei" */
+#define VTE_IMAGE_INDEXED_SIZE_MAX 32767  /* the largest image surface cairo creates */
+
+enum indexed_kind {
+	INDEXED_KIND_8 = 1,
+	INDEXED_KIND_16 = 2,
+	INDEXED_KIND_ARGB32 = 4,    /* the value is the size of a pixel */
+};
+
+struct indexed_header {
+	guint32 magic;
+	guint32 width;
+	guint32 height;
+	guint16 kind;
+	guint16 ncolors;
+	/* followed by ncolors ARGB32 palette entries and the compressed pixels */
+};
+
+static void
+append_compressed (std::vector<char> &out, guint8 const *data, gsize len)
+{
+	gsize start = out.size ();
+
+	out.resize (start + image_lz_compress_bound (len));
+	out.resize (start + image_lz_compress (data, len, (guint8 *)out.data () + start));
+}
+
+/* Reads and checks the header and palette; returns the offset of the compressed pixels, or 0 */
+static gsize
+read_header (char const *data, gsize len, indexed_header &header, guint32 *palette)
+{
+	gsize offset;
+
+	if (len < sizeof (header))
+		return 0;
+	memcpy (&header, data, sizeof (header));
+	if (header.magic != VTE_IMAGE_INDEXED_MAGIC ||
+	    (header.kind != INDEXED_KIND_8 && header.kind != INDEXED_KIND_16 && header.kind != INDEXED_KIND_ARGB32) ||
+	    header.ncolors > DECSIXEL_PALETTE_MAX ||
+	    header.width > VTE_IMAGE_INDEXED_SIZE_MAX || header.height > VTE_IMAGE_INDEXED_SIZE_MAX)
+		return 0;
+
+	offset = sizeof (header) + header.ncolors * sizeof (guint32);
+	if (len < offset)
+		return 0;
+	memcpy (palette, data + sizeof (header), header.ncolors * sizeof (guint32));
+
+	return offset;
+}
+
+class indexed_codec : public image_codec {
+protected:
+	bool
+	do_encode_indexed (indexed_image const &image, std::vector<char> &out) override
+	{
+		indexed_header header;
+
+		header.magic = VTE_IMAGE_INDEXED_MAGIC;
+		header.width = image.width;
+		header.height = image.height;
+		header.kind = image.index_size == 1 ? INDEXED_KIND_8 : INDEXED_KIND_16;
+		header.ncolors = image.palette.size ();
+
+		out.insert (out.end (), (char const *)&header, (char const *)&header + sizeof (header));
+		out.insert (out.end (), (char const *)image.palette.data (), (char const *)(image.palette.data () + header.ncolors));
+		append_compressed (out, image.indices.data (), image.indices.size ());
+
+		return true;
+	}
+
+	bool
+	do_encode (cairo_surface_t *surface, std::vector<char> &out) override
+	{
+		indexed_image image;
+		indexed_header header;
+
+		if (cairo_surface_get_type (surface) != CAIRO_SURFACE_TYPE_IMAGE ||
+		    cairo_image_surface_get_format (surface) != CAIRO_FORMAT_ARGB32)
+			return false;
+
+		if (indexed_image_from_surface (surface, image))
+			return do_encode_indexed (image, out);
+
+		header.magic = VTE_IMAGE_INDEXED_MAGIC;
+		header.width = cairo_image_surface_get_width (surface);
+		header.height = cairo_image_surface_get_height (surface);
+		header.kind = INDEXED_KIND_ARGB32;
+		header.ncolors = 0;
+		out.insert (out.end (), (char const *)&header, (char const *)&header + sizeof (header));
+
+		int stride = cairo_image_surface_get_stride (surface);
+		guint8 const *data = cairo_image_surface_get_data (surface);
+		std::vector<guint8> pixels ((gsize)header.width * header.height * 4);
+
+		for (guint32 y = 0; y < header.height; y++)
+			memcpy (pixels.data () + (gsize)y * header.width * 4, data + (gsize)y * stride, header.width * 4);
+		append_compressed (out, pixels.data (), pixels.size ());
+
+		return true;
+	}
+
+	bool
+	do_decode_indexed (char const *data, gsize len, indexed_image &image) override
+	{
+		indexed_header header;
+		guint32 palette[DECSIXEL_PALETTE_MAX];
+		gsize offset;
+
+		offset = read_header (data, len, header, palette);
+		if (offset == 0 || header.kind == INDEXED_KIND_ARGB32)
+			return false;
+
+		std::vector<guint8> indices ((gsize)header.width * header.height * header.kind);
+		if (! image_lz_decompress ((guint8 const *)data + offset, len - offset, indices.data (), indices.size ()))
+			return false;
+
+		image.width = header.width;
+		image.height = header.height;
+		image.index_size = header.kind;
+		image.palette.assign (palette, palette + header.ncolors);
+		image.indices = std::move (indices);
+
+		return true;
+	}
+
+	cairo_surface_t *
+	do_decode (char const *data, gsize len) override
+	{
+		indexed_header header;
+		guint32 palette[DECSIXEL_PALETTE_MAX];
+		indexed_image image;
+		cairo_surface_t *surface;
+		gsize offset;
+
+		offset = read_header (data, len, header, palette);
+		if (offset == 0)
+			return NULL;
+
+		if (header.kind != INDEXED_KIND_ARGB32) {
+			if (! do_decode_indexed (data, len, image))
+				return NULL;
+			return indexed_image_to_surface (image);
+		}
+
+		std::vector<guint8> pixels ((gsize)header.width * header.height * 4);
+		if (! image_lz_decompress ((guint8 const *)data + offset, len - offset, pixels.data (), pixels.size ()))
+			return NULL;
+
+		surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, header.width, header.height);
+		if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS) {
+			cairo_surface_destroy (surface);
+			return NULL;
+		}
+
+		int stride = cairo_image_surface_get_stride (surface);
+		guint8 *dst = cairo_image_surface_get_data (surface);
+
+		cairo_surface_flush (surface);
+		for (guint32 y = 0; y < header.height; y++)
+			memcpy (dst + (gsize)y * stride, pixels.data () + (gsize)y * header.width * 4, header.width * 4);
+		cairo_surface_mark_dirty (surface);
+
+		return surface;
+	}
+public:
+	char const *get_name () const override { return "indexed"; }
+};
+
+static png_codec s_png_codec;
+static indexed_codec s_indexed_codec;
+
+static image_codec *const s_codecs[] = {
+	&s_indexed_codec,
+	&s_png_codec,
+};
+
+/* Look up a codec by name; returns NULL if there's no such codec */
+image_codec *
+image_codec_get (char const *name)
+{
+	for (auto codec : s_codecs)
+		if (g_strcmp0 (codec->get_name (), name) == 0)
+			return codec;
+
+	return NULL;
+}
+
+/* The codec used for freezing; can be chosen with the VTE_IMAGE_CODEC environment variable */
+image_codec *
+image_codec_get_default ()
+{
+	static image_codec *codec = NULL;
+
+	if (codec == NULL) {
+		char const *name = g_getenv ("VTE_IMAGE_CODEC");
+
+		if (name)
+			codec = image_codec_get (name);
+		if (codec == NULL)
+			codec = &s_indexed_codec;
+	}
+
+	return codec;
+}
+
+void
+image_codec_print_stats ()
+{
+	for (auto codec : s_codecs) {
+		image_codec_stats stats = codec->get_stats ();
+
+		if (stats.n_encoded == 0 && stats.n_decoded == 0 && stats.n_failed == 0)
+			continue;
+
+		_vte_debug_print (VTE_DEBUG_IMAGE,
+		                  "Image codec %s: %" G_GSIZE_FORMAT " encoded in %" G_GINT64_FORMAT "µs, "
+		                  "%" G_GSIZE_FORMAT " decoded in %" G_GINT64_FORMAT "µs, %" G_GSIZE_FORMAT " failed, "
+		                  "%" G_GSIZE_FORMAT " -> %" G_GSIZE_FORMAT " bytes\n",
+		                  codec->get_name (),
+		                  stats.n_encoded, stats.encode_time,
+		                  stats.n_decoded, stats.decode_time,
+		                  stats.n_failed,
+		                  stats.pixel_bytes, stats.encoded_bytes);
+	}
+}
+
+} // namespace image
+
+} // namespace vte
@@ -0,0 +1,98 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <glib.h>
+#include <cairo.h>
+
+namespace vte {
+
+namespace image {
+
+/* Counters of what a codec did so far */
+struct image_codec_stats {
+	gsize n_encoded;            /* number of images frozen */
+	gsize n_decoded;            /* number of images thawed */
+	gsize n_failed;             /* number of failed encodes and decodes */
+	gsize pixel_bytes;          /* ARGB32 size of the images frozen */
+	gsize encoded_bytes;        /* size of what was written to the stream */
+	gint64 encode_time;         /* in microseconds */
+	gint64 decode_time;         /* in microseconds */
+};
+
+/* An image as a palette and one index of index_size bytes per pixel, which
+ * is how sixel images are kept until they're painted
+ */
+struct indexed_image {
+	int width;
+	int height;
+	int index_size;             /* 1 for up to 256 colours, else 2 */
+	std::vector<guint32> palette;  /* ARGB32 */
+	std::vector<guint8> indices;   /* rows without padding */
+
+	gsize resource_size () const { return indices.size () + palette.size () * sizeof (guint32); }
+};
+
+bool indexed_image_from_surface (cairo_surface_t *surface, indexed_image &image);
+void indexed_image_expand (indexed_image const &image, guint8 *pixels, int stride);
+void indexed_image_crop (indexed_image const &image, int x, int y, int width, int height, indexed_image &tile);
+cairo_surface_t *indexed_image_to_surface (indexed_image const &image);
+guint64 indexed_image_hash (indexed_image const &image);
+bool indexed_image_equal (indexed_image const &a, indexed_image const &b);
+
+/*
+ * Serializes image surfaces and indexed images for freezing them into
+ * the stream, and back. Codecs are stateless apart from their statistics,
+ * and can be used from several threads at once.
+ */
+class image_codec {
+private:
+	image_codec_stats m_stats;
+	GMutex m_stats_lock;
+	void count_encoded (gsize pixel_bytes, gsize encoded_bytes, gint64 start_time);
+	void count_decoded (gint64 start_time);
+	void count_failed ();
+protected:
+	virtual bool do_encode (cairo_surface_t *surface, std::vector<char> &out) = 0;
+	virtual cairo_surface_t *do_decode (char const *data, gsize len) = 0;
+	virtual bool do_encode_indexed (indexed_image const &image, std::vector<char> &out);
+	virtual bool do_decode_indexed (char const *data, gsize len, indexed_image &image);
+public:
+	image_codec ();
+	virtual ~image_codec ();
+	virtual char const *get_name () const = 0;
+	bool encode (cairo_surface_t *surface, std::vector<char> &out);
+	cairo_surface_t *decode (char const *data, gsize len);
+	bool encode_indexed (indexed_image const &image, std::vector<char> &out);
+	bool decode_indexed (char const *data, gsize len, indexed_image &image);
+	image_codec_stats get_stats ();
+};
+
+image_codec *image_codec_get (char const *name);
+image_codec *image_codec_get_default ();
+void image_codec_print_stats ();
+
+/* The LZ77 block compression used by the default codec */
+gsize image_lz_compress_bound (gsize len);
+gsize image_lz_compress (guint8 const *src, gsize len, guint8 *dst);
+bool image_lz_decompress (guint8 const *src, gsize len, guint8 *dst, gsize dst_len);
+
+} // namespace image
+
+} // namespace vte
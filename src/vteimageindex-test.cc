@@ -0,0 +1,205 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "vteimageindex.h"
+
+using namespace vte::image;
+
+/* Stands in for image_object, which needs a widget to paint */
+struct test_image {
+        glong left, top;
+        int width, height;
+
+        glong get_left() const { return left; }
+        glong get_top() const { return top; }
+        int get_width() const { return width; }
+        int get_height() const { return height; }
+        glong get_bottom() const { return top + height - 1; }
+};
+
+static bool
+overlaps(test_image const& image,
+         glong first_row,
+         glong last_row,
+         glong first_col,
+         glong last_col)
+{
+        return image.top <= last_row && image.get_bottom() >= first_row &&
+                image.left <= last_col && image.left + image.width - 1 >= first_col;
+}
+
+static void
+test_index_basic(void)
+{
+        image_index<test_image> index;
+        g_assert_true(index.empty());
+        g_assert_null(index.oldest());
+
+        /* Same bottom row, which a map keyed by it couldn't hold */
+        test_image a{0, 10, 5, 5};
+        test_image b{10, 12, 5, 3};
+        test_image c{0, 20, 80, 10};
+        index.insert(&a);
+        index.insert(&b);
+        index.insert(&c);
+        g_assert_cmpuint(index.size(), ==, 3);
+        g_assert_true(index.oldest() == &a);
+
+        auto found = std::vector<test_image*>{};
+        index.find_overlapping(14, 14, found);
+        g_assert_cmpuint(found.size(), ==, 2);
+        g_assert_true(found[0] == &a);
+        g_assert_true(found[1] == &b);
+
+        found.clear();
+        index.find_overlapping(0, 100, 6, 9, found);
+        g_assert_cmpuint(found.size(), ==, 1);
+        g_assert_true(found[0] == &c);
+
+        found.clear();
+        index.find_by_bottom(14, 14, found);
+        g_assert_cmpuint(found.size(), ==, 2);
+
+        found.clear();
+        index.find_by_top(11, 20, found);
+        g_assert_cmpuint(found.size(), ==, 2);
+        g_assert_true(found[0] == &b);
+        g_assert_true(found[1] == &c);
+
+        /* Updating makes an image paint last */
+        index.update(&a);
+        found.clear();
+        index.find_overlapping(14, 14, found);
+        g_assert_true(found[0] == &b);
+        g_assert_true(found[1] == &a);
+
+        g_assert_true(index.remove(&a));
+        g_assert_false(index.remove(&a));
+        g_assert_true(index.oldest() == &b);
+
+        index.clear();
+        g_assert_true(index.empty());
+}
+
+static void
+test_index_random(void)
+{
+        auto rand = g_rand_new_with_seed(11);
+        auto images = std::vector<test_image>(2000);
+        for (auto& image : images)
+                image = test_image{g_rand_int_range(rand, 0, 80),
+                                   g_rand_int_range(rand, 0, 5000),
+                                   g_rand_int_range(rand, 1, 40),
+                                   g_rand_int_range(rand, 1, 60)};
+
+        image_index<test_image> index;
+        auto present = std::vector<bool>(images.size());
+        for (auto round = 0; round < 20000; ++round) {
+                auto i = g_rand_int_range(rand, 0, images.size());
+                if (present[i])
+                        g_assert_true(index.remove(&images[i]));
+                else
+                        index.insert(&images[i]);
+                present[i] = !present[i];
+
+                if (round % 100)
+                        continue;
+
+                auto const first_row = g_rand_int_range(rand, -10, 5100);
+                auto const last_row = first_row + g_rand_int_range(rand, 0, 100);
+                auto const first_col = g_rand_int_range(rand, 0, 80);
+                auto const last_col = first_col + g_rand_int_range(rand, 0, 80);
+
+                auto found = std::vector<test_image*>{};
+                index.find_overlapping(first_row, last_row, first_col, last_col, found);
+                std::sort(found.begin(), found.end());
+
+                auto expected = std::vector<test_image*>{};
+                for (auto j = 0u; j < images.size(); ++j)
+                        if (present[j] && overlaps(images[j], first_row, last_row, first_col, last_col))
+                                expected.push_back(&images[j]);
+                g_assert_true(found == expected);
+
+                found.clear();
+                index.find_by_bottom(first_row, last_row, found);
+                for (auto j = 1u; j < found.size(); ++j)
+                        g_assert_cmpint(found[j - 1]->get_bottom(), <=, found[j]->get_bottom());
+                auto n = 0u;
+                for (auto j = 0u; j < images.size(); ++j)
+                        n += present[j] && images[j].get_bottom() >= first_row && images[j].get_bottom() <= last_row;
+                g_assert_cmpuint(found.size(), ==, n);
+
+                auto oldest = index.oldest();
+                for (auto j = 0u; j < images.size(); ++j)
+                        if (present[j])
+                                g_assert_cmpint(oldest->get_bottom(), <=, images[j].get_bottom());
+        }
+
+        g_rand_free(rand);
+}
+
+static void
+test_index_perf(void)
+{
+        auto const n = 100000;
+        auto images = std::vector<test_image>(n);
+        for (auto i = 0; i < n; ++i)
+                images[i] = test_image{(i * 7) % 60, i * 3, 20, 10};
+
+        image_index<test_image> index;
+        g_test_timer_start();
+        for (auto& image : images)
+                index.insert(&image);
+
+        /* Scroll over the whole scrollback a screenful at a time */
+        auto found = std::vector<test_image*>{};
+        auto total = gsize{0};
+        for (auto row = 0; row < n * 3; row += 25) {
+                found.clear();
+                index.find_overlapping(row, row + 24, found);
+                total += found.size();
+        }
+
+        while (!index.empty())
+                index.remove(index.oldest());
+        auto const elapsed = g_test_timer_elapsed();
+
+        g_assert_cmpuint(total, >, 0);
+        g_test_minimized_result(elapsed,
+                                "%d images: insert, %d queries and removal in %.3fs",
+                                n, n * 3 / 25, elapsed);
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+        g_test_init(&argc, &argv, nullptr);
+
+        g_test_add_func("/vte/image/index/basic", test_index_basic);
+        g_test_add_func("/vte/image/index/random", test_index_random);
+        if (g_test_perf())
+                g_test_add_func("/vte/image/index/perf", test_index_perf);
+
+        return g_test_run();
+}
@@ -0,0 +1,306 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include <glib.h>
+
+namespace vte {
+
+namespace image {
+
+/*
+ * An index of the images in the ring by their extents in cells.
+ *
+ * Images are kept in a treap ordered by (top, insertion sequence), where
+ * every node also knows the largest bottom row of its subtree, so the
+ * images overlapping a range of rows are found in O(log n + k). Subtrees
+ * also know their column span and are skipped when it misses the columns
+ * asked for, but a query narrower than the images' rows can still visit
+ * nodes that only overlap in rows. A second
+ * ordering by (bottom, insertion sequence) serves the scrollback eviction,
+ * which goes from the oldest row up. Any number of images may share a top
+ * or a bottom row.
+ *
+ * The extents are recorded when an image is inserted; an image whose
+ * position or size changes has to be removed and inserted again.
+ *
+ * T needs get_left(), get_top(), get_width() and get_height().
+ */
+template <class T>
+class image_index {
+private:
+	struct node {
+		T *image;
+		glong top;
+		glong bottom;           /* inclusive */
+		glong left;
+		glong right;            /* inclusive */
+		guint64 seq;            /* insertion order, for painting older images first */
+		guint32 priority;
+		glong max_bottom;       /* of this subtree */
+		glong min_left;         /* of this subtree */
+		glong max_right;        /* of this subtree */
+		node *lchild;
+		node *rchild;
+	};
+
+	struct bottom_less {
+		bool operator() (node const *a, node const *b) const
+		{
+			return a->bottom != b->bottom ? a->bottom < b->bottom : a->seq < b->seq;
+		}
+	};
+
+	node *m_root;
+	std::set<node *, bottom_less> m_by_bottom;
+	std::unordered_map<T const *, node *> m_nodes;
+	guint64 m_seq;
+	guint32 m_random;
+
+	static bool node_less (glong top, guint64 seq, node const *n)
+	{
+		return top != n->top ? top < n->top : seq < n->seq;
+	}
+
+	static void pull_child (node *n, node const *c)
+	{
+		if (c == NULL)
+			return;
+		n->max_bottom = MAX (n->max_bottom, c->max_bottom);
+		n->min_left = MIN (n->min_left, c->min_left);
+		n->max_right = MAX (n->max_right, c->max_right);
+	}
+
+	static void pull (node *n)
+	{
+		n->max_bottom = n->bottom;
+		n->min_left = n->left;
+		n->max_right = n->right;
+		pull_child (n, n->lchild);
+		pull_child (n, n->rchild);
+	}
+
+	/* Splits @n into the nodes before (top, seq) and the rest */
+	static void split (node *n, glong top, guint64 seq, node **l, node **r)
+	{
+		if (n == NULL) {
+			*l = *r = NULL;
+		} else if (node_less (top, seq, n) || (top == n->top && seq == n->seq)) {
+			split (n->lchild, top, seq, l, &n->lchild);
+			pull (n);
+			*r = n;
+		} else {
+			split (n->rchild, top, seq, &n->rchild, r);
+			pull (n);
+			*l = n;
+		}
+	}
+
+	static node *merge (node *l, node *r)
+	{
+		if (l == NULL)
+			return r;
+		if (r == NULL)
+			return l;
+		if (l->priority > r->priority) {
+			l->rchild = merge (l->rchild, r);
+			pull (l);
+			return l;
+		}
+		r->lchild = merge (l, r->lchild);
+		pull (r);
+		return r;
+	}
+
+	static void collect_overlapping (node const *n, glong first_row, glong last_row,
+	                                 glong first_col, glong last_col, std::vector<node const *> &out)
+	{
+		/* Nothing below reaches down to first_row, or into the columns */
+		if (n == NULL || n->max_bottom < first_row ||
+		    n->max_right < first_col || n->min_left > last_col)
+			return;
+		collect_overlapping (n->lchild, first_row, last_row, first_col, last_col, out);
+		/* This node and the right subtree all start below last_row */
+		if (n->top > last_row)
+			return;
+		if (n->bottom >= first_row && n->right >= first_col && n->left <= last_col)
+			out.push_back (n);
+		collect_overlapping (n->rchild, first_row, last_row, first_col, last_col, out);
+	}
+
+	static void collect_by_top (node const *n, glong first_row, glong last_row, std::vector<T *> &out)
+	{
+		if (n == NULL)
+			return;
+		if (n->top >= first_row)
+			collect_by_top (n->lchild, first_row, last_row, out);
+		if (n->top >= first_row && n->top <= last_row)
+			out.push_back (n->image);
+		if (n->top <= last_row)
+			collect_by_top (n->rchild, first_row, last_row, out);
+	}
+
+	static void free_nodes (node *n)
+	{
+		if (n == NULL)
+			return;
+		free_nodes (n->lchild);
+		free_nodes (n->rchild);
+		delete n;
+	}
+
+	guint32 next_priority ()
+	{
+		/* xorshift32; the treap only needs the priorities to look random */
+		m_random ^= m_random << 13;
+		m_random ^= m_random >> 17;
+		m_random ^= m_random << 5;
+		return m_random;
+	}
+
+public:
+	image_index () : m_root (NULL), m_seq (0), m_random (0x9e3779b9u) {}
+	~image_index () { free_nodes (m_root); }
+
+	image_index (image_index const &) = delete;
+	image_index &operator= (image_index const &) = delete;
+
+	bool empty () const { return m_nodes.empty (); }
+	gsize size () const { return m_nodes.size (); }
+	bool contains (T const *image) const { return m_nodes.count (image) != 0; }
+
+	/* Adds @image as the newest one, which is painted over the others */
+	void insert (T *image)
+	{
+		g_assert_true (image != NULL);
+		g_assert_false (contains (image));
+
+		node *n = new node;
+		n->image = image;
+		n->top = image->get_top ();
+		n->bottom = n->top + image->get_height () - 1;
+		n->left = image->get_left ();
+		n->right = n->left + image->get_width () - 1;
+		n->seq = m_seq++;
+		n->priority = next_priority ();
+		n->lchild = n->rchild = NULL;
+		pull (n);
+
+		node *l, *r;
+		split (m_root, n->top, n->seq, &l, &r);
+		m_root = merge (merge (l, n), r);
+		m_by_bottom.insert (n);
+		m_nodes[image] = n;
+	}
+
+	/* Removes @image without deleting it; returns false if it isn't indexed */
+	bool remove (T const *image)
+	{
+		auto it = m_nodes.find (image);
+		if (it == m_nodes.end ())
+			return false;
+		node *n = it->second;
+		m_nodes.erase (it);
+		m_by_bottom.erase (n);
+
+		node *l, *m, *r;
+		split (m_root, n->top, n->seq, &l, &m);
+		split (m, n->top, n->seq + 1, &m, &r);
+		g_assert_true (m == n && n->lchild == NULL && n->rchild == NULL);
+		m_root = merge (l, r);
+		delete n;
+		return true;
+	}
+
+	/* Re-records the extents of @image and makes it the newest one */
+	void update (T *image)
+	{
+		remove (image);
+		insert (image);
+	}
+
+	/* The image with the topmost bottom row, oldest first on ties */
+	T *oldest () const
+	{
+		return m_by_bottom.empty () ? NULL : (*m_by_bottom.begin ())->image;
+	}
+
+	/* Appends the images intersecting the given rows and columns (inclusive)
+	 * to @out, in insertion order
+	 */
+	void find_overlapping (glong first_row, glong last_row, glong first_col, glong last_col,
+	                       std::vector<T *> &out) const
+	{
+		std::vector<node const *> nodes;
+		collect_overlapping (m_root, first_row, last_row, first_col, last_col, nodes);
+		std::sort (nodes.begin (), nodes.end (),
+		           [] (node const *a, node const *b) { return a->seq < b->seq; });
+		for (auto n : nodes)
+			out.push_back (n->image);
+	}
+
+	void find_overlapping (glong first_row, glong last_row, std::vector<T *> &out) const
+	{
+		find_overlapping (first_row, last_row, G_MINLONG, G_MAXLONG, out);
+	}
+
+	/* Appends the images whose bottom row is within [first_row, last_row]
+	 * to @out, ordered by bottom row
+	 */
+	void find_by_bottom (glong first_row, glong last_row, std::vector<T *> &out) const
+	{
+		node key;
+		key.bottom = first_row;
+		key.seq = 0;
+		for (auto it = m_by_bottom.lower_bound (&key); it != m_by_bottom.end () && (*it)->bottom <= last_row; ++it)
+			out.push_back ((*it)->image);
+	}
+
+	/* Appends the images whose top row is within [first_row, last_row]
+	 * to @out, ordered by top row
+	 */
+	void find_by_top (glong first_row, glong last_row, std::vector<T *> &out) const
+	{
+		collect_by_top (m_root, first_row, last_row, out);
+	}
+
+	/* Calls @func on every image, ordered by bottom row */
+	template <class F>
+	void foreach (F func) const
+	{
+		for (auto n : m_by_bottom)
+			func (n->image);
+	}
+
+	/* Forgets all images without deleting them */
+	void clear ()
+	{
+		free_nodes (m_root);
+		m_root = NULL;
+		m_by_bottom.clear ();
+		m_nodes.clear ();
+	}
+};
+
+} // namespace image
+
+} // namespace vte
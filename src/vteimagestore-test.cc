@@ -0,0 +1,227 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include <memory>
+#include <vector>
+
+#include "vteimagestore.h"
+#include "vtedefines.hh"
+
+using namespace vte::image;
+
+static std::vector<char>
+make_record(gsize len,
+            guint64 seed)
+{
+        auto data = std::vector<char>(len);
+        for (auto i = gsize{0}; i < len; ++i)
+                data[i] = (char)((i * 31 + seed * 7) >> 3);
+        return data;
+}
+
+static void
+assert_record(image_store const& store,
+              guint64 id,
+              std::vector<char> const& expected)
+{
+        auto data = std::vector<char>(expected.size());
+        g_assert_true(store.read(id, data.data(), data.size()));
+        g_assert_true(data == expected);
+}
+
+static void
+test_store_basic(void)
+{
+        image_store store;
+        g_assert_false(store.contains(0));
+
+        auto a = make_record(1000, 1);
+        auto b = make_record(5, 2);
+        auto ida = store.append(a.data(), a.size());
+        auto idb = store.append(b.data(), b.size());
+        g_assert_cmpuint(ida, !=, 0);
+        g_assert_cmpuint(ida, !=, idb);
+        g_assert_cmpuint(store.get_live_size(), ==, 1005);
+        g_assert_cmpuint(store.get_size(), ==, 1005);
+
+        assert_record(store, ida, a);
+        assert_record(store, idb, b);
+
+        /* Shorter reads are fine, longer ones aren't */
+        char c;
+        g_assert_true(store.read(ida, &c, 1));
+        g_assert_cmpint(c, ==, a[0]);
+        auto longer = std::vector<char>(6);
+        g_assert_false(store.read(idb, longer.data(), longer.size()));
+
+        /* The space before the oldest record is given back right away */
+        store.release(ida);
+        g_assert_false(store.contains(ida));
+        g_assert_false(store.read(ida, &c, 1));
+        g_assert_cmpuint(store.get_size(), ==, 5);
+
+        store.release(0);
+        store.release(ida);
+
+        store.clear();
+        g_assert_false(store.contains(idb));
+        g_assert_cmpuint(store.get_size(), ==, 0);
+        g_assert_cmpuint(store.get_live_size(), ==, 0);
+}
+
+static void
+test_store_compact(void)
+{
+        image_store store;
+        auto const len = gsize{VTE_IMAGE_STORE_SEGMENT_SIZE / 16 + 123};
+
+        /* One long-lived record, and a lot of short-lived ones after it */
+        auto pinned = make_record(len, 0);
+        auto pinned_id = store.append(pinned.data(), pinned.size());
+
+        auto ids = std::vector<guint64>{};
+        auto records = std::vector<std::vector<char>>{};
+        for (auto i = 1; i <= 100; ++i) {
+                records.push_back(make_record(len, i));
+                ids.push_back(store.append(records.back().data(), len));
+        }
+
+        /* Keep every tenth */
+        for (auto i = 0u; i < ids.size(); ++i)
+                if (i % 10)
+                        store.release(ids[i]);
+        g_assert_cmpuint(store.get_size(), ==, 101 * len);
+        g_assert_cmpuint(store.get_live_size(), ==, 11 * len);
+
+        /* Nothing happens past the deadline */
+        g_assert_true(store.compact(0));
+        g_assert_cmpuint(store.get_size(), ==, 101 * len);
+
+        g_assert_false(store.compact(G_MAXINT64));
+        g_assert_cmpuint(store.get_live_size(), ==, 11 * len);
+        g_assert_cmpuint(store.get_size(), <, 2 * 11 * len + VTE_IMAGE_STORE_SEGMENT_SIZE);
+
+        /* The records moved, their IDs didn't */
+        assert_record(store, pinned_id, pinned);
+        for (auto i = 0u; i < ids.size(); ++i) {
+                g_assert_cmpint(store.contains(ids[i]), ==, i % 10 == 0);
+                if (i % 10 == 0)
+                        assert_record(store, ids[i], records[i]);
+        }
+
+        /* Releasing the rest gives everything back */
+        store.release(pinned_id);
+        for (auto i = 0u; i < ids.size(); i += 10)
+                store.release(ids[i]);
+        g_assert_cmpuint(store.get_size(), ==, 0);
+        g_assert_cmpuint(store.get_n_records(), ==, 0);
+}
+
+static void
+test_store_refs(void)
+{
+        image_store store;
+        auto a = make_record(100, 1);
+        auto source = std::make_shared<int>(0);
+        auto other = std::make_shared<int>(1);
+
+        auto id = store.append(a.data(), a.size());
+        g_assert_cmpuint(store.lookup(source), ==, 0);
+        store.set_source(id, source);
+        g_assert_cmpuint(store.lookup(source), ==, id);
+        g_assert_cmpuint(store.lookup(other), ==, 0);
+        g_assert_cmpuint(store.get_length(id), ==, 100);
+
+        /* A source keeps its first record */
+        auto b = make_record(50, 2);
+        auto idb = store.append(b.data(), b.size());
+        store.set_source(idb, source);
+        g_assert_cmpuint(store.lookup(source), ==, id);
+        store.release(idb);
+
+        /* Released with the last reference */
+        g_assert_cmpuint(store.ref(id), ==, id);
+        g_assert_cmpuint(store.get_refs(id), ==, 2);
+        store.release(id);
+        g_assert_true(store.contains(id));
+        assert_record(store, id, a);
+        g_assert_cmpuint(store.get_live_size(), ==, 100);
+        store.release(id);
+        g_assert_false(store.contains(id));
+        g_assert_cmpuint(store.get_refs(id), ==, 0);
+        g_assert_cmpuint(store.lookup(source), ==, 0);
+
+        /* A record is found by what it's a copy of now, even once that's gone */
+        id = store.append(a.data(), a.size());
+        store.set_source(id, source);
+        store.set_source(id, other);
+        g_assert_cmpuint(store.lookup(source), ==, 0);
+        g_assert_cmpuint(store.lookup(other), ==, id);
+        auto weak = std::weak_ptr<int>(other);
+        other.reset();
+        g_assert_true(weak.expired());
+        g_assert_cmpuint(store.lookup(std::make_shared<int>(1)), ==, 0);
+        store.release(id);
+        g_assert_cmpuint(store.get_n_records(), ==, 0);
+}
+
+static void
+test_store_random(void)
+{
+        auto rand = g_rand_new_with_seed(18);
+        image_store store;
+        auto live = std::vector<std::pair<guint64, std::vector<char>>>{};
+
+        for (auto round = 0; round < 2000; ++round) {
+                if (live.empty() || g_rand_int_range(rand, 0, 3)) {
+                        auto record = make_record(g_rand_int_range(rand, 1, 100000), round);
+                        auto id = store.append(record.data(), record.size());
+                        live.emplace_back(id, std::move(record));
+                } else {
+                        auto i = g_rand_int_range(rand, 0, live.size());
+                        store.release(live[i].first);
+                        live.erase(live.begin() + i);
+                }
+
+                if (round % 50 == 0)
+                        store.compact(G_MAXINT64);
+        }
+
+        store.compact(G_MAXINT64);
+        for (auto const& entry : live)
+                assert_record(store, entry.first, entry.second);
+        g_assert_cmpuint(store.get_n_records(), ==, live.size());
+
+        g_rand_free(rand);
+}
+
+int
+main(int argc,
+     char* argv[])
+{
+        g_test_init(&argc, &argv, nullptr);
+
+        g_test_add_func("/vte/image/store/basic", test_store_basic);
+        g_test_add_func("/vte/image/store/compact", test_store_compact);
+        g_test_add_func("/vte/image/store/refs", test_store_refs);
+        g_test_add_func("/vte/image/store/random", test_store_random);
+
+        return g_test_run();
+}
@@ -0,0 +1,283 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+#include <glib.h>
+#include <vector>
+#include "vteimagestore.h"
+#include "vtedefines.hh"
+#include "debug.h"
+
+namespace vte {
+
+namespace image {
+
+image_store::image_store ()
+	: m_stream (_vte_file_stream_new ()),
+	  m_next_id (1),
+	  m_live_size (0),
+	  m_compact_tag (0)
+{
+}
+
+image_store::~image_store ()
+{
+	if (m_compact_tag != 0)
+		g_source_remove (m_compact_tag);
+	g_object_unref (m_stream);
+}
+
+/* Bytes between the tail and the head of the log, free or not */
+gsize
+image_store::get_size () const
+{
+	return _vte_stream_head (m_stream) - _vte_stream_tail (m_stream);
+}
+
+/* Write a record; returns its ID, which is never 0 */
+guint64
+image_store::append (char const *data, gsize len)
+{
+	guint64 id = m_next_id++;
+	record r = { _vte_stream_head (m_stream), len, 1, source_ref () };
+
+	_vte_stream_append (m_stream, data, len);
+	m_records.emplace (id, r);
+	m_by_offset.emplace (r.offset, id);
+	m_live_size += len;
+
+	return id;
+}
+
+/* Read the first @len bytes of a record */
+bool
+image_store::read (guint64 id, char *data, gsize len) const
+{
+	auto it = m_records.find (id);
+
+	if (it == m_records.end () || len > it->second.length)
+		return false;
+
+	return _vte_stream_read (m_stream, it->second.offset, data, len);
+}
+
+bool
+image_store::contains (guint64 id) const
+{
+	return m_records.count (id) != 0;
+}
+
+/* Take another reference to a record; returns @id */
+guint64
+image_store::ref (guint64 id)
+{
+	auto it = m_records.find (id);
+
+	if (it != m_records.end ())
+		it->second.refs++;
+
+	return id;
+}
+
+/* Let go of a reference to a record; 0 is no record */
+void
+image_store::release (guint64 id)
+{
+	auto it = m_records.find (id);
+
+	if (it == m_records.end () || --it->second.refs > 0)
+		return;
+
+	erase (it);
+
+	drop_free_tail ();
+	if (needs_compaction ())
+		queue_compaction ();
+}
+
+void
+image_store::erase (std::unordered_map<guint64, record>::iterator it)
+{
+	auto source = m_by_source.find (it->second.source);
+
+	if (source != m_by_source.end () && source->second == it->first)
+		m_by_source.erase (source);
+	m_by_offset.erase (it->second.offset);
+	m_live_size -= it->second.length;
+	m_records.erase (it);
+}
+
+/* Note that a record is a copy of @source, in place of what it was a copy
+ * of before, so lookup() finds it; a source keeps the first record it's given
+ */
+void
+image_store::set_source (guint64 id, std::shared_ptr<void const> const &source)
+{
+	auto it = m_records.find (id);
+
+	if (it == m_records.end () || ! source || ! m_by_source.emplace (source, id).second)
+		return;
+
+	auto old = m_by_source.find (it->second.source);
+	if (old != m_by_source.end () && old->second == id)
+		m_by_source.erase (old);
+	it->second.source = source;
+}
+
+/* The record that's a copy of @source, or 0 */
+guint64
+image_store::lookup (std::shared_ptr<void const> const &source) const
+{
+	auto it = m_by_source.find (source);
+
+	return it == m_by_source.end () ? 0 : it->second;
+}
+
+gsize
+image_store::get_length (guint64 id) const
+{
+	auto it = m_records.find (id);
+
+	return it == m_records.end () ? 0 : it->second.length;
+}
+
+/* The number of references to a record, 0 if there's no such record */
+guint
+image_store::get_refs (guint64 id) const
+{
+	auto it = m_records.find (id);
+
+	return it == m_records.end () ? 0 : it->second.refs;
+}
+
+/* Call @func with the IDs of the records compact() couldn't read back */
+void
+image_store::set_lost_func (lost_func_t func)
+{
+	m_lost_func = std::move (func);
+}
+
+/* Release all records */
+void
+image_store::clear ()
+{
+	m_records.clear ();
+	m_by_offset.clear ();
+	m_by_source.clear ();
+	m_live_size = 0;
+	_vte_stream_reset (m_stream, _vte_stream_head (m_stream));
+}
+
+/* Advance the tail up to the oldest record, which costs nothing */
+void
+image_store::drop_free_tail ()
+{
+	gsize first = m_by_offset.empty () ? _vte_stream_head (m_stream) : m_by_offset.begin ()->first;
+
+	if (first > _vte_stream_tail (m_stream))
+		_vte_stream_advance_tail (m_stream, first);
+}
+
+/* Whether at least a segment, and half the log, is free */
+bool
+image_store::needs_compaction () const
+{
+	gsize size = get_size ();
+	gsize free_size = size - m_live_size;
+
+	return free_size >= VTE_IMAGE_STORE_SEGMENT_SIZE && free_size * 2 >= size;
+}
+
+void
+image_store::queue_compaction ()
+{
+	if (m_compact_tag != 0)
+		return;
+
+	m_compact_tag = g_timeout_add_full (G_PRIORITY_LOW,
+	                                    VTE_IMAGE_STORE_COMPACT_INTERVAL,
+	                                    (GSourceFunc)compact_timeout_cb,
+	                                    this,
+	                                    NULL);
+}
+
+gboolean
+image_store::compact_timeout_cb (image_store *store)
+{
+	if (store->compact (g_get_monotonic_time () + VTE_IMAGE_STORE_COMPACT_BUDGET))
+		return G_SOURCE_CONTINUE;
+
+	store->m_compact_tag = 0;
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * Move the records in the segment at the tail to the head, and advance the
+ * tail past it, until the log doesn't need compacting any more or the
+ * @deadline passes. Returns whether there's more to do.
+ */
+bool
+image_store::compact (gint64 deadline)
+{
+	std::vector<char> data;
+	std::vector<guint64> lost;
+	bool more = false;
+
+	while (needs_compaction ()) {
+		if (g_get_monotonic_time () >= deadline) {
+			more = true;
+			break;
+		}
+
+		/* The head is past the segment, as at least a segment is free */
+		gsize segment_end = _vte_stream_tail (m_stream) + VTE_IMAGE_STORE_SEGMENT_SIZE;
+
+		while (! m_by_offset.empty () && m_by_offset.begin ()->first < segment_end) {
+			auto first = m_by_offset.begin ();
+			guint64 id = first->second;
+			record &r = m_records[id];
+
+			m_by_offset.erase (first);
+			data.resize (r.length);
+			if (! _vte_stream_read (m_stream, r.offset, data.data (), r.length)) {
+				/* Lost already; the images can't be thawed either way */
+				erase (m_records.find (id));
+				lost.push_back (id);
+				continue;
+			}
+
+			r.offset = _vte_stream_head (m_stream);
+			_vte_stream_append (m_stream, data.data (), r.length);
+			m_by_offset.emplace (r.offset, id);
+		}
+
+		drop_free_tail ();
+	}
+
+	_vte_debug_print (VTE_DEBUG_IMAGE,
+	                  "image store compacted, %zu of %zu bytes in use, %zu records lost\n",
+	                  m_live_size, get_size (), lost.size ());
+
+	/* Last, as the images let go of their records meanwhile */
+	if (! lost.empty () && m_lost_func)
+		m_lost_func (lost);
+
+	return more;
+}
+
+} // namespace image
+
+} // namespace vte
@@ -0,0 +1,110 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <glib.h>
+#include "vtestream.h"
+
+namespace vte {
+
+namespace image {
+
+/*
+ * Where frozen images are kept: records of any size, each one written
+ * and released on its own, in a VteFileStream, so they're compressed and
+ * encrypted on disk like the scrollback is.
+ *
+ * The stream is a log divided into segments of VTE_IMAGE_STORE_SEGMENT_SIZE
+ * bytes. Records are appended at the head; releasing one only counts its
+ * bytes as free. Once a good part of the log is free, the records still in
+ * the segment at the tail are copied to the head, a few at a time in a low
+ * priority timeout, and the tail advances past the segment, which gives its
+ * space back. So one long-lived image doesn't keep the images frozen after
+ * it on disk.
+ *
+ * Records are known by an ID that stays the same when they're moved.
+ * A record can be referenced more than once, e.g. by identical images that
+ * share their pixels: it can be looked up by the object it's a copy of,
+ * and is only released with its last reference.
+ * Records that can't be read back when they're moved are dropped, and
+ * their IDs reported to the lost function, so the owner can let go of
+ * the images frozen into them.
+ * The store is used from the main thread only.
+ */
+class image_store {
+public:
+	typedef std::function<void (std::vector<guint64> const &ids)> lost_func_t;
+
+private:
+	typedef std::weak_ptr<void const> source_ref;
+
+	struct record {
+		gsize offset;
+		gsize length;
+		guint refs;
+		source_ref source;      /* what the record is a copy of, if known */
+	};
+
+	VteStream *m_stream;
+	std::unordered_map<guint64, record> m_records;
+	std::map<gsize, guint64> m_by_offset;   /* the records by their offset, from the tail */
+	std::map<source_ref, guint64, std::owner_less<source_ref>> m_by_source;
+	guint64 m_next_id;
+	gsize m_live_size;                      /* bytes of the records */
+	guint m_compact_tag;                    /* timeout ID for compacting in the background */
+	lost_func_t m_lost_func;                /* told about the records compact() dropped */
+
+	void erase (std::unordered_map<guint64, record>::iterator it);
+	bool needs_compaction () const;
+	void queue_compaction ();
+	void drop_free_tail ();
+	static gboolean compact_timeout_cb (image_store *store);
+
+public:
+	image_store ();
+	~image_store ();
+
+	image_store (image_store const &) = delete;
+	image_store &operator= (image_store const &) = delete;
+
+	guint64 append (char const *data, gsize len);
+	bool read (guint64 id, char *data, gsize len) const;
+	bool contains (guint64 id) const;
+	guint64 ref (guint64 id);
+	void release (guint64 id);
+	void set_source (guint64 id, std::shared_ptr<void const> const &source);
+	guint64 lookup (std::shared_ptr<void const> const &source) const;
+	gsize get_length (guint64 id) const;
+	guint get_refs (guint64 id) const;
+	void set_lost_func (lost_func_t func);
+	void clear ();
+	bool compact (gint64 deadline);
+
+	gsize get_live_size () const { return m_live_size; }
+	gsize get_size () const;
+	gsize get_n_records () const { return m_records.size (); }
+};
+
+} // namespace image
+
+} // namespace vte
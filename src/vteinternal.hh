@@ -53,6 +53,8 @@
 #include "vtepcre2.h"
 #include "vteregexinternal.hh"
 #include "sixel.h"
+#include "vteimage.h"
+#include "vteimageindex.h"
 
 #include "chunk.hh"
 #include "utf8.hh"
@@ -497,7 +499,22 @@ public:
         gboolean m_sixel_scrolls_right;
         gboolean m_sixel_use_private_register;
         sixel_state_t m_sixel_state;
+        bool m_sixel_streaming{false};  /* feeding a DECSIXEL data string straight to m_sixel_state */
+        uint8_t m_sixel_lead_byte{0};  /* UTF-8 lead byte the last chunk of the data string ended in */
+        vte::image::image_object* m_sixel_preview{nullptr};  /* the part of the streamed image decoded so far */
+        cairo_surface_t* m_sixel_preview_surface{nullptr};
+        VteRing* m_sixel_preview_ring{nullptr};  /* the ring m_sixel_preview is charged to */
+        int m_sixel_preview_rows{0};  /* pixel rows of m_sixel_preview_surface already rendered */
         gulong m_freezed_image_limit;
+        std::vector<std::pair<VteRing*, vte::image::image_object*>> m_image_freeze_queue;  /* scrolled out of view, to be frozen */
+        guint m_image_freeze_tag{0};  /* timeout ID for working through m_image_freeze_queue */
+        long m_image_prefetch_rows;  /* rows above and below the view whose images are thawed ahead of time */
+        double m_scroll_velocity{0.0};  /* rows per second, negative when scrolling up */
+        gint64 m_scroll_time{0};  /* of the last vadjustment change, in µs */
+        std::vector<std::pair<VteRing*, vte::image::image_object*>> m_image_prefetch_queue;  /* thawing or thawed ahead of time */
+        guint m_image_prefetch_tag{0};  /* timeout ID for taking finished thaws */
+        GList* m_image_terminals_link;  /* in the terminals sharing the image memory budget */
+        gsize m_image_memory_notified{0};  /* image bytes at the last image-memory-changed */
         gboolean m_sixel_enabled;
 
 	/* State variables for handling match checks. */
@@ -695,6 +712,10 @@ public:
         void insert_char(gunichar c,
                          bool insert,
                          bool invalidate_now);
+        template<typename T>
+        size_t insert_text_run(T const* text,
+                               size_t len,
+                               int columns);
 
         void invalidate_row(vte::grid::row_t row);
         void invalidate_rows(vte::grid::row_t row_start,
@@ -715,6 +736,12 @@ public:
         bool invalidate_dirty_rects_and_process_updates();
         void time_process_incoming();
         void process_incoming();
+        uint8_t const* process_incoming_decsixel(uint8_t const* ip,
+                                                 uint8_t const* iend);
+        void update_sixel_preview();
+        void clear_sixel_preview();
+        void cancel_decsixel();
+        size_t sixel_preview_resource_size() const;
         bool process(bool emit_adj_changed);
         inline bool is_processing() const { return m_active_terminals_link != nullptr; }
         void start_processing();
@@ -1213,6 +1240,7 @@ public:
         bool set_font_desc(PangoFontDescription const* desc);
         bool set_font_scale(double scale);
         bool set_freezed_image_limit(gulong limit);
+        bool set_image_prefetch_rows(long rows);
         bool set_input_enabled(bool enabled);
         bool set_mouse_autohide(bool autohide);
         bool set_pty(VtePty *pty,
@@ -1308,7 +1336,7 @@ public:
                                                       int index_fallback,
                                                       int osc,
                                                       char const *terminator);
-        void seq_load_sixel(char const* p);
+        void seq_load_sixel();
 // =======
         inline void set_cursor_coords1(vte::grid::row_t row /* relative to scrolling region */,
                                        vte::grid::column_t column); /* 1-based */
@@ -1352,6 +1380,25 @@ public:
 private:
         void freeze_hidden_images_before_view_area(double start_pos, double end_pos);
         void freeze_hidden_images_after_view_area(double start_pos, double end_pos);
+        void queue_image_freeze(VteRing* ring, vte::image::image_object* image);
+        bool process_image_freeze_queue();
+        void clear_image_freeze_queue();
+        static gboolean image_freeze_timeout_cb(Terminal* that);
+        double get_scroll_velocity() const;
+        void get_image_prefetch_window(vte::grid::row_t* first_row, vte::grid::row_t* last_row);
+        void prefetch_images();
+        bool process_image_prefetch_queue();
+        void clear_image_prefetch_queue();
+        static gboolean image_prefetch_timeout_cb(Terminal* that);
+        void get_image_memory_usage(gsize* resident, gsize* frozen) const;
+        static void get_image_memory_totals(gsize* resident, gsize* frozen);
+        static void set_image_memory_limits(gsize resident, gsize frozen);
+        static void get_image_memory_limits(gsize* resident, gsize* frozen);
+        bool image_is_visible(VteRing* ring, vte::image::image_object* image);
+        static void queue_image_budget_check();
+        static gboolean image_budget_timeout_cb(gpointer data);
+        static void enforce_image_budget();
+        void emit_image_memory_changed();
         void maybe_remove_images();
 // =======
         void send(vte::parser::u8SequenceBuilder const& builder,
@@ -111,60 +111,6 @@ vte::parser::Sequence::command_string() const
         }
 }
 
-// FIXMEchpe optimise this
-std::string
-vte::parser::Sequence::string_utf8() const noexcept
-{
-        std::string str;
-
-        size_t len;
-        auto buf = vte_seq_string_get(&m_seq->arg_str, &len);
-
-        char u[6];
-        for (size_t i = 0; i < len; ++i) {
-                auto ulen = g_unichar_to_utf8(buf[i], u);
-                str.append((char const*)u, ulen);
-        }
-
-        return str;
-}
-
-/* A couple are duplicated from vte.c, to keep them static... */
-
-/* Check how long a string of unichars is.  Slow version. */
-static gsize
-vte_unichar_strlen(gunichar const* c)
-{
-	gsize i;
-	for (i = 0; c[i] != 0; i++) ;
-	return i;
-}
-
-/* Convert a wide character string to a multibyte string */
-/* Simplified from glib's g_ucs4_to_utf8() to simply allocate the maximum
- * length instead of walking the input twice.
- */
-char*
-vte::parser::Sequence::ucs4_to_utf8(gunichar const* str,
-                                    ssize_t len) const noexcept
-{
-        if (len < 0)
-                len = vte_unichar_strlen(str);
-        auto outlen = (len * VTE_UTF8_BPC) + 1;
-
-        auto result = (char*)g_try_malloc(outlen);
-        if (result == nullptr)
-                return nullptr;
-
-        auto end = str + len;
-        auto p = result;
-        for (auto i = str; i < end; i++)
-                p += g_unichar_to_utf8(*i, p);
-        *p = '\0';
-
-        return result;
-}
-
 namespace vte {
 namespace terminal {
 
@@ -2794,141 +2740,61 @@ Terminal::DAQ(vte::parser::Sequence const& seq)
          */
 }
 
-static void
-vte_sequence_handler_device_control_string (VteTerminalPrivate *that, GValueArray *params)
-{
-	GValue *value;
-	char *dcs = NULL;
-	char *p;
-	glong cmd = 0;
-	gint param;
-	size_t nparams = 0;
-	gint dcsparams[DECSIXEL_PARAMS_MAX];
-
-	value = g_value_array_get_nth(params, 0);
-	if (!value)
-		return;
-	if (G_VALUE_HOLDS_STRING(value)) {
-		/* Copy the string into the buffer. */
-		dcs = g_value_dup_string(value);
-	}
-	else if (G_VALUE_HOLDS_POINTER(value)) {
-		dcs = that->ucs4_to_utf8((const guchar *)g_value_get_pointer (value));
-	}
-	if (! dcs)
-		return;
-
-	for (p = dcs; p; ++p) {
-		switch (*p) {
-		case ' ' ... '/':
-			cmd = cmd << 8 | *p;
-			if (cmd > (1 << 24))
-				goto end;
-			break;
-		case '0' ... '9':
-			if (param < 0)
-				param = 0;
-			param = param * 10 + *p - '0';
-			break;
-		case ';':
-			if (param < 0)
-				param = 0;
-			if (nparams < sizeof(dcsparams) / sizeof(dcsparams[0]))
-				dcsparams[nparams++] = param;
-			param = 0;
-			break;
-		case '@' ... '~':
-			cmd = cmd << 8 | *p;
-			goto dispatch;
-		default:
-		    goto end;
-		}
-	}
-
-dispatch:
-	switch (cmd) {
-	case 'q':
-		if (that->m_sixel_enabled)
-			that->seq_load_sixel(dcs);
-		break;
-	default:
-		break;
-	}
-
-end:
-	g_free(dcs);
-}
-
 void
-VteTerminalPrivate::seq_load_sixel(char const* dcs)
+Terminal::seq_load_sixel()
 {
-	unsigned char *pixels = NULL;
-	auto fg = get_color(VTE_DEFAULT_FG);
-	auto bg = get_color(VTE_DEFAULT_BG);
-	int nfg = fg->red >> 8 | fg->green >> 8 << 8 | fg->blue >> 8 << 16;
-	int nbg = bg->red >> 8 | bg->green >> 8 << 8 | bg->blue >> 8 << 16;
 	glong left, top, width, height;
-	glong pixelwidth, pixelheight;
+	int pixelwidth, pixelheight;
+	unsigned int palette[DECSIXEL_PALETTE_MAX];
+	int ncolors;
 	glong i;
-	cairo_surface_t *image_surface, *surface;
-	cairo_t *cr;
 
-	/* Parse images */
-	if (sixel_parser_init(&m_sixel_state, nfg, nbg, m_sixel_use_private_register) < 0) {
-		sixel_parser_deinit(&m_sixel_state);
-		return;
-	}
-	if (sixel_parser_parse(&m_sixel_state, (unsigned char *)dcs, strlen(dcs)) < 0) {
-		sixel_parser_deinit(&m_sixel_state);
-		return;
-	}
-	pixels = (unsigned char *)g_malloc(m_sixel_state.image.width * m_sixel_state.image.height * 4);
-	if (! pixels) {
-		sixel_parser_deinit(&m_sixel_state);
-		return;
-	}
-	if (sixel_parser_finalize(&m_sixel_state, pixels) < 0) {
+	clear_sixel_preview();
+
+	if (sixel_parser_finalize(&m_sixel_state, &pixelwidth, &pixelheight) < 0 ||
+	    pixelwidth <= 0 || pixelheight <= 0) {
 		sixel_parser_deinit(&m_sixel_state);
 		return;
 	}
+
+	/* Keep the image as palette indices; it gets its ARGB32 pixels
+	 * only when it's painted, and may lose them again while it's kept.
+	 */
+	auto indexed = std::make_shared<vte::image::indexed_image>();
+	ncolors = sixel_parser_get_palette(&m_sixel_state, palette);
+	indexed->width = pixelwidth;
+	indexed->height = pixelheight;
+	indexed->index_size = ncolors <= 256 ? 1 : 2;
+	indexed->palette.assign(palette, palette + ncolors);
+	indexed->indices.resize((gsize)pixelwidth * pixelheight * indexed->index_size);
+	sixel_parser_render_indices(&m_sixel_state,
+	                            indexed->indices.data(),
+	                            pixelwidth * indexed->index_size,
+	                            indexed->index_size,
+	                            pixelwidth, 0, pixelheight);
 	sixel_parser_deinit(&m_sixel_state);
 
 	if (m_sixel_display_mode)
-		seq_home_cursor();
+		home_cursor();
 
-	/* Append new image to VteRing */
 	left = m_screen->cursor.col;
 	top = m_screen->cursor.row;
-	width = (m_sixel_state.image.width + m_char_width - 1) / m_char_width;
-	height = (m_sixel_state.image.height + m_char_height - 1) / m_char_height;
-	pixelwidth = m_sixel_state.image.width;
-	pixelheight = m_sixel_state.image.height;
-
-	/* create image surface (in-memory, device-independant) */
-	image_surface = cairo_image_surface_create_for_data (pixels, CAIRO_FORMAT_ARGB32, pixelwidth, pixelheight, pixelwidth * 4);
-	g_assert (image_surface);
-
-	/* create device-dependant surface compatible with m_widget */
-	surface = gdk_window_create_similar_surface (gtk_widget_get_window (m_widget), CAIRO_CONTENT_COLOR_ALPHA, pixelwidth, pixelheight);
-	g_assert (surface);
-
-	/* copy image surface to a device-compatible surface */
-	cr = cairo_create (surface);
-	cairo_set_source_surface (cr, image_surface, 0, 0);
-	cairo_paint (cr);
-	cairo_destroy (cr);
-	cairo_surface_destroy (image_surface);
-	free (pixels);
-
-	/* create image object */
-	_vte_ring_append_image (m_screen->row_data, surface, pixelwidth, pixelheight, left, top, width, height);
+	width = (pixelwidth + m_cell_width - 1) / m_cell_width;
+	height = (pixelheight + m_cell_height - 1) / m_cell_height;
+
+	/* Append new image to VteRing, tile by tile; tiles identical to
+	 * ones kept already, e.g. of a dashboard redrawn, share their pixels */
+	for (auto tile : vte::image::image_object::create_tiles(std::move(indexed), left, top,
+	                                                         m_cell_width, m_cell_height,
+	                                                         m_screen->row_data->image_store))
+		_vte_ring_append_image (m_screen->row_data, tile, m_cell_width, m_cell_height);
 
 	/* Erase characters on the image */
 	for (i = 0; i < height; ++i) {
-		seq_erase_characters(width);
+		erase_characters(width);
 		if (i == height - 1) {
 			if (m_sixel_scrolls_right)
-				seq_cursor_forward(width);
+				move_cursor_forward(width);
 			else
 				cursor_down(true);
 		} else {
@@ -2936,7 +2802,7 @@ VteTerminalPrivate::seq_load_sixel(char const* dcs)
 		}
 	}
 	if (m_sixel_display_mode)
-		seq_home_cursor();
+		home_cursor();
 }
 
 void
@@ -4213,7 +4079,7 @@ Terminal::DECRQSS(vte::parser::Sequence const& seq)
         auto const str = seq.string();
         size_t i;
         for (i = 0; i < str.size(); ++i) {
-                auto const c = str[i];
+                auto const c = uint8_t(str[i]);
                 if (c < 0x20 || c >= 0x7f)
                         break;
                 rv = parser.feed(c);
@@ -4813,8 +4679,61 @@ Terminal::DECSIXEL(vte::parser::Sequence const& seq)
         /*
          * DECSIXEL - SIXEL graphics
          *
+         * Arguments:
+         *   args[0]: pixel aspect ratio (obsolete, use DECGRA instead)
+         *   args[1]: background select
+         *   args[2]: horizontal grid size (ignored)
+         *   DATA: the sixel data
+         *
+         * The DATA string is not collected by the parser; instead
+         * this is dispatched unripe on receiving the final character,
+         * and the data is then fed straight from the incoming chunks
+         * into the sixel decoder by process_incoming_decsixel().
+         * When the string terminator is received, this is dispatched
+         * again, ripe, and the decoded image is inserted.
+         *
          * References: VT330
          */
+
+        if (seq.is_unripe()) {
+                /* Drop any image left over from a cancelled DECSIXEL */
+                sixel_parser_deinit(&m_sixel_state);
+                clear_sixel_preview();
+
+                if (!m_sixel_enabled)
+                        return;
+
+                /* The image is shown progressively while it's streamed,
+                 * so place the cursor where it will be inserted already.
+                 */
+                if (m_sixel_display_mode)
+                        home_cursor();
+
+                auto const fg = get_color(VTE_DEFAULT_FG);
+                auto const bg = get_color(VTE_DEFAULT_BG);
+                int const nfg = fg->red >> 8 | fg->green >> 8 << 8 | fg->blue >> 8 << 16;
+                int const nbg = bg->red >> 8 | bg->green >> 8 << 8 | bg->blue >> 8 << 16;
+
+                if (sixel_parser_init(&m_sixel_state, nfg, nbg, m_sixel_use_private_register) < 0) {
+                        sixel_parser_deinit(&m_sixel_state);
+                        return;
+                }
+
+                int params[3];
+                for (unsigned int i = 0; i < G_N_ELEMENTS(params); ++i)
+                        params[i] = seq.param(i, 0);
+                sixel_parser_start(&m_sixel_state, params, G_N_ELEMENTS(params));
+
+                m_sixel_streaming = true;
+                m_sixel_lead_byte = 0;
+                return;
+        }
+
+        /* Terminated; insert the image, if any was started */
+        if (m_sixel_state.image.bands == nullptr)
+                return;
+
+        seq_load_sixel();
 }
 
 void